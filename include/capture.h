@@ -0,0 +1,132 @@
+#ifndef ISOLATE_CAPTURE_H
+#define ISOLATE_CAPTURE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @def CAPTURE_SIZE_DEFAULT
+ * @brief Размер файла журнала по умолчанию, байт; вместе с предыдущим
+ *        файлом журнал потока занимает не больше двух таких размеров.
+ */
+#define CAPTURE_SIZE_DEFAULT (1024 * 1024)
+
+/**
+ * @def CAPTURE_BURST_MIN
+ * @brief Минимальный запас лимита скорости, байт: буфер канала (64 КиБ).
+ */
+#define CAPTURE_BURST_MIN (64 * 1024)
+
+/**
+ * @def CAPTURE_CHUNK
+ * @brief Максимум байт, переносимых из одного канала за одно событие, чтобы
+ *        одна песочница не задерживала остальные.
+ */
+#define CAPTURE_CHUNK (1024 * 1024)
+
+/**
+ * @brief Поток вывода песочницы
+ */
+enum capture_stream_id {
+    CAPTURE_STDOUT = 0,
+    CAPTURE_STDERR,
+    CAPTURE_STREAMS
+};
+
+/**
+ * @struct capture_opts
+ * @brief Параметры записи вывода песочниц в журналы.
+ */
+struct capture_opts {
+    const char *dir;    /**< Каталог журналов или NULL (вывод не перехватывается) */
+    uint64_t size;      /**< Размер файла журнала, байт (0 — CAPTURE_SIZE_DEFAULT) */
+    uint64_t rate;      /**< Лимит записи на песочницу, байт/с (0 — без лимита) */
+    int tee;            /**< Дублировать вывод в stdout/stderr запускающего процесса */
+};
+
+/**
+ * @struct capture_stream
+ * @brief Канал одного потока и текущий файл его журнала.
+ */
+struct capture_stream {
+    int pipe;           /**< Читающий конец канала или -1 */
+    int file;           /**< Текущий файл журнала или -1 */
+    int mirror;         /**< Канал для tee() или -1 */
+    size_t mirrored;    /**< Байты в начале канала, уже скопированные в mirror */
+    off_t off;          /**< Позиция записи в текущем файле */
+    uint64_t bytes;     /**< Всего записано байт */
+};
+
+/**
+ * @struct capture
+ * @brief Журналы stdout и stderr одной песочницы с общим лимитом скорости.
+ */
+struct capture {
+    const struct capture_opts *opts;  /**< Параметры или NULL */
+    int id;             /**< Номер экземпляра */
+    pid_t pid;          /**< PID процесса песочницы (в именах файлов) */
+    struct capture_stream s[CAPTURE_STREAMS];  /**< stdout и stderr */
+    uint64_t tokens;    /**< Доступный запас лимита, байт */
+    uint64_t refill_us; /**< Момент последнего пополнения запаса */
+    uint64_t throttled_us;  /**< Суммарное время ожидания лимита, мкс */
+};
+
+/**
+ * @brief Создаёт каналы для stdout и stderr будущей песочницы.
+ *
+ * Читающие концы получают O_NONBLOCK и остаются в c, пишущие возвращаются
+ * в wr для dup2() в дочернем процессе. Оба конца — O_CLOEXEC.
+ *
+ * @param c Журналы для инициализации
+ * @param opts Параметры (opts->dir не NULL); должны жить дольше c
+ * @param wr Пишущие концы для stdout и stderr
+ * @return 0 или -errno
+ */
+int capture_init(struct capture *c, const struct capture_opts *opts,
+                 int wr[CAPTURE_STREAMS]);
+
+/**
+ * @brief Открывает файлы журналов <dir>/<id>-<pid>.stdout и .stderr.
+ *
+ * @param c Журналы после capture_init()
+ * @param id Номер экземпляра
+ * @param pid PID процесса песочницы
+ * @return 0 или -errno
+ */
+int capture_open(struct capture *c, int id, pid_t pid);
+
+/**
+ * @brief Переносит данные из канала в журнал через splice() без
+ *        копирования в пространство пользователя.
+ *
+ * При включённом tee данные сначала дублируются tee() в канал
+ * запускающего процесса. Когда файл журнала достигает opts->size, он
+ * переименовывается в <имя>.1 (прежний .1 удаляется), и запись начинается в
+ * новый файл. Если запас лимита скорости исчерпан, данные остаются в канале:
+ * песочница блокируется на записи, пока запас не восстановится.
+ *
+ * @param c Журналы
+ * @param i Поток (CAPTURE_STDOUT или CAPTURE_STDERR)
+ * @param wait_us Время до восстановления запаса, если лимит исчерпан
+ * @return 0 — канал пуст, 1 — лимит исчерпан, -1 — конец потока
+ *         (канал закрыт), иначе -errno
+ */
+int capture_pump(struct capture *c, int i, uint64_t *wait_us);
+
+/**
+ * @brief Переносит остаток данных из каналов без учёта лимита и закрывает
+ *        каналы и файлы.
+ *
+ * @param c Журналы
+ */
+void capture_close(struct capture *c);
+
+/**
+ * @brief Разбирает размер в байтах с двоичным множителем ("256K", "16M").
+ *
+ * @param arg Значение опции
+ * @return Размер; вызывает die() для некорректного значения
+ */
+uint64_t capture_parse_size(const char *arg);
+
+#endif //ISOLATE_CAPTURE_H
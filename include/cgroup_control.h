@@ -1,56 +1,296 @@
 #ifndef CGROUP_CONTROL_H
 #define CGROUP_CONTROL_H
 
+#include <stdio.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+/**
+ * @struct cgroup_io_opts
+ * @brief Ограничения ввода-вывода экземпляра на устройстве rootfs.
+ *
+ * Нулевое значение означает отсутствие ограничения.
+ */
+struct cgroup_io_opts {
+    const char *device;     /**< Блочное устройство ("MAJ:MIN" или путь) или NULL — устройство rootfs */
+    uint64_t rbps;          /**< Чтение, байт/с */
+    uint64_t wbps;          /**< Запись, байт/с */
+    uint64_t riops;         /**< Операций чтения в секунду */
+    uint64_t wiops;         /**< Операций записи в секунду */
+    uint64_t latency_us;    /**< Целевая задержка io.latency, мкс */
+};
+
+/**
+ * @struct cgroup_usage
+ * @brief Потребление ресурсов cgroup экземпляра.
+ *
+ * Значение -1 означает, что файл отсутствует (контроллер не включён или
+ * ядро его не поддерживает).
+ */
+struct cgroup_usage {
+    long long cpu_usage_usec;       /**< cpu.stat usage_usec */
+    long long cpu_user_usec;        /**< cpu.stat user_usec */
+    long long cpu_system_usec;      /**< cpu.stat system_usec */
+    long long cpu_nr_throttled;     /**< cpu.stat nr_throttled */
+    long long cpu_throttled_usec;   /**< cpu.stat throttled_usec */
+    long long memory_peak;          /**< memory.peak, байт */
+    long long memory_high;          /**< memory.events high */
+    long long memory_oom;           /**< memory.events oom */
+    long long memory_oom_kill;      /**< memory.events oom_kill */
+    long long pids_peak;            /**< pids.peak */
+    long long io_rbytes;            /**< io.stat rbytes, сумма по устройствам */
+    long long io_wbytes;            /**< io.stat wbytes, сумма по устройствам */
+    long long io_rios;              /**< io.stat rios, сумма по устройствам */
+    long long io_wios;              /**< io.stat wios, сумма по устройствам */
+};
+
 /**
  * @brief Создаёт директорию cgroup для проекта (если отсутствует)
  *
- * Каталог создаётся по пути /sys/fs/cgroup/isolate_group.
- * Вызывает ошибку и завершает программу при неудаче.
+ * Каталог создаётся по пути /sys/fs/cgroup/isolate_group, в нём включаются
+ * контроллеры для cgroup экземпляров: cpu, memory и pids обязательно,
+ * cpuset и io — если доступны (иначе выводится предупреждение).
+ *
+ * @return 0 или -errno
  */
-void cgroup_create_directory(void);
+int cgroup_create_directory(void);
 
 /**
  * @brief Устанавливает лимит CPU в микросекундах и период для cpu.max
  *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
  * @param max_quota Ограничение времени использования CPU (например "20000 100000" для 20%)
+ * @return 0 или -errno
+ */
+int cgroup_set_cpu_limit(int cgroup_fd, const char *max_quota);
+
+/**
+ * @brief Устанавливает долю CPU при конкуренции через cpu.weight
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param weight Вес 1..10000 (по умолчанию 100)
+ * @return 0 или -errno
+ */
+int cgroup_set_cpu_weight(int cgroup_fd, const char *weight);
+
+/**
+ * @brief Переводит cgroup в класс SCHED_IDLE через cpu.idle
+ *
+ * Процессы такой cgroup получают CPU, только когда он не нужен остальным.
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param idle 1 — включить, 0 — выключить
+ * @return 0 или -errno
+ */
+int cgroup_set_cpu_idle(int cgroup_fd, int idle);
+
+/**
+ * @brief Ограничивает частоту CPU для процессов cgroup через
+ *        cpu.uclamp.min и cpu.uclamp.max
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param min Нижняя граница в процентах производительности (например "50")
+ * @param max Верхняя граница в процентах или "max"
+ * @return 0 или -errno
  */
-void cgroup_set_cpu_limit(const char *max_quota);
+int cgroup_set_uclamp(int cgroup_fd, const char *min, const char *max);
 
 /**
  * @brief Устанавливает ограничение памяти через memory.max
  *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
  * @param max_value Строка с пределом памяти (например "50000000" или "50M")
+ * @return 0 или -errno
+ */
+int cgroup_set_memory_limit(int cgroup_fd, const char *max_value);
+
+/**
+ * @brief Устанавливает порог мягкого ограничения памяти через memory.high
+ *
+ * При превышении порога процессы cgroup замедляются принудительным
+ * освобождением памяти, но не завершаются OOM killer.
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param high_bytes Порог в байтах или с суффиксом (например "40M")
+ * @return 0 или -errno
  */
-void cgroup_set_memory_limit(const char *max_value);
+int cgroup_set_memory_high(int cgroup_fd, const char *high_bytes);
 
 /**
  * @brief Устанавливает ограничения по I/O вводу-выводу через io.max
  *
- * @param io_limits Строка с ограничениями, зависит от контроллера
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param io_limits Строка "MAJ:MIN" с ключами rbps, wbps, riops, wiops
+ *                  (например "259:0 rbps=10485760 wiops=200")
+ * @return 0 или -errno
+ */
+int cgroup_set_io_limit(int cgroup_fd, const char *io_limits);
+
+/**
+ * @brief Устанавливает целевую задержку ввода-вывода через io.latency
+ *
+ * Если задержка у cgroup с целью превышена, ядро ограничивает глубину
+ * очереди соседних cgroup с менее строгой целью или без неё.
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param target Строка "MAJ:MIN target=<мкс>"
+ * @return 0 или -errno
  */
-void cgroup_set_io_limit(const char *io_limits);
+int cgroup_set_io_latency(int cgroup_fd, const char *target);
+
+/**
+ * @brief Определяет диск, на котором лежит файл, в формате "MAJ:MIN"
+ *
+ * Для файла блочного устройства берётся само устройство, для остальных —
+ * устройство файловой системы; у файловых систем без собственного номера
+ * устройства (btrfs) оно ищется по источнику монтирования в
+ * /proc/self/mountinfo. Раздел заменяется диском, которому он принадлежит:
+ * io.max и io.latency принимают только целые диски. Строка "MAJ:MIN"
+ * принимается как есть, с той же заменой раздела.
+ *
+ * @param path Путь к файлу, каталогу или блочному устройству, либо "MAJ:MIN"
+ * @param dev Буфер для "MAJ:MIN"
+ * @param len Размер буфера
+ * @return 0 или -errno
+ */
+int cgroup_io_device(const char *path, char *dev, size_t len);
+
+/**
+ * @brief Применяет ограничения ввода-вывода к cgroup экземпляра
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param io Ограничения
+ * @param dev Диск в формате "MAJ:MIN" от cgroup_io_device()
+ * @return 0 или -errno (-EOPNOTSUPP, если контроллер io не включён)
+ */
+int cgroup_set_io(int cgroup_fd, const struct cgroup_io_opts *io,
+                  const char *dev);
 
 /**
  * @brief Устанавливает лимит количества PIDs через pids.max
  *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
  * @param max_pids Максимальное число процессов (например "50")
+ * @return 0 или -errno
+ */
+int cgroup_set_pids_limit(int cgroup_fd, const char *max_pids);
+
+/**
+ * @brief Привязывает cgroup к CPU и узлам NUMA через cpuset.cpus и cpuset.mems
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param cpus Список CPU (например "4-7,12-15")
+ * @param mems Список узлов NUMA (например "1")
+ * @return 0 или -errno (-EOPNOTSUPP, если контроллер cpuset не включён)
  */
-void cgroup_set_pids_limit(const char *max_pids);
+int cgroup_set_cpuset(int cgroup_fd, const char *cpus, const char *mems);
 
 /**
  * @brief Добавляет процесс с указанным PID в cgroup
  *
+ * Нужно только на ядрах без clone3(CLONE_INTO_CGROUP).
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
  * @param pid Идентификатор процесса, который нужно добавить
+ * @return 0 или -errno
+ */
+int cgroup_add_process(int cgroup_fd, pid_t pid);
+
+/**
+ * @brief Открывает существующую cgroup экземпляра
+ *
+ * @param name Имя cgroup экземпляра внутри isolate_group
+ * @return Дескриптор директории cgroup экземпляра или -errno
+ */
+int cgroup_open(const char *name);
+
+/**
+ * @brief Создаёт cgroup экземпляра и задаёт стандартные лимиты до создания процесса
+ *
+ * Каталог экземпляра создаётся как /sys/fs/cgroup/isolate_group/<name>.
+ * Возвращённый дескриптор передаётся в clone3(CLONE_INTO_CGROUP). Если
+ * каталог остался от прошлого запуска, его процессы убиваются через
+ * cgroup.kill, и он пересоздаётся; если он не опустел, возвращается ошибка.
+ *
+ * @param name Имя cgroup экземпляра
+ * @return Дескриптор директории cgroup экземпляра или -errno
+ */
+int cgroup_init_and_limit(const char *name);
+
+/**
+ * @brief Завершает все процессы cgroup экземпляра
+ *
+ * Запись в cgroup.kill посылает SIGKILL всем процессам cgroup и её потомков
+ * атомарно относительно fork(): порождённые во время завершения процессы
+ * тоже получают сигнал. На ядрах без cgroup.kill (до 5.14) SIGKILL
+ * посылается процессам из cgroup.procs по одному.
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @return 0 или -errno
+ */
+int cgroup_kill(int cgroup_fd);
+
+/**
+ * @brief Ожидает, пока в cgroup экземпляра не останется процессов
+ *
+ * Ждёт populated 0 в cgroup.events через poll(POLLPRI). Без cgroup.events
+ * cgroup считается пустой.
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param timeout_ms Предельное время ожидания, мс
+ * @return 0 или -errno (-ETIMEDOUT, если процессы остались)
+ */
+int cgroup_wait_empty(int cgroup_fd, int timeout_ms);
+
+/**
+ * @brief Удаляет пустую cgroup экземпляра
+ *
+ * Отсутствующая cgroup не считается ошибкой.
+ *
+ * @param name Имя cgroup экземпляра внутри isolate_group
+ * @return 0 или -errno
+ */
+int cgroup_remove(const char *name);
+
+/**
+ * @brief Считает cgroup экземпляров внутри isolate_group
+ *
+ * @return Число подкаталогов isolate_group или -errno
  */
-void cgroup_add_process(pid_t pid);
+int cgroup_count_instances(void);
 
 /**
- * @brief Инициализирует cgroup и задаёт стандартные лимиты для указанного PID
+ * @brief Читает файл интерфейса cgroup экземпляра
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param file Имя файла (например "cpu.stat")
+ * @param buf Буфер для содержимого (завершается '\0')
+ * @param size Размер буфера
+ * @return Длина содержимого или -1, если файл недоступен
+ */
+ssize_t cgroup_read_file(int cgroup_fd, const char *file,
+                         char *buf, size_t size);
+
+/**
+ * @brief Читает потребление ресурсов cgroup экземпляра
+ *
+ * Вызывается после завершения процесса песочницы, пока cgroup ещё существует:
+ * счётчики cgroup включают потребление уже завершившихся процессов.
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param usage Структура для заполнения
+ */
+void cgroup_read_usage(int cgroup_fd, struct cgroup_usage *usage);
+
+/**
+ * @brief Записывает потребление ресурсов компактным JSON-объектом
+ *        вида {"cpu":{...},"memory":{...},"pids":{...},"io":{...}}
+ *
+ * Отсутствующие значения записываются как null.
  *
- * @param pid PID процесса для добавления в cgroup
+ * @param f Поток для записи
+ * @param usage Потребление ресурсов
  */
-void cgroup_init_and_limit(pid_t pid);
+void cgroup_usage_write_json(FILE *f, const struct cgroup_usage *usage);
 
 #endif // CGROUP_CONTROL_H
@@ -0,0 +1,66 @@
+#ifndef ISOLATE_IMAGE_H
+#define ISOLATE_IMAGE_H
+
+#include <stddef.h>
+#include "sha256.h"
+
+/**
+ * @def IMAGE_STORE
+ * @brief Хранилище образов rootfs, адресуемое содержимым: <sha256>.img.
+ */
+#define IMAGE_STORE "/var/lib/isolate/images"
+
+/**
+ * @def IMAGE_INDEX
+ * @brief Индекс уже посчитанных хэшей: символические ссылки
+ *        <dev>-<ino>-<size>-<mtime> → <sha256> для исходных файлов образов.
+ */
+#define IMAGE_INDEX IMAGE_STORE "/index"
+
+/**
+ * @def IMAGE_MOUNT_DIR
+ * @brief Точки монтирования образов (<sha256>/) и счётчики ссылок на них
+ *        (<sha256>.refs).
+ */
+#define IMAGE_MOUNT_DIR "/run/isolate/images"
+
+/**
+ * @brief Проверяет, является ли rootfs файлом образа, а не каталогом.
+ *
+ * @param path Путь к rootfs
+ * @return 1 для обычного файла, иначе 0
+ */
+int image_is_file(const char *path);
+
+/**
+ * @brief Подключает образ erofs или squashfs как корень экземпляра.
+ *
+ * Образ копируется в IMAGE_STORE под именем своего SHA-256 (один раз на
+ * содержимое: повторные запуски находят хэш по индексу без чтения файла) и
+ * монтируется только для чтения через loop-устройство (LOOP_CONFIGURE,
+ * прямой ввод-вывод, автоотключение) в IMAGE_MOUNT_DIR/<sha256>. Все
+ * экземпляры с одинаковым образом используют одно монтирование и общий кэш
+ * страниц; экземпляр записывается в счётчик ссылок образа.
+ *
+ * @param path Путь к файлу образа
+ * @param id Номер экземпляра-владельца ссылки
+ * @param digest Буфер для хэша образа (для image_release())
+ * @param root Буфер для пути к смонтированному корню
+ * @param len Размер буфера root
+ * @return 0 или -errno
+ */
+int image_acquire(const char *path, int id, char digest[SHA256_HEX_SIZE],
+                  char *root, size_t len);
+
+/**
+ * @brief Снимает ссылку экземпляра на образ; образ без ссылок отмонтируется,
+ *        и loop-устройство освобождается.
+ *
+ * Ссылки аварийно завершившихся экземпляров снимаются здесь же.
+ *
+ * @param digest Хэш образа, полученный от image_acquire()
+ * @param id Номер экземпляра
+ */
+void image_release(const char *digest, int id);
+
+#endif //ISOLATE_IMAGE_H
@@ -0,0 +1,138 @@
+#ifndef ISOLATE_INSTANCE_H
+#define ISOLATE_INSTANCE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "sha256.h"
+
+/**
+ * @def INSTANCE_DIR
+ * @brief Каталог с файлами блокировок номеров экземпляров.
+ */
+#define INSTANCE_DIR "/run/isolate/instances"
+
+/**
+ * @def INSTANCE_SUBNET
+ * @brief Пул адресов песочниц (10.1.0.0/16), делится на подсети /30.
+ */
+#define INSTANCE_SUBNET 0x0a010000u
+
+/**
+ * @def INSTANCE_PREFIXLEN
+ * @brief Длина префикса подсети экземпляра.
+ */
+#define INSTANCE_PREFIXLEN 30
+
+/**
+ * @def INSTANCE_MAX
+ * @brief Число номеров экземпляров: по одной подсети /30 из /16 на экземпляр.
+ */
+#define INSTANCE_MAX (1 << (INSTANCE_PREFIXLEN - 16))
+
+/**
+ * @def INSTANCE_SUBID_SIZE
+ * @brief Размер диапазона UID и GID одного экземпляра: полный набор
+ *        идентификаторов 0..65535 внутри песочницы.
+ */
+#define INSTANCE_SUBID_SIZE 65536
+
+/**
+ * @def INSTANCE_SUBID_USER
+ * @brief Пользователь, чьи диапазоны из /etc/subuid и /etc/subgid делятся
+ *        между экземплярами.
+ */
+#define INSTANCE_SUBID_USER "isolate"
+
+/**
+ * @def INSTANCE_SUBID_BASE
+ * @brief Начало диапазонов экземпляров, если в /etc/subuid или /etc/subgid
+ *        нет записи INSTANCE_SUBID_USER: выше UID обычных пользователей и
+ *        диапазонов, которые выдаёт useradd.
+ */
+#define INSTANCE_SUBID_BASE 0x10000000u
+
+/**
+ * @brief Выделяет свободный номер экземпляра.
+ *
+ * Номер принадлежит процессу, пока открыт возвращённый дескриптор с flock():
+ * номера разных процессов isolate не пересекаются, а при аварийном завершении
+ * процесса номер освобождается ядром. Поиск начинается с позиции, зависящей
+ * от PID, поэтому параллельные запуски почти не конкурируют за одни файлы.
+ *
+ * @param lock_fd Указатель для сохранения дескриптора блокировки
+ * @return Номер экземпляра в диапазоне [0, INSTANCE_MAX) или -errno
+ *         (-EAGAIN, если свободных номеров нет)
+ */
+int instance_acquire(int *lock_fd);
+
+/**
+ * @brief Записывает PID процесса песочницы и хэш её фильтра seccomp в файл
+ *        блокировки номера.
+ *
+ * По ним isolate exec находит запущенную песочницу и ставит команде тот же
+ * фильтр.
+ *
+ * @param lock_fd Дескриптор блокировки, полученный от instance_acquire()
+ * @param pid PID процесса песочницы в пространстве имён хоста
+ * @param seccomp Хэш программы в SECCOMP_CACHE или "" (без фильтра)
+ * @return 0 или -errno
+ */
+int instance_set_pid(int lock_fd, pid_t pid, const char *seccomp);
+
+/**
+ * @brief Проверяет, занят ли номер экземпляра каким-либо процессом.
+ *
+ * @param id Номер экземпляра
+ * @return 1, если номер занят, иначе 0
+ */
+int instance_running(int id);
+
+/**
+ * @brief Находит PID процесса запущенной песочницы по номеру экземпляра.
+ *
+ * @param id Номер экземпляра
+ * @param pid Указатель для PID процесса песочницы в пространстве имён хоста
+ * @param seccomp Буфер для хэша фильтра seccomp песочницы ("" — без
+ *        фильтра) или NULL
+ * @return 0 или -errno (-ESRCH, если номер свободен, -EAGAIN, если PID ещё
+ *         не записан)
+ */
+int instance_pid(int id, pid_t *pid, char seccomp[SHA256_HEX_SIZE]);
+
+/**
+ * @brief Освобождает номер экземпляра.
+ *
+ * @param lock_fd Дескриптор блокировки, полученный от instance_acquire()
+ */
+void instance_release(int lock_fd);
+
+/**
+ * @brief Вычисляет диапазоны UID и GID хоста, на которые отображаются
+ *        идентификаторы песочницы.
+ *
+ * Экземпляр id получает срез INSTANCE_SUBID_SIZE с номером id из диапазона
+ * INSTANCE_SUBID_USER в /etc/subuid и /etc/subgid (или от
+ * INSTANCE_SUBID_BASE), поэтому одновременно работающие песочницы не делят
+ * UID между собой. Файлы прочитываются один раз за процесс.
+ *
+ * @param id Номер экземпляра
+ * @param uid Указатель для первого UID хоста (root песочницы)
+ * @param gid Указатель для первого GID хоста
+ * @return 0 или -ERANGE, если диапазон INSTANCE_SUBID_USER меньше нужного
+ */
+int instance_subids(int id, uid_t *uid, gid_t *gid);
+
+/**
+ * @brief Вычисляет адреса подсети /30 экземпляра (IPAM).
+ *
+ * Экземпляр id получает подсеть 10.1.0.0 + 4 * id: первый адрес — сторона
+ * хоста, второй — песочница.
+ *
+ * @param id Номер экземпляра
+ * @param host Буфер для адреса стороны хоста
+ * @param peer Буфер для адреса песочницы
+ * @param len Размер буферов (не меньше INET_ADDRSTRLEN)
+ */
+void instance_addrs(int id, char *host, char *peer, size_t len);
+
+#endif //ISOLATE_INSTANCE_H
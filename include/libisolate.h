@@ -0,0 +1,77 @@
+#ifndef ISOLATE_LIBISOLATE_H
+#define ISOLATE_LIBISOLATE_H
+
+#include "sandbox.h"
+
+/**
+ * @struct isolate
+ * @brief Запущенная песочница, принадлежащая встроившему библиотеку процессу.
+ *
+ * Функции libisolate не завершают процесс и не используют разделяемого
+ * изменяемого состояния, кроме атомарного счётчика номеров экземпляров и
+ * однократно загружаемой топологии CPU, поэтому разные экземпляры можно
+ * запускать и ждать из разных потоков. Один экземпляр одновременно
+ * используется только одним потоком.
+ */
+struct isolate;
+
+/**
+ * @brief Создаёт песочницу и дожидается запуска в ней команды.
+ *
+ * @param out Указатель для созданного экземпляра
+ * @param opts Параметры песочницы
+ * @param argv Команда для запуска
+ * @return 0 или -errno: ошибку создания песочницы либо errno неудачного
+ *         execvp() в ней. При ошибке все ресурсы уже освобождены.
+ */
+int isolate_spawn(struct isolate **out, const struct sandbox_opts *opts,
+                  char **argv);
+
+/**
+ * @brief Номер экземпляра (имена cgroup, veth и подсеть).
+ */
+int isolate_id(const struct isolate *iso);
+
+/**
+ * @brief pidfd процесса песочницы для собственного цикла poll()/epoll
+ *        вызывающего: становится читаемым при завершении процесса.
+ *
+ * @return Дескриптор или -1 на ядрах без pidfd
+ */
+int isolate_pidfd(const struct isolate *iso);
+
+/**
+ * @brief Отправляет сигнал процессу песочницы; SIGKILL завершает весь её
+ *        PID namespace.
+ *
+ * @return 0 или -errno
+ */
+int isolate_kill(struct isolate *iso, int sig);
+
+/**
+ * @brief Ожидает завершения песочницы и освобождает её номер экземпляра,
+ *        CPU и дескриптор cgroup.
+ *
+ * @param iso Экземпляр
+ * @param usage Потребление ресурсов cgroup или NULL
+ * @return Статус завершения в формате waitpid() или -errno
+ */
+int isolate_wait(struct isolate *iso, struct cgroup_usage *usage);
+
+/**
+ * @brief Сетевые счётчики интерфейса песочницы: текущие, а после
+ *        isolate_wait() — итоговые.
+ *
+ * @param iso Экземпляр
+ * @param st Счётчики с точки зрения песочницы
+ * @return 0 или -errno
+ */
+int isolate_net_stats(const struct isolate *iso, struct net_stats *st);
+
+/**
+ * @brief Освобождает экземпляр. Если песочница ещё не дождана через
+ *        isolate_wait(), она завершается через SIGKILL и дожидается.
+ */
+void isolate_free(struct isolate *iso);
+
+#endif //ISOLATE_LIBISOLATE_H
@@ -2,6 +2,7 @@
 #define ISOLATE_NETNS_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <linux/rtnetlink.h>
 #include <linux/veth.h>
@@ -13,23 +14,7 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <sys/ioctl.h>
-
-/**
- * @def MAX_PAYLOAD
- * @brief Максимальный размер полезной нагрузки для Netlink сообщений.
- */
-#define MAX_PAYLOAD 1024
-
-/**
- * @struct nl_req
- * @brief Структура для формирования Netlink запроса с информацией об интерфейсе.
- */
-struct nl_req {
-    struct nlmsghdr n;      /**< Заголовок Netlink сообщения */
-    struct ifinfomsg i;     /**< Структура с информацией об интерфейсе */
-    char buf[MAX_PAYLOAD];  /**< Буфер полезной нагрузки */
-};
+#include "timing.h"
 
 /**
  * @def NLMSG_TAIL(nmsg)
@@ -41,48 +26,412 @@ struct nl_req {
 #define NLMSG_TAIL(nmsg) \
     ((struct rtattr *) (((void *) (nmsg)) + NLMSG_ALIGN((nmsg)->nlmsg_len)))
 
+/**
+ * @def NET_QUEUES_MAX
+ * @brief Максимальное число очередей интерфейса для драйвера veth-mq.
+ */
+#define NET_QUEUES_MAX 64
+
+/**
+ * @def NET_BURST_MIN
+ * @brief Минимальный запас (burst) лимита скорости по умолчанию, байт:
+ *        больше пакета GSO/GRO (64 КиБ), иначе полисер отбросит любой такой пакет.
+ */
+#define NET_BURST_MIN (128 * 1024)
+
+/**
+ * @brief Тип сетевого интерфейса песочницы
+ */
+enum net_driver {
+    NET_DRIVER_VETH = 0,  /**< Пара veth с одной очередью */
+    NET_DRIVER_VETH_MQ,   /**< Пара veth с очередью на каждый CPU песочницы и GRO (NAPI) */
+    NET_DRIVER_IPVLAN,    /**< Дочерние интерфейсы ipvlan (L2) на uplink хоста */
+    NET_DRIVER_MACVLAN,   /**< Дочерние интерфейсы macvlan (bridge) на uplink хоста */
+    NET_DRIVER_NETKIT,    /**< Пара netkit (L3, ядро 6.7+), иначе veth */
+};
+
+/**
+ * @struct net_opts
+ * @brief Параметры сети песочницы.
+ */
+struct net_opts {
+    enum net_driver driver;   /**< Тип интерфейса */
+    const char *uplink;       /**< Интерфейс хоста для ipvlan и macvlan */
+    uint64_t rate;            /**< Лимит скорости в каждую сторону, байт/с (0 — без лимита) */
+    __u32 burst;              /**< Запас лимита в байтах (0 — net_default_burst()) */
+};
+
 /**
  * @brief Создает сокет для работы с сетевыми операциями.
  * 
  * @param domain Домен сокета (например, AF_NETLINK)
  * @param type Тип сокета (например, SOCK_RAW)
  * @param protocol Протокол сокета (например, NETLINK_ROUTE)
- * @return Дескриптор созданного сокета или -1 в случае ошибки.
+ * @return Дескриптор созданного сокета или -errno
  */
 int create_socket(int domain, int type, int protocol);
 
 /**
- * @brief Активирует сетевой интерфейс и назначает ему IP адрес и маску.
- * 
- * @param ifname Имя интерфейса (например, "veth0")
- * @param ip IP адрес в строковом формате (например, "192.168.1.10")
- * @param netmask Маска подсети в строковом формате (например, "255.255.255.0")
+ * @def NL_BATCH_SIZE
+ * @brief Размер буфера пакета Netlink запросов.
  */
-void if_up(char *ifname, char *ip, char *netmask);
+#define NL_BATCH_SIZE 8192
 
 /**
- * @brief Создает пару виртуальных Ethernet интерфейсов (veth pair).
- * 
- * @param sock_fd Дескриптор сокета Netlink
- * @param ifname Имя первого интерфейса пары
+ * @def NL_RECV_SIZE
+ * @brief Размер буфера для приёма ответов Netlink.
+ */
+#define NL_RECV_SIZE 16384
+
+/**
+ * @struct nl_batch
+ * @brief Пакет Netlink запросов, отправляемых одним sendmsg().
+ *
+ * Каждый запрос получает свой номер последовательности и флаг NLM_F_ACK;
+ * все подтверждения собираются одним вызовом nl_batch_wait().
+ */
+struct nl_batch {
+    char buf[NL_BATCH_SIZE] __attribute__((aligned(NLMSG_ALIGNTO))); /**< Сообщения */
+    __u32 len;      /**< Суммарная длина сообщений */
+    __u32 seq;      /**< Номер последнего добавленного сообщения */
+    int pending;    /**< Число сообщений, ожидающих подтверждения */
+    __u32 optional; /**< Битовая маска (seq - 1) запросов, для которых ENODEV и ENOENT не ошибка */
+    int error;      /**< Ошибка построения пакета (-errno), возвращается nl_batch_send() */
+    int quiet;      /**< Ожидаемая ошибка ответа (-errno): возвращается без сообщения */
+};
+
+/**
+ * @struct nl_rx
+ * @brief Буфер приёма ответов Netlink, переиспользуемый между пакетами.
+ *
+ * Выделяется при первом приёме (не меньше NL_RECV_SIZE) и растёт, если
+ * датаграмма в него не помещается. Нулевая структура — пустой буфер.
+ */
+struct nl_rx {
+    char *buf;      /**< Буфер или NULL */
+    size_t size;    /**< Размер буфера */
+};
+
+/**
+ * @struct net_stats
+ * @brief Счётчики сетевого интерфейса песочницы (IFLA_STATS64) с точки
+ *        зрения песочницы: rx — принято песочницей, tx — отправлено ею.
+ */
+struct net_stats {
+    uint64_t rx_bytes;      /**< Принято байт */
+    uint64_t tx_bytes;      /**< Отправлено байт */
+    uint64_t rx_packets;    /**< Принято пакетов */
+    uint64_t tx_packets;    /**< Отправлено пакетов */
+    uint64_t rx_dropped;    /**< Отброшено пакетов на приёме */
+    uint64_t tx_dropped;    /**< Отброшено пакетов на передаче */
+    uint64_t rx_errors;     /**< Ошибок приёма */
+    uint64_t tx_errors;     /**< Ошибок передачи */
+};
+
+/**
+ * @brief Обработчик сообщений Netlink, не являющихся подтверждениями.
+ */
+typedef void (*nl_handler)(struct nlmsghdr *n, void *arg);
+
+/**
+ * @brief Очищает пакет запросов.
+ *
+ * @param b Пакет запросов
+ */
+void nl_batch_init(struct nl_batch *b);
+
+/**
+ * @brief Добавляет запрос на создание пары veth или netkit, второй конец
+ *        которой сразу создаётся в заданном network namespace (IFLA_NET_NS_FD
+ *        в атрибуте второго конца).
+ *
+ * @param b Пакет запросов
+ * @param kind Тип пары ("veth" или "netkit")
+ * @param ifname Имя интерфейса в текущем namespace
  * @param peername Имя второго интерфейса пары
+ * @param peer_netns Дескриптор network namespace для второго интерфейса
+ * @param queues Число очередей передачи и приёма каждого конца (1 — по умолчанию)
  */
-void create_veth(int sock_fd, char *ifname, char *peername);
+void nl_batch_pair(struct nl_batch *b, const char *kind, const char *ifname,
+                   const char *peername, int peer_netns, int queues);
 
 /**
- * @brief Перемещает сетевой интерфейс в сетевое пространство имен процесса.
- * 
- * @param sock_fd Дескриптор сокета Netlink
- * @param ifname Имя интерфейса, который нужно переместить
- * @param netns Дескриптор сетевого пространства имен (file descriptor)
+ * @brief Добавляет запрос на создание дочернего интерфейса ipvlan (режим L2)
+ *        или macvlan (режим bridge) на интерфейсе хоста.
+ *
+ * @param b Пакет запросов
+ * @param kind "ipvlan" или "macvlan"
+ * @param ifname Имя нового интерфейса
+ * @param uplink Индекс родительского интерфейса в текущем namespace
+ * @param netns Дескриптор network namespace для нового интерфейса или -1
+ */
+void nl_batch_slave(struct nl_batch *b, const char *kind, const char *ifname,
+                    int uplink, int netns);
+
+/**
+ * @brief Добавляет запросы, ограничивающие скорость интерфейса в обе
+ *        стороны.
+ *
+ * Исходящий трафик проходит через корневой tbf (handle 1:) с дочерним fq
+ * (10:), который делит полосу между потоками; без sch_fq в ядре остаётся
+ * очередь FIFO tbf. Входящий трафик ограничивает полисер (действие police
+ * фильтра u32 в очереди ingress), отбрасывающий пакеты сверх скорости.
+ *
+ * @param b Пакет запросов
+ * @param ifindex Индекс интерфейса
+ * @param rate Скорость, байт/с (больше 0)
+ * @param burst Запас в байтах
+ */
+void nl_batch_shape(struct nl_batch *b, int ifindex, uint64_t rate, __u32 burst);
+
+/**
+ * @brief Добавляет запрос RTM_DELLINK по имени интерфейса.
+ *
+ * Отсутствие интерфейса (ENODEV) не считается ошибкой.
+ *
+ * @param b Пакет запросов
+ * @param ifname Имя интерфейса
+ */
+void nl_batch_dellink(struct nl_batch *b, const char *ifname);
+
+/**
+ * @brief Добавляет запрос RTM_GETLINK по имени интерфейса.
+ *
+ * @param b Пакет запросов
+ * @param ifname Имя интерфейса
+ */
+void nl_batch_getlink(struct nl_batch *b, const char *ifname);
+
+/**
+ * @brief Добавляет запрос RTM_NEWADDR с IPv4 адресом.
+ *
+ * @param b Пакет запросов
+ * @param ifindex Индекс интерфейса
+ * @param ip IP адрес в строковом формате (например, "10.1.1.1")
+ * @param prefixlen Длина префикса подсети (например, 24)
+ */
+void nl_batch_addr(struct nl_batch *b, int ifindex,
+                   const char *ip, int prefixlen);
+
+/**
+ * @brief Добавляет запрос RTM_NEWLINK, поднимающий интерфейс (IFF_UP).
+ *
+ * @param b Пакет запросов
+ * @param ifindex Индекс интерфейса
+ */
+void nl_batch_link_up(struct nl_batch *b, int ifindex);
+
+/**
+ * @brief Добавляет запрос RTM_GETSTATS со счётчиками IFLA_STATS_LINK_64.
+ *
+ * @param b Пакет запросов
+ * @param ifindex Индекс интерфейса или 0 — дамп всех интерфейсов namespace
+ *        (NLM_F_DUMP)
+ */
+void nl_batch_getstats(struct nl_batch *b, int ifindex);
+
+/**
+ * @brief Отправляет все запросы пакета одним sendmsg().
+ *
+ * @param sock_fd Дескриптор Netlink сокета
+ * @param b Пакет запросов
+ * @return 0 или -errno (в том числе ошибка построения пакета)
+ */
+int nl_batch_send(int sock_fd, struct nl_batch *b);
+
+/**
+ * @brief Собирает подтверждения всех запросов пакета.
+ *
+ * Остальные сообщения (например, ответ на RTM_GETLINK) передаются обработчику.
+ * Ответ на запрос NLM_F_DUMP может занять несколько датаграмм (NLM_F_MULTI) и
+ * завершается NLMSG_DONE, который считается его подтверждением. После ошибки
+ * подтверждения оставшихся запросов всё равно дочитываются, поэтому сокет
+ * пригоден для следующего пакета.
+ *
+ * @param sock_fd Дескриптор Netlink сокета
+ * @param b Отправленный пакет запросов
+ * @param rx Буфер приёма
+ * @param handler Обработчик ответов или NULL
+ * @param arg Аргумент обработчика
+ * @return 0 или -errno первого неудачного запроса
+ */
+int nl_batch_wait(int sock_fd, struct nl_batch *b, struct nl_rx *rx,
+                  nl_handler handler, void *arg);
+
+/**
+ * @brief Освобождает буфер приёма.
+ *
+ * @param rx Буфер приёма
+ */
+void nl_rx_free(struct nl_rx *rx);
+
+/**
+ * @brief Создаёт интерфейсы песочницы выбранного драйвера, назначает адреса
+ *        и поднимает оба конца.
+ *
+ * Вся настройка выполняется запросами Netlink без setns(): интерфейс
+ * песочницы создаётся сразу в её namespace и настраивается через сокет,
+ * открытый в нём. Для ipvlan и macvlan на uplink создаётся второй дочерний
+ * интерфейс для хоста, и обмен между хостом и песочницей не покидает драйвер.
+ * Если ядро не поддерживает netkit, создаётся пара veth с именем
+ * интерфейса хоста, как у драйвера veth.
+ *
+ * @param sock_fd Netlink сокет в namespace хоста
+ * @param peer_sock_fd Netlink сокет в namespace песочницы
+ * @param peer_netns Дескриптор network namespace песочницы
+ * @param net Драйвер и uplink
+ * @param queues Число очередей для veth-mq
+ * @param id Номер экземпляра: интерфейс хоста получает имя net_ifname()
+ * @param peername Имя интерфейса в песочнице
+ * @param ip Адрес интерфейса на стороне хоста
+ * @param peer_ip Адрес интерфейса в песочнице
+ * @param prefixlen Длина префикса подсети
+ * @param ifindex Индекс интерфейса на стороне хоста
+ * @param peer_ifindex Индекс интерфейса в песочнице
+ * @param t Длительности фаз veth и addr или NULL
+ * @return 0 или -errno
+ */
+int create_net_link(int sock_fd, int peer_sock_fd, int peer_netns,
+                    const struct net_opts *net, int queues,
+                    int id, const char *peername,
+                    const char *ip, const char *peer_ip, int prefixlen,
+                    int *ifindex, int *peer_ifindex, struct timings *t);
+
+/**
+ * @brief Обработчик счётчиков одного интерфейса из дампа net_stats_dump().
+ */
+typedef void (*net_stats_handler)(int ifindex, const struct net_stats *st,
+                                  void *arg);
+
+/**
+ * @brief Читает счётчики интерфейса песочницы на стороне хоста.
+ *
+ * @param sock_fd Netlink сокет в namespace хоста
+ * @param rx Буфер приёма
+ * @param ifindex Индекс интерфейса на стороне хоста
+ * @param st Счётчики с точки зрения песочницы
+ * @return 0 или -errno
+ */
+int net_stats_read(int sock_fd, struct nl_rx *rx, int ifindex,
+                   struct net_stats *st);
+
+/**
+ * @brief Читает счётчики интерфейса внутри песочницы.
+ *
+ * Нужен для ipvlan и macvlan: их интерфейс на стороне хоста — отдельный
+ * дочерний интерфейс uplink, через который идёт только обмен с хостом.
+ *
+ * @param sock_fd Netlink сокет в namespace песочницы
+ * @param rx Буфер приёма
+ * @param ifindex Индекс интерфейса в namespace песочницы
+ * @param st Счётчики интерфейса
+ * @return 0 или -errno
+ */
+int net_stats_read_peer(int sock_fd, struct nl_rx *rx, int ifindex,
+                        struct net_stats *st);
+
+/**
+ * @brief Читает счётчики всех интерфейсов namespace одним дампом
+ *        RTM_GETSTATS.
+ *
+ * Один запрос на все песочницы вместо запроса на каждую; ответ приходит
+ * несколькими датаграммами (NLM_F_MULTI) и завершается NLMSG_DONE.
+ *
+ * @param sock_fd Netlink сокет в namespace хоста
+ * @param rx Буфер приёма
+ * @param handler Вызывается для каждого интерфейса со счётчиками с точки
+ *        зрения песочницы (передача хоста — приём песочницы)
+ * @param arg Аргумент обработчика
+ * @return 0 или -errno
+ */
+int net_stats_dump(int sock_fd, struct nl_rx *rx, net_stats_handler handler,
+                   void *arg);
+
+/**
+ * @brief Пишет счётчики объектом JSON.
+ *
+ * @param f Поток вывода
+ * @param st Счётчики
+ */
+void net_stats_write_json(FILE *f, const struct net_stats *st);
+
+/**
+ * @brief Формирует имя интерфейса экземпляра на стороне хоста
+ *        (veth<id>, ipvl<id>, mvl<id> или nk<id>).
+ *
+ * @param driver Драйвер
+ * @param id Номер экземпляра
+ * @param buf Буфер для имени
+ * @param len Размер буфера (IFNAMSIZ)
+ */
+void net_ifname(enum net_driver driver, int id, char *buf, size_t len);
+
+/**
+ * @brief Удаляет через RTM_DELLINK интерфейс экземпляра на стороне хоста,
+ *        который не исчезает вместе с namespace песочницы (ipvlan и macvlan).
+ *
+ * Пары veth и netkit удаляет ядро при уничтожении namespace песочницы: оно
+ * выполняется асинхронно и одним проходом для всех завершившихся
+ * namespace, тогда как RTM_DELLINK ждёт период RCU под rtnl_lock на каждый
+ * интерфейс. Отсутствие интерфейса не считается ошибкой.
+ *
+ * @param sock_fd Сокет NETLINK_ROUTE
+ * @param rx Буфер приёма
+ * @param driver Драйвер
+ * @param id Номер экземпляра
+ * @return 0 или -errno
+ */
+int net_release(int sock_fd, struct nl_rx *rx, enum net_driver driver, int id);
+
+/**
+ * @brief Разбирает имя драйвера ("veth", "veth-mq", "ipvlan", "macvlan",
+ *        "netkit").
+ *
+ * @param name Имя драйвера
+ * @return Драйвер; вызывает die() для неизвестного имени
+ */
+enum net_driver net_driver_parse(const char *name);
+
+/**
+ * @brief Запас лимита скорости по умолчанию: 10 мс на заданной скорости,
+ *        но не меньше NET_BURST_MIN.
+ *
+ * @param rate Скорость, байт/с
+ * @return Запас в байтах
+ */
+__u32 net_default_burst(uint64_t rate);
+
+/**
+ * @brief Разбирает лимит скорости в битах в секунду с десятичным множителем
+ *        ("100m", "1g", "500kbit") в net->rate.
+ *
+ * @param arg Значение опции --rate
+ * @param net Параметры сети
+ */
+void net_parse_rate(const char *arg, struct net_opts *net);
+
+/**
+ * @brief Разбирает запас лимита в байтах с двоичным множителем ("256K")
+ *        в net->burst.
+ *
+ * @param arg Значение опции --burst
+ * @param net Параметры сети
+ */
+void net_parse_burst(const char *arg, struct net_opts *net);
+
+/**
+ * @brief Возвращает имя драйвера для вывода.
+ *
+ * @param driver Драйвер
+ * @return Имя, принимаемое net_driver_parse()
  */
-void move_if_to_pid_netns(int sock_fd, char *ifname, int netns);
+const char *net_driver_name(enum net_driver driver);
 
 /**
  * @brief Получает файловый дескриптор сетевого пространства имен заданного PID.
  * 
  * @param pid Идентификатор процесса (PID)
- * @return Дескриптор сетевого пространства имен или -1 при ошибке
+ * @return Дескриптор сетевого пространства имен или -errno
  */
 int get_netns_fd(int pid);
 
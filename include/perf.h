@@ -0,0 +1,84 @@
+#ifndef ISOLATE_PERF_H
+#define ISOLATE_PERF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * @brief Счётчики, открываемые для cgroup экземпляра
+ */
+enum perf_counter {
+    PERF_CYCLES = 0,        /**< Такты CPU */
+    PERF_INSTRUCTIONS,      /**< Выполненные инструкции */
+    PERF_LLC_MISSES,        /**< Промахи кэша последнего уровня */
+    PERF_CONTEXT_SWITCHES,  /**< Переключения контекста (программный) */
+    PERF_CPU_CLOCK,         /**< Время работы процессов экземпляра на CPU, нс (программный) */
+    PERF_COUNTERS
+};
+
+/**
+ * @def PERF_CPUS_LEN
+ * @brief Размер строки со списком CPU, на которых работал экземпляр.
+ */
+#define PERF_CPUS_LEN 256
+
+/**
+ * @struct perf
+ * @brief Группы счётчиков perf_event в режиме cgroup, по одной на CPU.
+ */
+struct perf {
+    int *fd;        /**< Дескрипторы [cpu * PERF_COUNTERS + счётчик] или -1; NULL — не открыты */
+    int ncpus;      /**< Число CPU в fd */
+    int hardware;   /**< Открыты аппаратные счётчики (иначе только программные) */
+};
+
+/**
+ * @struct perf_counts
+ * @brief Суммы счётчиков по всем CPU.
+ */
+struct perf_counts {
+    uint64_t value[PERF_COUNTERS];  /**< Значения, масштабированные при мультиплексировании */
+    int hardware;       /**< Аппаратные счётчики были доступны */
+    int multiplexed;    /**< Группы делили PMU с другими событиями, значения оценочные */
+    char cpus[PERF_CPUS_LEN];  /**< CPU, на которых работал экземпляр ("0-3,8") */
+};
+
+/**
+ * @brief Открывает счётчики perf_event для cgroup (PERF_FLAG_PID_CGROUP) на
+ *        каждом CPU из её cpuset.cpus.effective (без cpuset — на всех).
+ *
+ * Счётчики одного CPU открываются группой, чтобы такты и инструкции
+ * считались одновременно. Если аппаратного PMU нет (например, в
+ * виртуальной машине), открываются только программные счётчики; об этом
+ * сообщается один раз на процесс.
+ *
+ * @param p Структура для заполнения
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @return 0 или -errno
+ */
+int perf_open(struct perf *p, int cgroup_fd);
+
+/**
+ * @brief Читает и суммирует счётчики всех CPU
+ *
+ * @param p Открытые счётчики
+ * @param counts Структура для заполнения
+ */
+void perf_read(const struct perf *p, struct perf_counts *counts);
+
+/**
+ * @brief Закрывает счётчики (допускает повторный вызов и неоткрытые счётчики)
+ */
+void perf_close(struct perf *p);
+
+/**
+ * @brief Записывает счётчики JSON-объектом вида {"mode":"hardware",
+ *        "cycles":N,...,"ipc":X,"cpus":"0-3"}; недоступные при программном
+ *        режиме значения записываются как null.
+ *
+ * @param f Поток для записи
+ * @param counts Счётчики
+ */
+void perf_write_json(FILE *f, const struct perf_counts *counts);
+
+#endif //ISOLATE_PERF_H
@@ -0,0 +1,76 @@
+#ifndef ISOLATE_PLACEMENT_H
+#define ISOLATE_PLACEMENT_H
+
+#include <stddef.h>
+
+/**
+ * @def PLACEMENT_STATE
+ * @brief Файл с занятостью CPU, общий для всех процессов isolate.
+ */
+#define PLACEMENT_STATE "/run/isolate/placement"
+
+/**
+ * @def PLACEMENT_LLC_MAX
+ * @brief Максимальное число доменов общего кэша последнего уровня (LLC).
+ */
+#define PLACEMENT_LLC_MAX 256
+
+/**
+ * @brief Политика выбора домена LLC для нового экземпляра
+ */
+enum placement_policy {
+    PLACEMENT_NONE = 0,   /**< Не задавать cpuset (экземпляр плавает по всем CPU) */
+    PLACEMENT_PACK,       /**< Плотная упаковка: самый загруженный домен, где есть место */
+    PLACEMENT_SPREAD,     /**< Распределение: наименее загруженный домен */
+};
+
+/**
+ * @struct placement_opts
+ * @brief Требования экземпляра к размещению.
+ */
+struct placement_opts {
+    enum placement_policy policy;   /**< Политика размещения */
+    int cpus;                       /**< Число логических CPU для исключительного среза */
+    int exclusive;                  /**< Исключительный срез из целых ядер вместо общего домена */
+};
+
+/**
+ * @brief Выбирает CPU и узлы NUMA для экземпляра.
+ *
+ * Топология (ядра, SMT-соседи, домены LLC, узлы NUMA) читается из sysfs
+ * один раз на процесс через pthread_once(). Исключительный срез состоит из
+ * целых физических ядер (со всеми SMT-соседями) одного домена LLC, если это
+ * возможно, и выдаётся только из доменов без общих экземпляров: ни один
+ * другой экземпляр с размещением на его ядрах не работает. Процессы хоста и
+ * песочницы без размещения этим не ограничены. Общий срез — все не занятые
+ * исключительно CPU одного домена LLC, в котором общих экземпляров не
+ * больше, чем CPU. Занятость хранится в PLACEMENT_STATE под flock(),
+ * поэтому параллельные процессы isolate не выдают одни и те же ядра; записи
+ * аварийно завершившихся экземпляров освобождаются при нехватке CPU.
+ *
+ * @param id Номер экземпляра
+ * @param opts Требования к размещению
+ * @param cpus Буфер для cpuset.cpus (например "4-7")
+ * @param mems Буфер для cpuset.mems (например "0")
+ * @param len Размер буферов
+ * @return 0 или -errno (-EBUSY, если свободных CPU не хватает)
+ */
+int placement_assign(int id, const struct placement_opts *opts,
+                     char *cpus, char *mems, size_t len);
+
+/**
+ * @brief Освобождает CPU, выданные экземпляру.
+ *
+ * @param id Номер экземпляра
+ */
+void placement_release(int id);
+
+/**
+ * @brief Разбирает имя политики ("pack" или "spread").
+ *
+ * @param name Имя политики
+ * @return Политика; вызывает die() для неизвестного имени
+ */
+enum placement_policy placement_policy_parse(const char *name);
+
+#endif //ISOLATE_PLACEMENT_H
@@ -0,0 +1,80 @@
+#ifndef ISOLATE_POOL_H
+#define ISOLATE_POOL_H
+
+#include "sandbox.h"
+#include "supervisor.h"
+
+/**
+ * @def POOL_SOCKET_PATH
+ * @brief Путь к unix-сокету демона пула по умолчанию.
+ */
+#define POOL_SOCKET_PATH "/run/isolate.sock"
+
+/**
+ * @def POOL_MAX
+ * @brief Максимальное число "тёплых" песочниц в пуле.
+ */
+#define POOL_MAX 64
+
+/**
+ * @def POOL_JOBS_MAX
+ * @brief Максимальное число одновременно обслуживаемых заданий.
+ */
+#define POOL_JOBS_MAX 128
+
+/**
+ * @def POOL_REFILL_BACKOFF_MS
+ * @brief Пауза перед повторным пополнением пула после первой неудачи, мс.
+ */
+#define POOL_REFILL_BACKOFF_MS 100
+
+/**
+ * @def POOL_REFILL_BACKOFF_MAX_MS
+ * @brief Предельная пауза между попытками пополнения пула, мс.
+ */
+#define POOL_REFILL_BACKOFF_MAX_MS 10000
+
+/**
+ * @struct pool_reply
+ * @brief Ответ демона клиенту после завершения задания.
+ */
+struct pool_reply {
+    int error;      /**< errno ошибки запуска или 0 */
+    int status;     /**< Статус завершения команды в формате waitpid() */
+};
+
+/**
+ * @brief Запускает демон пула "тёплых" песочниц.
+ *
+ * Держит size песочниц, остановленных после полной настройки namespaces,
+ * cgroup и rootfs. Задание клиента забирает готовую песочницу (hit) или,
+ * если пул пуст, создаёт новую (miss); пул пополняется между заданиями.
+ * Запущенные задания ведёт супервизор на epoll: лимит времени, OOM kill и
+ * адаптивные лимиты обрабатываются в том же цикле, что и новые задания.
+ * Ошибки одной песочницы не останавливают демон: задание, которое не удалось
+ * поставить под наблюдение, завершается с ошибкой, а неудачное пополнение
+ * пула повторяется с нарастающей паузой.
+ * Статистика hit/miss и задержка от получения задания до execvp()
+ * выводятся в stderr по SIGUSR1 и при завершении (SIGINT/SIGTERM).
+ *
+ * @param sock_path Путь к unix-сокету для приёма заданий
+ * @param size Число "тёплых" песочниц
+ * @param opts Параметры создаваемых песочниц
+ * @param limits Ограничения запущенных заданий
+ */
+void pool_serve(const char *sock_path, int size,
+                const struct sandbox_opts *opts,
+                const struct supervisor_limits *limits);
+
+/**
+ * @brief Отправляет команду демону пула и ждёт её завершения.
+ *
+ * stdin/stdout/stderr клиента передаются команде через SCM_RIGHTS.
+ *
+ * @param sock_path Путь к unix-сокету демона
+ * @param argv Команда с аргументами, завершённая NULL
+ * @return Код завершения команды (128 + сигнал при завершении сигналом)
+ */
+int pool_submit(const char *sock_path, char **argv);
+
+#endif //ISOLATE_POOL_H
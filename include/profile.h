@@ -0,0 +1,58 @@
+#ifndef ISOLATE_PROFILE_H
+#define ISOLATE_PROFILE_H
+
+/**
+ * @brief Класс задержки песочницы: доля CPU, ограничение частоты и политика
+ *        планировщика её процессов
+ */
+enum profile {
+    PROFILE_NONE = 0,     /**< Только лимиты cgroup_init_and_limit() */
+    PROFILE_LATENCY,      /**< Интерактивная нагрузка: вес 1000, без квоты cpu.max, uclamp.min 50% */
+    PROFILE_NORMAL,       /**< Вес по умолчанию (100) и квота cpu.max */
+    PROFILE_BATCH,        /**< Вес 20, uclamp.max 50%, SCHED_BATCH */
+    PROFILE_IDLE,         /**< cpu.idle, uclamp.max 20%, SCHED_IDLE */
+};
+
+/**
+ * @brief Записывает параметры профиля в cgroup экземпляра: cpu.weight или
+ *        cpu.idle, cpu.uclamp.min и cpu.uclamp.max, для PROFILE_LATENCY —
+ *        cpu.max "max" вместо квоты.
+ *
+ * Вес делит CPU только при конкуренции, поэтому интерактивная песочница не
+ * ждёт конца периода квоты, а пакетная уступает ей CPU без простоя, когда
+ * хост свободен. cpu.idle (ядро 5.15+) и cpu.uclamp.* (CONFIG_UCLAMP_TASK_GROUP)
+ * есть не везде: без них профиль применяется частично с предупреждением.
+ *
+ * @param p Профиль
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @return 0 или -errno
+ */
+int profile_apply_cgroup(enum profile p, int cgroup_fd);
+
+/**
+ * @brief Устанавливает текущему процессу политику планировщика профиля
+ *        (SCHED_BATCH или SCHED_IDLE); её наследуют все потомки.
+ *
+ * Понижение политики не требует привилегий, поэтому вызывается в дочернем
+ * процессе песочницы перед execvp().
+ *
+ * @param p Профиль
+ * @return 0 или -errno
+ */
+int profile_apply_sched(enum profile p);
+
+/**
+ * @brief Возвращает имя профиля для отчётов ("latency-critical", "normal",
+ *        "batch", "idle").
+ */
+const char *profile_name(enum profile p);
+
+/**
+ * @brief Разбирает имя профиля.
+ *
+ * @param name Имя профиля
+ * @return Профиль; вызывает die() для неизвестного имени
+ */
+enum profile profile_parse(const char *name);
+
+#endif //ISOLATE_PROFILE_H
@@ -0,0 +1,131 @@
+#ifndef ISOLATE_PSI_H
+#define ISOLATE_PSI_H
+
+#include <stdint.h>
+
+/**
+ * @def PSI_WINDOW_US
+ * @brief Окно триггера PSI и период опроса давления, мкс. Без
+ *        CAP_SYS_RESOURCE ядро принимает только окна, кратные 2 с.
+ */
+#define PSI_WINDOW_US 2000000
+
+/**
+ * @def PSI_THRESHOLD_US
+ * @brief Порог триггера: суммарный простой "some" за окно, мкс (10%).
+ */
+#define PSI_THRESHOLD_US 200000
+
+/**
+ * @def PSI_CALM_TICKS
+ * @brief Число периодов без давления перед снижением лимита.
+ */
+#define PSI_CALM_TICKS 3
+
+/**
+ * @struct psi_bounds
+ * @brief Границы адаптивных лимитов. Нулевая верхняя граница отключает
+ *        управление соответствующим ресурсом.
+ */
+struct psi_bounds {
+    long long mem_min;   /**< Нижняя граница memory.high, байт */
+    long long mem_max;   /**< Верхняя граница memory.high и значение memory.max, байт */
+    int cpu_min;         /**< Нижняя граница квоты cpu.max, % одного CPU */
+    int cpu_max;         /**< Верхняя граница квоты cpu.max, % одного CPU */
+};
+
+/**
+ * @brief Разбирает границы memory.high вида "MIN:MAX" с суффиксами K, M, G.
+ *
+ * @param arg Строка границ (например "20M:200M")
+ * @param b Границы для заполнения
+ */
+void psi_parse_memory(const char *arg, struct psi_bounds *b);
+
+/**
+ * @brief Разбирает границы квоты CPU вида "MIN:MAX" в процентах одного CPU.
+ *
+ * @param arg Строка границ (например "10:100")
+ * @param b Границы для заполнения
+ */
+void psi_parse_cpu(const char *arg, struct psi_bounds *b);
+
+/**
+ * @def PSI_RESOURCES
+ * @brief Число управляемых ресурсов (память и CPU).
+ */
+#define PSI_RESOURCES 2
+
+/**
+ * @struct psi_resource
+ * @brief Ресурс под управлением контроллера.
+ */
+struct psi_resource {
+    const char *name;       /**< Управляемый файл cgroup (для журнала) */
+    const char *pressure;   /**< Файл PSI ресурса */
+    const char *unit;       /**< Единица значения в журнале */
+    int fd;                 /**< Дескриптор с зарегистрированным триггером */
+    uint64_t total;         /**< Последнее значение "some total", мкс */
+    int calm;               /**< Периоды без давления подряд */
+    int raised;             /**< Лимит уже поднят в текущем периоде */
+    long long value;        /**< Текущий лимит */
+    long long min;          /**< Нижняя граница */
+    long long max;          /**< Верхняя граница */
+    long long up;           /**< Шаг повышения */
+    long long down;         /**< Шаг снижения */
+    void (*apply)(int cgroup_fd, long long value);
+};
+
+/**
+ * @struct psi
+ * @brief Контроллер адаптивных лимитов одного экземпляра.
+ */
+struct psi {
+    int cgroup;             /**< Дескриптор директории cgroup экземпляра */
+    int id;                 /**< Номер экземпляра (для журнала) */
+    int n;                  /**< Число управляемых ресурсов (0 — отключён) */
+    uint64_t tick;          /**< Начало текущего периода, мкс */
+    struct psi_resource res[PSI_RESOURCES];
+};
+
+/**
+ * @brief Включает адаптивное управление memory.high и cpu.max экземпляра.
+ *
+ * Выставляет лимиты на верхние границы и регистрирует триггеры PSI на
+ * memory.pressure и cpu.pressure. Дескрипторы триггеров (p->res[i].fd)
+ * ожидаются вызывающим на POLLPRI, период PSI_WINDOW_US отсчитывается им же.
+ * Давление (срабатывание триггера или доля простоя за период выше порога)
+ * поднимает лимит на шаг, несколько спокойных периодов подряд снижают его,
+ * всегда в пределах границ. Так нагрузка под конкуренцией замедляется
+ * постепенно, а не завершается по memory.max. Каждое изменение пишется
+ * в stderr.
+ *
+ * Если триггер зарегистрировать нельзя (PSI отключён в ядре, cgroup уже
+ * удалена), подключённые ресурсы отключаются, а лимиты остаются на верхних
+ * границах.
+ *
+ * @param p Контроллер для заполнения
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param id Номер экземпляра (для журнала)
+ * @param b Границы лимитов
+ * @return 0 или -errno
+ */
+int psi_attach(struct psi *p, int cgroup_fd, int id, const struct psi_bounds *b);
+
+/**
+ * @brief Обрабатывает срабатывание триггера ресурса i.
+ */
+void psi_trigger(struct psi *p, int i);
+
+/**
+ * @brief Завершает период: оценивает долю простоя каждого ресурса по
+ *        счётчику "some total" и сдвигает лимиты.
+ */
+void psi_tick(struct psi *p);
+
+/**
+ * @brief Закрывает дескрипторы триггеров.
+ */
+void psi_detach(struct psi *p);
+
+#endif //ISOLATE_PSI_H
@@ -0,0 +1,205 @@
+#ifndef ISOLATE_SANDBOX_H
+#define ISOLATE_SANDBOX_H
+
+#include <sys/types.h>
+#include "timing.h"
+#include "cgroup_control.h"
+#include "placement.h"
+#include "netns.h"
+#include "sha256.h"
+#include "capture.h"
+#include "profile.h"
+#include "perf.h"
+
+/**
+ * @def SANDBOX_JOB_MAX
+ * @brief Максимальный размер сериализованного argv задания.
+ */
+#define SANDBOX_JOB_MAX 32768
+
+/**
+ * @def SANDBOX_ROOTFS
+ * @brief Корневая файловая система по умолчанию (относительно текущего каталога).
+ */
+#define SANDBOX_ROOTFS "rootfs"
+
+/**
+ * @def SANDBOX_TEARDOWN_MS
+ * @brief Сколько sandbox_wait() ждёт завершения процессов cgroup экземпляра
+ *        после cgroup.kill, мс.
+ */
+#define SANDBOX_TEARDOWN_MS 1000
+
+/**
+ * @def SANDBOX_OVERLAY_DIR
+ * @brief Точка монтирования tmpfs с верхним слоем overlay внутри mount namespace песочницы.
+ */
+#define SANDBOX_OVERLAY_DIR "/run/isolate/overlay"
+
+/**
+ * @struct sandbox_opts
+ * @brief Параметры создаваемых песочниц.
+ */
+struct sandbox_opts {
+    const char *rootfs;     /**< Каталог корневой файловой системы или файл образа erofs/squashfs */
+    int overlay;            /**< rootfs — нижний слой overlay, запись идёт в tmpfs экземпляра */
+    int timings;            /**< Передавать родителю длительности фаз дочернего процесса */
+    struct placement_opts placement;  /**< Размещение по CPU и узлам NUMA */
+    struct net_opts net;    /**< Драйвер сетевых интерфейсов */
+    const char *seccomp;    /**< Файл политики seccomp или NULL (без фильтра) */
+    struct capture_opts log;  /**< Журналы stdout и stderr; каналы обслуживает супервизор */
+    struct cgroup_io_opts io; /**< Ограничения ввода-вывода на диске rootfs */
+    enum profile profile;     /**< Класс задержки: вес CPU, uclamp и политика планировщика */
+    int perf;                 /**< Считать такты, инструкции, промахи LLC и переключения контекста экземпляра */
+};
+
+/**
+ * @struct sandbox
+ * @brief Подготовленная песочница: дочерний процесс во всех namespaces,
+ *        который ждёт команду на управляющем сокете.
+ */
+struct sandbox {
+    int id;       /**< Номер экземпляра (имена cgroup, veth и подсеть) */
+    int lock;     /**< Дескриптор блокировки номера экземпляра */
+    pid_t pid;    /**< PID процесса песочницы в пространстве имён хоста */
+    int pidfd;    /**< pidfd процесса песочницы или -1 на старых ядрах */
+    int cgroup;   /**< Дескриптор директории cgroup экземпляра */
+    int ctl;      /**< Управляющий сокет SOCK_SEQPACKET к процессу песочницы */
+    struct timings timings;  /**< Длительности фаз запуска */
+    struct cgroup_usage usage;  /**< Потребление ресурсов, заполняется sandbox_wait() */
+    int placed;   /**< Экземпляру выданы CPU через placement_assign() */
+    const char *reason;  /**< Причина завершения от супервизора или NULL */
+    char image[SHA256_HEX_SIZE];  /**< Хэш смонтированного образа rootfs или "" */
+    enum net_driver net;  /**< Драйвер сетевых интерфейсов экземпляра */
+    int netns;    /**< network namespace песочницы: держит её интерфейсы до sandbox_wait() */
+    int ifindex;  /**< Индекс интерфейса песочницы на стороне хоста */
+    int peer_ifindex;  /**< Индекс интерфейса внутри песочницы */
+    int nl;       /**< Netlink сокет в namespace песочницы для счётчиков ipvlan и macvlan или -1 */
+    struct net_stats net_stats;  /**< Сетевые счётчики, обновляются супервизором и sandbox_wait() */
+    struct capture log;  /**< Журналы вывода (log.opts NULL — вывод не перехватывается) */
+    uint64_t teardown_us;  /**< Длительность освобождения ресурсов в sandbox_wait(), мкс */
+    enum profile profile;  /**< Класс задержки экземпляра */
+    struct perf perf;      /**< Счётчики perf_event cgroup экземпляра (perf.fd NULL — не открыты) */
+    struct perf_counts perf_counts;  /**< Значения счётчиков, обновляются супервизором и sandbox_wait() */
+    int counted;  /**< Счётчики perf_event были открыты, perf_counts попадают в отчёт */
+};
+
+/**
+ * @brief Создаёт песочницу: cgroup экземпляра, clone3() с namespaces сразу в эту
+ *        cgroup, затем user и network namespaces.
+ *
+ * Если argv равен NULL, процесс песочницы после настройки mount namespace
+ * останавливается и ждёт задание через sandbox_send_job().
+ *
+ * Номер экземпляра выделяется через instance_acquire(), поэтому песочницы
+ * параллельных процессов isolate не конфликтуют по cgroup, veth и адресам.
+ *
+ * Если opts->rootfs — файл образа erofs или squashfs, он подключается через
+ * image_acquire() и отключается при sandbox_wait().
+ *
+ * Функция не завершает процесс при ошибке: уже созданные ресурсы (процесс
+ * песочницы, сокеты, дескриптор cgroup, CPU и номер экземпляра)
+ * освобождаются, и возвращается код ошибки. Её можно вызывать параллельно
+ * из нескольких потоков.
+ *
+ * @param sb Структура для заполнения
+ * @param opts Параметры песочницы
+ * @param argv Команда для запуска или NULL для "тёплой" песочницы
+ * @return 0 или -errno
+ */
+int sandbox_create(struct sandbox *sb, const struct sandbox_opts *opts,
+                   char **argv);
+
+/**
+ * @brief Передаёт задание "тёплой" песочнице.
+ *
+ * @param sb Песочница, созданная с argv == NULL
+ * @param job argv, сериализованный как последовательность строк с завершающим '\0'
+ * @param len Длина job в байтах
+ * @param stdio Дескрипторы stdin/stdout/stderr для команды (три элемента)
+ * @return 0 или -errno
+ */
+int sandbox_send_job(struct sandbox *sb, const char *job, size_t len,
+                     const int stdio[3]);
+
+/**
+ * @brief Ожидает запуска команды в песочнице.
+ *
+ * Управляющий сокет закрывается в дочернем процессе при успешном execvp(),
+ * поэтому EOF означает успешный запуск. Если песочница создана с
+ * sandbox_opts.timings, перед execvp() дочерний процесс присылает свои фазы
+ * (pivot_root, procfs), и они вместе с фазой execvp попадают в sb->timings.
+ *
+ * @param sb Песочница
+ * @return 0 при успешном execvp() или -errno неудачного запуска (либо
+ *         ошибки чтения управляющего сокета)
+ */
+int sandbox_await_exec(struct sandbox *sb);
+
+/**
+ * @brief Ожидает завершения процесса песочницы через pidfd и освобождает
+ *        ресурсы экземпляра.
+ *
+ * Оставшиеся процессы экземпляра завершаются через cgroup.kill, после
+ * populated 0 (не дольше SANDBOX_TEARDOWN_MS) cgroup экземпляра удаляется,
+ * network namespace закрывается (интерфейсы ipvlan и macvlan на стороне
+ * хоста удаляются через RTM_DELLINK), образ rootfs отключается, если
+ * экземпляр был последним, номер экземпляра освобождается.
+ * Дописывает остаток вывода в журналы и закрывает их.
+ * Перед удалением cgroup читает потребление ресурсов экземпляра в sb->usage,
+ * а перед удалением интерфейса — его итоговые счётчики в sb->net_stats.
+ * Счётчики perf_event читаются в sb->perf_counts и закрываются.
+ * Длительность освобождения записывается в sb->teardown_us.
+ *
+ * @param sb Песочница
+ * @return Статус завершения в формате waitpid() или -errno
+ */
+int sandbox_wait(struct sandbox *sb);
+
+/**
+ * @brief Запускает команду в уже работающей песочнице.
+ *
+ * Открывает pidfd процесса песочницы по номеру экземпляра. Вспомогательный
+ * процесс одним вызовом setns() входит во все её namespaces, создаёт
+ * процесс команды через clone3(CLONE_INTO_CGROUP) сразу в cgroup экземпляра
+ * и передаёт его статус обратно; namespaces вызывающего процесса не
+ * меняются. Ни cgroup, ни veth, ни rootfs не создаются заново. Если
+ * песочница работает под фильтром seccomp, команда получает тот же фильтр
+ * из SECCOMP_CACHE; без него возвращается -EPERM. Политику планировщика
+ * команда копирует у процесса песочницы.
+ *
+ * @param id Номер экземпляра запущенной песочницы
+ * @param argv Команда для запуска
+ * @return Статус завершения команды в формате waitpid() или -errno
+ */
+int sandbox_exec(int id, char **argv);
+
+/**
+ * @brief Читает текущие сетевые счётчики песочницы.
+ *
+ * Для veth, veth-mq и netkit читается интерфейс на стороне хоста. У ipvlan
+ * и macvlan интерфейс хоста видит только обмен с хостом, поэтому
+ * читается интерфейс внутри песочницы через сокет sb->nl.
+ *
+ * @param sb Запущенная песочница
+ * @param sock_fd Netlink сокет в namespace хоста
+ * @param rx Буфер приёма
+ * @param st Счётчики с точки зрения песочницы
+ * @return 0 или -errno (-ENODEV, если у песочницы нет интерфейса)
+ */
+int sandbox_net_stats(const struct sandbox *sb, int sock_fd, struct nl_rx *rx,
+                      struct net_stats *st);
+
+/**
+ * @brief Записывает итог запуска одной строкой JSON: номер экземпляра, код
+ *        завершения или сигнал, причину завершения, потребление ресурсов
+ *        cgroup, сетевые счётчики, счётчики perf_event, объём журналов
+ *        вывода и длительность освобождения ресурсов.
+ *
+ * @param f Поток для записи
+ * @param sb Песочница после sandbox_wait()
+ * @param status Статус, возвращённый sandbox_wait()
+ */
+void sandbox_write_report(FILE *f, const struct sandbox *sb, int status);
+
+#endif //ISOLATE_SANDBOX_H
@@ -0,0 +1,64 @@
+#ifndef ISOLATE_SECCOMP_H
+#define ISOLATE_SECCOMP_H
+
+#include <linux/filter.h>
+#include "sha256.h"
+
+/**
+ * @def SECCOMP_CACHE
+ * @brief Кэш скомпилированных фильтров: <sha256>.bpf, где хэш считается по
+ *        тексту политики, архитектуре и таблице системных вызовов сборки.
+ */
+#define SECCOMP_CACHE "/var/lib/isolate/seccomp"
+
+/**
+ * @brief Загружает фильтр seccomp для политики из кэша или компилирует его.
+ *
+ * Политика — текстовый файл со списком разрешённых системных вызовов,
+ * по одному в строке, с необязательным числом вызовов из профилирующего
+ * запуска ("read 120394"); строка "default kill|eperm|enosys|log" задаёт
+ * действие для остальных вызовов (по умолчанию eperm), "#" начинает
+ * комментарий. execve разрешён всегда: фильтр ставится до запуска команды.
+ *
+ * Фильтр — сбалансированное дерево поиска по диапазонам номеров вызовов с
+ * одинаковым действием; если заданы числа вызовов, дерево балансируется по
+ * их сумме, а вызов с большей частью всех вызовов проверяется до дерева.
+ * Скомпилированная программа сохраняется в SECCOMP_CACHE, и следующие
+ * запуски с той же политикой только читают её.
+ *
+ * @param path Путь к файлу политики
+ * @param prog Программа для seccomp_apply(); освобождается seccomp_free()
+ * @param digest Буфер для хэша программы в SECCOMP_CACHE или NULL
+ * @return 0 или -errno
+ */
+int seccomp_load(const char *path, struct sock_fprog *prog,
+                 char digest[SHA256_HEX_SIZE]);
+
+/**
+ * @brief Загружает из SECCOMP_CACHE программу по хэшу от seccomp_load().
+ *
+ * Так isolate exec ставит команде тот же фильтр, что и песочнице, даже если
+ * файл политики с тех пор изменился.
+ *
+ * @param digest Хэш программы
+ * @param prog Программа для seccomp_apply(); освобождается seccomp_free()
+ * @return 0 или -errno (-ENOENT — программы нет в кэше)
+ */
+int seccomp_load_cached(const char *digest, struct sock_fprog *prog);
+
+/**
+ * @brief Устанавливает фильтр текущему процессу после PR_SET_NO_NEW_PRIVS.
+ *
+ * @param prog Программа от seccomp_load()
+ * @return 0 или -errno
+ */
+int seccomp_apply(const struct sock_fprog *prog);
+
+/**
+ * @brief Освобождает программу seccomp_load().
+ *
+ * @param prog Программа
+ */
+void seccomp_free(struct sock_fprog *prog);
+
+#endif //ISOLATE_SECCOMP_H
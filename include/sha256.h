@@ -0,0 +1,47 @@
+#ifndef ISOLATE_SHA256_H
+#define ISOLATE_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @def SHA256_DIGEST_SIZE
+ * @brief Размер дайджеста SHA-256, байт.
+ */
+#define SHA256_DIGEST_SIZE 32
+
+/**
+ * @def SHA256_HEX_SIZE
+ * @brief Размер шестнадцатеричной записи дайджеста с завершающим '\0'.
+ */
+#define SHA256_HEX_SIZE (2 * SHA256_DIGEST_SIZE + 1)
+
+/**
+ * @struct sha256
+ * @brief Состояние потокового вычисления SHA-256 (FIPS 180-4).
+ */
+struct sha256 {
+    uint32_t state[8];      /**< Промежуточное значение хэша */
+    uint64_t len;           /**< Обработано байт */
+    uint8_t buf[64];        /**< Неполный блок */
+};
+
+/**
+ * @brief Начинает вычисление хэша.
+ */
+void sha256_init(struct sha256 *c);
+
+/**
+ * @brief Добавляет данные к хэшу.
+ */
+void sha256_update(struct sha256 *c, const void *data, size_t len);
+
+/**
+ * @brief Завершает вычисление и записывает дайджест в шестнадцатеричном виде.
+ *
+ * @param c Состояние
+ * @param hex Буфер размером SHA256_HEX_SIZE
+ */
+void sha256_final_hex(struct sha256 *c, char hex[SHA256_HEX_SIZE]);
+
+#endif //ISOLATE_SHA256_H
@@ -0,0 +1,154 @@
+#ifndef ISOLATE_SUPERVISOR_H
+#define ISOLATE_SUPERVISOR_H
+
+#include <stdint.h>
+#include "sandbox.h"
+#include "psi.h"
+
+/**
+ * @def SUPERVISOR_EVENTS_MAX
+ * @brief Максимальное число событий, обрабатываемых за один epoll_wait().
+ */
+#define SUPERVISOR_EVENTS_MAX 64
+
+/**
+ * @brief Источник событий экземпляра
+ */
+enum supervisor_kind {
+    SUPERVISOR_PIDFD = 0,       /**< pidfd процесса песочницы: процесс завершился */
+    SUPERVISOR_CGROUP_EVENTS,   /**< cgroup.events: изменилось populated */
+    SUPERVISOR_MEMORY_EVENTS,   /**< memory.events: счётчик oom_kill */
+    SUPERVISOR_TIMEOUT,         /**< timerfd лимита времени */
+    SUPERVISOR_PSI_TICK,        /**< timerfd периода контроллера PSI */
+    SUPERVISOR_LOG_STDOUT,      /**< Канал stdout песочницы: данные для журнала */
+    SUPERVISOR_LOG_STDERR,      /**< Канал stderr песочницы */
+    SUPERVISOR_LOG_RESUME,      /**< timerfd возобновления журналов после лимита скорости */
+    SUPERVISOR_PSI_TRIGGER,     /**< Триггеры PSI, по одному на ресурс */
+    SUPERVISOR_SOURCES = SUPERVISOR_PSI_TRIGGER + PSI_RESOURCES,
+    SUPERVISOR_NET_TICK = SUPERVISOR_SOURCES,  /**< Общий timerfd сбора сетевых счётчиков */
+};
+
+/**
+ * @struct supervisor_limits
+ * @brief Ограничения, которые супервизор применяет к экземпляру.
+ */
+struct supervisor_limits {
+    uint64_t timeout_ms;        /**< Лимит времени работы, мс (0 — без лимита) */
+    struct psi_bounds psi;      /**< Границы адаптивных лимитов (нулевые — без PSI) */
+    uint64_t net_stats_ms;      /**< Период сбора сетевых счётчиков, мс (0 — только итоговые) */
+};
+
+struct supervisor_watch;
+
+/**
+ * @struct supervisor_source
+ * @brief Дескриптор, зарегистрированный в epoll; указатель на него хранится
+ *        в epoll_event.data.
+ */
+struct supervisor_source {
+    struct supervisor_watch *w;     /**< Экземпляр-владелец (NULL для общих источников) */
+    enum supervisor_kind kind;      /**< Тип источника */
+    int fd;                         /**< Дескриптор или -1 */
+};
+
+/**
+ * @struct supervisor_watch
+ * @brief Наблюдение за одной песочницей.
+ */
+struct supervisor_watch {
+    struct supervisor_watch *next;  /**< Следующее активное наблюдение */
+    struct supervisor_watch **pprev;  /**< Ссылка на это наблюдение в списке */
+    struct sandbox *sb;         /**< Песочница */
+    void *data;                 /**< Данные вызывающего */
+    struct supervisor_source src[SUPERVISOR_SOURCES];
+    struct psi psi;             /**< Контроллер адаптивных лимитов */
+    long long oom_kills;        /**< Последнее значение oom_kill из memory.events */
+    int log_paused;             /**< Маска каналов, снятых с epoll до восстановления лимита */
+    int populated;              /**< В cgroup экземпляра есть процессы */
+    int exited;                 /**< Процесс песочницы завершился */
+    int timed_out;              /**< Экземпляр остановлен по лимиту времени */
+    int done;                   /**< Наблюдение завершено, status заполнен */
+    int status;                 /**< Статус завершения в формате waitpid() */
+};
+
+/**
+ * @struct supervisor
+ * @brief Супервизор песочниц на epoll.
+ */
+struct supervisor {
+    int epfd;       /**< Дескриптор epoll; его можно ждать через poll() на POLLIN */
+    int watches;    /**< Число активных наблюдений */
+    struct supervisor_watch *active;  /**< Список активных наблюдений */
+    struct supervisor_source net_tick;  /**< Таймер сбора сетевых счётчиков */
+    int net_sock;   /**< Netlink сокет для дампа счётчиков или -1 */
+    struct nl_rx net_rx;  /**< Буфер приёма дампа, общий для всех тиков */
+};
+
+/**
+ * @brief Создаёт экземпляр epoll для супервизора.
+ *
+ * @param s Супервизор для инициализации
+ */
+void supervisor_init(struct supervisor *s);
+
+/**
+ * @brief Ставит песочницу под наблюдение.
+ *
+ * Регистрирует в epoll pidfd процесса песочницы, cgroup.events и
+ * memory.events экземпляра (EPOLLPRI при изменении файла), timerfd лимита
+ * времени, если заданы границы, — триггеры и период контроллера PSI, а при
+ * перехвате вывода — каналы stdout и stderr песочницы.
+ * Первое наблюдение с ненулевым limits->net_stats_ms запускает общий таймер
+ * сбора сетевых счётчиков с этим периодом.
+ * Структура w должна оставаться на месте до завершения наблюдения.
+ * При ошибке уже зарегистрированные источники снимаются, а песочница
+ * остаётся работать: завершить и дождаться её должен вызывающий.
+ *
+ * @param s Супервизор
+ * @param w Наблюдение для заполнения
+ * @param sb Запущенная песочница (с pidfd)
+ * @param limits Ограничения экземпляра
+ * @param data Данные вызывающего для w->data
+ * @return 0 или -errno
+ */
+int supervisor_add(struct supervisor *s, struct supervisor_watch *w,
+                   struct sandbox *sb, const struct supervisor_limits *limits,
+                   void *data);
+
+/**
+ * @brief Ждёт события и обрабатывает их.
+ *
+ * OOM kill и истечение лимита времени (после которого процесс песочницы
+ * получает SIGKILL через pidfd, а с ним и весь PID namespace) пишутся в
+ * stderr сразу. Данные из каналов вывода переносятся в журналы
+ * capture_pump(); при исчерпании лимита скорости канал снимается с epoll до
+ * срабатывания таймера возобновления.
+ *
+ * По таймеру сетевых счётчиков один дамп RTM_GETSTATS обновляет
+ * sb->net_stats всех наблюдаемых песочниц, и счётчики каждой пишутся в
+ * stderr строкой вместе с текущим потреблением памяти и CPU; по тому же
+ * таймеру пишутся счётчики perf_event песочниц, у которых они открыты
+ * (такты, инструкции, IPC, промахи LLC и CPU, где шла работа).
+ *
+ * Наблюдение завершается, когда процесс песочницы вышел, а cgroup экземпляра
+ * опустела (populated 0): тогда вызывается sandbox_wait(), причина
+ * завершения сохраняется в sb->reason, а наблюдение попадает в done.
+ * Песочница, источник которой не удалось вернуть в epoll, завершается через
+ * SIGKILL; остальные не затрагиваются.
+ *
+ * @param s Супервизор
+ * @param timeout_ms Таймаут epoll_wait() (-1 — без таймаута)
+ * @param done Массив для завершённых наблюдений
+ * @param max Размер массива done
+ * @return Число завершённых наблюдений или -errno, если epoll_wait() не
+ *         удался
+ */
+int supervisor_dispatch(struct supervisor *s, int timeout_ms,
+                        struct supervisor_watch **done, int max);
+
+/**
+ * @brief Закрывает epoll, таймер и Netlink сокет супервизора.
+ */
+void supervisor_close(struct supervisor *s);
+
+#endif //ISOLATE_SUPERVISOR_H
@@ -0,0 +1,58 @@
+#ifndef ISOLATE_TIMING_H
+#define ISOLATE_TIMING_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * @brief Фазы запуска песочницы, для которых измеряется длительность
+ */
+enum timing_phase {
+    TIMING_CLONE = 0,     /**< clone3() процесса со всеми namespaces */
+    TIMING_CGROUP,        /**< Создание cgroup экземпляра и запись лимитов */
+    TIMING_IDMAP,         /**< Запись uid_map, setgroups и gid_map, idmapped rootfs */
+    TIMING_VETH,          /**< Создание пары veth */
+    TIMING_ADDR,          /**< Назначение адресов и подъём интерфейсов */
+    TIMING_PIVOT_ROOT,    /**< Монтирование rootfs и pivot_root */
+    TIMING_PROCFS,        /**< Монтирование procfs */
+    TIMING_SECCOMP,       /**< Загрузка фильтра seccomp из кэша или его компиляция */
+    TIMING_EXEC,          /**< От вызова execvp() до закрытия управляющего сокета */
+    TIMING_PHASES
+};
+
+/**
+ * @struct timings
+ * @brief Длительности фаз запуска в микросекундах.
+ */
+struct timings {
+    uint64_t us[TIMING_PHASES];
+};
+
+/**
+ * @brief Возвращает текущее значение CLOCK_MONOTONIC в микросекундах.
+ *
+ * Часы общие для хоста и песочницы, поэтому отметки дочернего процесса
+ * можно сравнивать с отметками родителя.
+ */
+uint64_t timing_now_us(void);
+
+/**
+ * @brief Возвращает имя фазы для отчётов (например "pivot_root").
+ */
+const char *timing_name(enum timing_phase phase);
+
+/**
+ * @brief Сумма длительностей всех фаз в микросекундах.
+ */
+uint64_t timing_total_us(const struct timings *t);
+
+/**
+ * @brief Записывает длительности фаз одним JSON-объектом
+ *        вида {"clone":120,...,"total":900}.
+ *
+ * @param f Поток для записи
+ * @param t Длительности фаз
+ */
+void timing_write_json(FILE *f, const struct timings *t);
+
+#endif //ISOLATE_TIMING_H
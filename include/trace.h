@@ -0,0 +1,99 @@
+#ifndef ISOLATE_TRACE_H
+#define ISOLATE_TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @def TRACE_NAME_MAX
+ * @brief Максимальная длина имени шага (с завершающим '\0').
+ */
+#define TRACE_NAME_MAX 32
+
+/**
+ * @def TRACE_BUFFER_MAX
+ * @brief Число шагов, которые дочерний процесс накапливает до передачи родителю.
+ */
+#define TRACE_BUFFER_MAX 48
+
+/**
+ * @struct trace_event
+ * @brief Завершённый шаг с монотонными отметками времени.
+ */
+struct trace_event {
+    char name[TRACE_NAME_MAX];  /**< Имя шага, например "prepare_mntns.pivot_root" */
+    uint64_t ts;                /**< Начало, мкс CLOCK_MONOTONIC */
+    uint64_t dur;               /**< Длительность, мкс */
+};
+
+/**
+ * @brief Включает трассировку с записью в файл в формате Chrome trace-event
+ *        (JSON-массив, по одному событию на строку).
+ *
+ * Файл открывается в режиме построчной буферизации: каждое событие сразу
+ * попадает в файл, поэтому трасса полезна и при аварийном завершении, а
+ * дочерние процессы не наследуют недописанный буфер.
+ *
+ * @param path Путь к файлу трассы
+ * @return 0 или -errno
+ */
+int trace_open(const char *path);
+
+/**
+ * @brief Завершает JSON-массив и закрывает файл трассы.
+ *
+ * @return 0 или -errno
+ */
+int trace_close(void);
+
+/**
+ * @brief Включена ли трассировка.
+ */
+int trace_enabled(void);
+
+/**
+ * @brief Отметка начала шага.
+ *
+ * @return Текущее время в мкс или 0, если трассировка выключена
+ */
+uint64_t trace_begin(void);
+
+/**
+ * @brief Записывает шаг, начатый trace_begin().
+ *
+ * В дочернем процессе после trace_buffer() шаг сохраняется в памяти.
+ *
+ * @param name Имя шага
+ * @param start Результат trace_begin()
+ */
+void trace_end(const char *name, uint64_t start);
+
+/**
+ * @brief Переводит текущий (дочерний) процесс в режим накопления шагов в памяти.
+ *
+ * После pivot_root файл трассы недоступен, поэтому шаги песочницы
+ * передаются родителю через управляющий сокет и записываются им.
+ */
+void trace_buffer(void);
+
+/**
+ * @brief Копирует накопленные шаги и очищает буфер.
+ *
+ * @param ev Массив для шагов
+ * @param max Размер массива
+ * @return Число скопированных шагов
+ */
+int trace_take(struct trace_event *ev, int max);
+
+/**
+ * @brief Записывает шаги другого процесса (песочницы).
+ *
+ * @param pid PID процесса в namespace хоста
+ * @param label Имя процесса для просмотрщика или NULL
+ * @param ev Шаги
+ * @param n Число шагов
+ */
+void trace_emit(pid_t pid, const char *label,
+                const struct trace_event *ev, int n);
+
+#endif //ISOLATE_TRACE_H
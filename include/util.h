@@ -1,14 +1,37 @@
 #ifndef ISOLATE_UTIL_H
 #define ISOLATE_UTIL_H
 
-static void die(const char *fmt, ...)
-{
-    va_list params;
-
-    va_start(params, fmt);
-    vfprintf(stderr, fmt, params);
-    va_end(params);
-    exit(1);
-}
+/**
+ * @brief Выводит сообщение в stderr и завершает процесс с кодом 1.
+ *
+ * Только для CLI и дочернего процесса песочницы: код, который может работать
+ * в процессе, встроившем libisolate, сообщает об ошибке через fail(). В
+ * libisolate.a его вызывают только дочерний процесс песочницы и функции
+ * разбора опций командной строки (*_parse).
+ *
+ * @param fmt Формат сообщения (поддерживает %m)
+ */
+void die(const char *fmt, ...)
+        __attribute__((noreturn, format(printf, 1, 2)));
+
+/**
+ * @brief Выводит сообщение в stderr и возвращает -errno.
+ *
+ * errno сохраняется: %m в формате и вызывающий видят исходную ошибку.
+ * Если errno равен 0, используется EIO.
+ *
+ * @param fmt Формат сообщения (поддерживает %m)
+ * @return Отрицательный код ошибки
+ */
+int fail(const char *fmt, ...)
+        __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Создаёт каталог вместе с недостающими родительскими (режим 0755).
+ *
+ * @param path Путь к каталогу
+ * @return 0 или -errno
+ */
+int mkdirs(const char *path);
 
 #endif //ISOLATE_UTIL_H
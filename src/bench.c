@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../include/util.h"
+#include "../include/sandbox.h"
+#include "../include/timing.h"
+
+/**
+ * @brief Параметры командной строки бенчмарка
+ */
+struct options {
+    char **argv;                  /**< Команда, запускаемая в каждой песочнице */
+    int runs;                     /**< Число запусков */
+    const char *output;           /**< Файл для JSON с результатами */
+    struct sandbox_opts sandbox;  /**< Параметры песочниц */
+};
+
+/**
+ * @brief Парсит аргументы командной строки, пропуская имя бинарника
+ *
+ * Поддерживаемые опции:
+ *   --runs N         число запусков (по умолчанию 100)
+ *   --output FILE    файл для JSON с результатами (по умолчанию bench.json)
+ *   --rootfs PATH    корневая файловая система песочницы (каталог или образ)
+ *   --overlay        смонтировать rootfs как нижний слой overlay
+ *   --net-driver D   интерфейсы песочниц: veth, veth-mq, ipvlan, macvlan, netkit
+ *   --uplink IF      интерфейс хоста для ipvlan и macvlan
+ *   --seccomp FILE   политика seccomp (фаза seccomp — загрузка фильтра)
+ *
+ * @param argc Количество аргументов
+ * @param argv Массив аргументов
+ * @param opts Структура параметров для заполнения
+ */
+static void parse_args(int argc, char **argv, struct options *opts)
+{
+#define NEXT_ARG() do { argc--; argv++; } while (0)
+#define ARG_VALUE() do { \
+        NEXT_ARG(); \
+        if (argc < 1) \
+            die("Option %s requires a value\n", argv[-1]); \
+    } while (0)
+
+    NEXT_ARG();
+
+    while (argc > 0 && argv[0][0] == '-') {
+        if (!strcmp(argv[0], "--")) {
+            NEXT_ARG();
+            break;
+        } else if (!strcmp(argv[0], "--runs")) {
+            ARG_VALUE();
+            opts->runs = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "--output")) {
+            ARG_VALUE();
+            opts->output = argv[0];
+        } else if (!strcmp(argv[0], "--rootfs")) {
+            ARG_VALUE();
+            opts->sandbox.rootfs = argv[0];
+        } else if (!strcmp(argv[0], "--overlay")) {
+            opts->sandbox.overlay = 1;
+        } else if (!strcmp(argv[0], "--seccomp")) {
+            ARG_VALUE();
+            opts->sandbox.seccomp = argv[0];
+        } else if (!strcmp(argv[0], "--net-driver")) {
+            ARG_VALUE();
+            opts->sandbox.net.driver = net_driver_parse(argv[0]);
+        } else if (!strcmp(argv[0], "--uplink")) {
+            ARG_VALUE();
+            opts->sandbox.net.uplink = argv[0];
+        } else {
+            die("Unknown option %s\n", argv[0]);
+        }
+        NEXT_ARG();
+    }
+
+    if (argc < 1)
+        die("Usage: isolate-bench [--runs N] [--output FILE] "
+            "[--rootfs PATH] [--overlay] [--net-driver D] [--uplink IF] "
+            "-- CMD [ARGS...]\n");
+    if (opts->runs < 1)
+        die("Invalid number of runs: %d\n", opts->runs);
+
+    opts->argv = argv;
+#undef ARG_VALUE
+#undef NEXT_ARG
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Перцентиль по методу ближайшего ранга
+ *
+ * @param sorted Отсортированные значения
+ * @param n Число значений
+ * @param p Перцентиль (1..100)
+ */
+static uint64_t percentile(const uint64_t *sorted, int n, int p)
+{
+    int rank = (n * p + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * @brief Записывает перцентили одной фазы и выводит строку сводки
+ *
+ * @param f Поток JSON
+ * @param name Имя фазы
+ * @param samples Значения фазы по всем запускам (сортируются на месте)
+ * @param n Число значений
+ */
+static void report_phase(FILE *f, const char *name, uint64_t *samples, int n)
+{
+    qsort(samples, n, sizeof(*samples), cmp_u64);
+
+    uint64_t p50 = percentile(samples, n, 50);
+    uint64_t p90 = percentile(samples, n, 90);
+    uint64_t p99 = percentile(samples, n, 99);
+    uint64_t max = samples[n - 1];
+
+    fprintf(f, "\"%s\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}",
+            name, (unsigned long long) p50, (unsigned long long) p90,
+            (unsigned long long) p99, (unsigned long long) max);
+    fprintf(stderr, "%-12s %8llu %8llu %8llu %8llu\n", name,
+            (unsigned long long) p50, (unsigned long long) p90,
+            (unsigned long long) p99, (unsigned long long) max);
+}
+
+/**
+ * @brief Бенчмарк запуска: создаёт runs песочниц подряд с одной командой
+ *        и сохраняет p50/p90/p99/max каждой фазы и число запусков в секунду.
+ */
+int main(int argc, char **argv)
+{
+    struct options opts;
+    memset(&opts, 0, sizeof(struct options));
+    opts.runs = 100;
+    opts.output = "bench.json";
+    opts.sandbox.rootfs = SANDBOX_ROOTFS;
+    opts.sandbox.timings = 1;
+
+    parse_args(argc, argv, &opts);
+
+    int n = opts.runs;
+    uint64_t *samples = calloc((size_t) n * (TIMING_PHASES + 2), sizeof(uint64_t));
+    if (samples == NULL)
+        die("Failed to allocate samples: %m\n");
+
+    // Вывод песочниц не должен искажать замеры
+    int out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (out < 0 || null < 0 || dup2(null, STDOUT_FILENO) < 0)
+        die("Failed to redirect stdout: %m\n");
+    close(null);
+
+    int failures = 0;
+    uint64_t start = timing_now_us();
+
+    for (int i = 0; i < n; i++) {
+        struct sandbox sb;
+        uint64_t launch = timing_now_us();
+
+        if (sandbox_create(&sb, &opts.sandbox, opts.argv))
+            die("Failed to create sandbox %d of %d\n", i + 1, n);
+        int err = sandbox_await_exec(&sb);
+        int status = sandbox_wait(&sb);
+
+        if (err || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failures++;
+
+        for (int p = 0; p < TIMING_PHASES; p++)
+            samples[p * n + i] = sb.timings.us[p];
+        samples[TIMING_PHASES * n + i] = sb.teardown_us;
+        samples[(TIMING_PHASES + 1) * n + i] = timing_now_us() - launch;
+    }
+
+    uint64_t elapsed = timing_now_us() - start;
+    double per_sec = elapsed ? n * 1e6 / elapsed : 0;
+
+    fflush(stdout);
+    if (dup2(out, STDOUT_FILENO) < 0)
+        die("Failed to restore stdout: %m\n");
+    close(out);
+
+    FILE *f = fopen(opts.output, "we");
+    if (f == NULL)
+        die("Failed to open file %s: %m\n", opts.output);
+
+    fprintf(f, "{\"command\":\"%s\",\"runs\":%d,\"failures\":%d,"
+               "\"elapsed_us\":%llu,\"launches_per_sec\":%.1f,\"phases_us\":{",
+            opts.argv[0], n, failures,
+            (unsigned long long) elapsed, per_sec);
+    fprintf(stderr, "%-12s %8s %8s %8s %8s\n",
+            "phase_us", "p50", "p90", "p99", "max");
+
+    for (int p = 0; p < TIMING_PHASES; p++) {
+        report_phase(f, timing_name(p), samples + p * n, n);
+        fputc(',', f);
+    }
+    report_phase(f, "teardown", samples + TIMING_PHASES * n, n);
+    fputc(',', f);
+    report_phase(f, "wall", samples + (TIMING_PHASES + 1) * n, n);
+    fprintf(f, "}}\n");
+
+    if (fclose(f) != 0)
+        die("Failed to close file %s: %m\n", opts.output);
+
+    fprintf(stderr, "runs=%d failures=%d launches_per_sec=%.1f -> %s\n",
+            n, failures, per_sec, opts.output);
+
+    free(samples);
+    return failures ? 1 : 0;
+}
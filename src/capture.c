@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/util.h"
+#include "../include/timing.h"
+#include "../include/capture.h"
+
+/**
+ * @def CAPTURE_RESUME_BYTES
+ * @brief Запас, после накопления которого приостановленный канал снова
+ *        читается: не меньше страницы, иначе splice() идёт мелкими кусками.
+ */
+#define CAPTURE_RESUME_BYTES 4096ull
+
+static const char *const names[CAPTURE_STREAMS] = { "stdout", "stderr" };
+
+static uint64_t burst(const struct capture_opts *opts)
+{
+    return opts->rate > CAPTURE_BURST_MIN ? opts->rate : CAPTURE_BURST_MIN;
+}
+
+int capture_init(struct capture *c, const struct capture_opts *opts,
+                 int wr[CAPTURE_STREAMS])
+{
+    static int no_tee;
+    int err;
+
+    c->opts = opts;
+    c->id = -1;
+    c->pid = 0;
+    c->tokens = burst(opts);
+    c->refill_us = timing_now_us();
+    c->throttled_us = 0;
+
+    for (int i = 0; i < CAPTURE_STREAMS; i++) {
+        struct capture_stream *s = &c->s[i];
+        s->pipe = s->file = s->mirror = -1;
+        s->off = 0;
+        s->bytes = 0;
+        s->mirrored = 0;
+        wr[i] = -1;
+    }
+
+    for (int i = 0; i < CAPTURE_STREAMS; i++) {
+        struct capture_stream *s = &c->s[i];
+        int fds[2];
+
+        if (pipe2(fds, O_CLOEXEC))
+            goto fail;
+        s->pipe = fds[0];
+        wr[i] = fds[1];
+
+        // O_NONBLOCK только у читающего конца: запись песочницы в полный
+        // канал должна блокироваться, а не возвращать EAGAIN
+        if (fcntl(s->pipe, F_SETFL, O_NONBLOCK))
+            goto fail;
+
+        // tee() работает только между каналами
+        struct stat st;
+        if (opts->tee) {
+            if (fstat(STDOUT_FILENO + i, &st) == 0 && S_ISFIFO(st.st_mode))
+                s->mirror = STDOUT_FILENO + i;
+            else if (!__atomic_exchange_n(&no_tee, 1, __ATOMIC_RELAXED))
+                fprintf(stderr, "%s is not a pipe, captured output is "
+                                "not mirrored\n", names[i]);
+        }
+    }
+    return 0;
+
+fail:
+    err = fail("Failed to create output pipe: %m\n");
+    for (int i = 0; i < CAPTURE_STREAMS; i++)
+        if (wr[i] >= 0)
+            close(wr[i]);
+    capture_close(c);
+    return err;
+}
+
+static void log_path(const struct capture *c, int i, const char *suffix,
+                     char *buf, size_t len)
+{
+    snprintf(buf, len, "%s/%d-%d.%s%s", c->opts->dir, c->id, (int) c->pid,
+             names[i], suffix);
+}
+
+int capture_open(struct capture *c, int id, pid_t pid)
+{
+    char path[PATH_MAX];
+    int err;
+
+    c->id = id;
+    c->pid = pid;
+    if ((err = mkdirs(c->opts->dir)))
+        return err;
+
+    for (int i = 0; i < CAPTURE_STREAMS; i++) {
+        log_path(c, i, "", path, sizeof(path));
+        c->s[i].file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                            0644);
+        if (c->s[i].file < 0)
+            return fail("Failed to open log %s: %m\n", path);
+    }
+    return 0;
+}
+
+/**
+ * @brief Переводит заполненный файл журнала в <имя>.1 и начинает новый
+ *
+ * @return 0 или -errno
+ */
+static int rotate(struct capture *c, int i)
+{
+    struct capture_stream *s = &c->s[i];
+    char path[PATH_MAX];
+    char old[PATH_MAX];
+
+    log_path(c, i, "", path, sizeof(path));
+    log_path(c, i, ".1", old, sizeof(old));
+
+    close(s->file);
+    s->file = -1;
+    if (rename(path, old))
+        return fail("Failed to rotate log %s: %m\n", path);
+
+    s->file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (s->file < 0)
+        return fail("Failed to open log %s: %m\n", path);
+    s->off = 0;
+    return 0;
+}
+
+static void refill(struct capture *c)
+{
+    uint64_t now = timing_now_us();
+    uint64_t add = (now - c->refill_us) * c->opts->rate / 1000000;
+
+    // Без сдвига момента при нулевом пополнении частые вызовы не теряют
+    // дробную часть
+    if (add == 0)
+        return;
+    c->refill_us = now;
+    c->tokens += add;
+    if (c->tokens > burst(c->opts))
+        c->tokens = burst(c->opts);
+}
+
+/**
+ * @brief Переносит до limit байт из канала в журнал
+ *
+ * @param limited Учитывать лимит скорости
+ * @return Как у capture_pump()
+ */
+static int pump(struct capture *c, int i, uint64_t limit, int limited,
+                uint64_t *wait_us)
+{
+    struct capture_stream *s = &c->s[i];
+    uint64_t size = c->opts->size ? c->opts->size : CAPTURE_SIZE_DEFAULT;
+    uint64_t moved = 0;
+    int err;
+
+    if (limited)
+        refill(c);
+
+    while (moved < limit) {
+        size_t len = limit - moved;
+
+        if (limited) {
+            if (c->tokens == 0) {
+                *wait_us = (CAPTURE_RESUME_BYTES * 1000000 + c->opts->rate - 1) /
+                           c->opts->rate;
+                c->throttled_us += *wait_us;
+                return 1;
+            }
+            if (len > c->tokens)
+                len = c->tokens;
+        }
+
+        if ((uint64_t) s->off >= size && (err = rotate(c, i)))
+            return err;
+        if (len > size - s->off)
+            len = size - s->off;
+
+        // Копия для запускающего процесса; если его канал полон, эта часть
+        // только пишется в журнал. После частичной записи в журнал
+        // скопированный остаток дописывается без повторного tee()
+        if (s->mirrored > 0) {
+            if (len > s->mirrored)
+                len = s->mirrored;
+        } else if (s->mirror >= 0) {
+            ssize_t t = tee(s->pipe, s->mirror, len, SPLICE_F_NONBLOCK);
+            if (t == 0)
+                return -1;
+            if (t > 0)
+                len = s->mirrored = t;
+        }
+
+        ssize_t n = splice(s->pipe, NULL, s->file, &s->off, len,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0)
+            return -1;
+        if (n < 0) {
+            if (errno == EAGAIN)
+                return 0;
+            return fail("Failed to write %s log of sandbox %d: %m\n",
+                        names[i], c->id);
+        }
+
+        s->mirrored -= (size_t) n < s->mirrored ? (size_t) n : s->mirrored;
+        moved += n;
+        s->bytes += n;
+        if (limited)
+            c->tokens -= n;
+    }
+    return 0;
+}
+
+int capture_pump(struct capture *c, int i, uint64_t *wait_us)
+{
+    return pump(c, i, CAPTURE_CHUNK, c->opts->rate > 0, wait_us);
+}
+
+void capture_close(struct capture *c)
+{
+    uint64_t wait_us;
+
+    if (c->opts == NULL)
+        return;
+
+    for (int i = 0; i < CAPTURE_STREAMS; i++) {
+        struct capture_stream *s = &c->s[i];
+
+        // Процессы песочницы завершились, и в канале остаётся не больше его
+        // буфера: дописываем без лимита
+        if (s->pipe >= 0 && s->file >= 0)
+            pump(c, i, UINT64_MAX, 0, &wait_us);
+        if (s->pipe >= 0)
+            close(s->pipe);
+        if (s->file >= 0)
+            close(s->file);
+        s->pipe = s->file = s->mirror = -1;
+    }
+}
+
+uint64_t capture_parse_size(const char *arg)
+{
+    char *end;
+    uint64_t v = strtoull(arg, &end, 10);
+
+    switch (*end) {
+        case 'G': v <<= 10; /* fallthrough */
+        case 'M': v <<= 10; /* fallthrough */
+        case 'K': v <<= 10; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || v == 0 || end == arg)
+        die("Invalid size %s\n", arg);
+    return v;
+}
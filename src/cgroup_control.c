@@ -1,110 +1,740 @@
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
+#include "../include/util.h"
+#include "../include/cgroup_control.h"
+#include "../include/trace.h"
+#include "../include/timing.h"
 
 #define CGROUP_BASE "/sys/fs/cgroup"
 #define CGROUP_NAME "isolate_group"
 #define CGROUP_PATH CGROUP_BASE "/" CGROUP_NAME
+#define CGROUP_CONTROLLERS "+cpu +memory +pids"
+#define CGROUP_OPTIONAL_CONTROLLERS "+cpuset +io"
+#define CGROUP_STALE_MS 1000
 
 /**
  * @brief Записывает строку в файл, с проверкой ошибок
  *
  * @param path Путь к файлу
  * @param value Строка для записи
+ * @return 0 или -errno
  */
-static void write_to_file(const char *path, const char *value)
+static int write_to_file(const char *path, const char *value)
 {
     int fd = open(path, O_WRONLY | O_CLOEXEC);
-    if (fd < 0) {
-        perror("open");
-        exit(EXIT_FAILURE);
+    if (fd < 0)
+        return fail("open %s: %m\n", path);
+
+    int err = 0;
+    if (write(fd, value, strlen(value)) < 0)
+        err = fail("write %s: %m\n", path);
+    close(fd);
+    return err;
+}
+
+/**
+ * @brief Записывает строку в файл интерфейса cgroup относительно директории cgroup
+ *
+ * @param cgroup_fd Дескриптор директории cgroup
+ * @param file Имя файла (например "cpu.max")
+ * @param value Строка для записи
+ * @return 0 или -errno
+ */
+static int write_to_cgroup(int cgroup_fd, const char *file, const char *value)
+{
+    int fd = openat(cgroup_fd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return fail("%s: %m\n", file);
+
+    int err = 0;
+    if (write(fd, value, strlen(value)) < 0)
+        err = fail("%s: %m\n", file);
+    close(fd);
+    return err;
+}
+
+/**
+ * @brief Проверяет, что все контроллеры списка уже включены
+ *
+ * @param path Путь к cgroup.subtree_control
+ * @param controllers Список вида "+cpu +memory"
+ * @return 1, если все контроллеры включены, иначе 0
+ */
+static int controllers_enabled(const char *path, const char *controllers)
+{
+    char buf[512];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len < 0)
+        return 0;
+    buf[len] = '\0';
+
+    char wanted[64];
+    char *save = NULL;
+    snprintf(wanted, sizeof(wanted), "%s", controllers);
+    for (char *tok = strtok_r(wanted, " +", &save); tok;
+         tok = strtok_r(NULL, " +", &save)) {
+        size_t n = strlen(tok);
+        const char *p = buf;
+        int found = 0;
+        while ((p = strstr(p, tok)) != NULL) {
+            if ((p == buf || p[-1] == ' ') &&
+                (p[n] == ' ' || p[n] == '\n' || p[n] == '\0')) {
+                found = 1;
+                break;
+            }
+            p += n;
+        }
+        if (!found)
+            return 0;
     }
-    if (write(fd, value, strlen(value)) < 0) {
-        perror("write");
-        close(fd);
-        exit(EXIT_FAILURE);
+    return 1;
+}
+
+static pthread_once_t optional_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Включает контроллеры CGROUP_OPTIONAL_CONTROLLERS по одному;
+ *        вызывается один раз на процесс через pthread_once()
+ *
+ * Недоступный контроллер (не собран в ядре, занят cgroup v1 или не включён
+ * у родителя isolate_group) не мешает запускам без опций, которым он нужен:
+ * о нём только предупреждаем, а ошибку вернут cgroup_set_cpuset() и
+ * cgroup_set_io().
+ */
+static void enable_optional(void)
+{
+    static const char *const paths[] = {
+            CGROUP_BASE "/cgroup.subtree_control",
+            CGROUP_PATH "/cgroup.subtree_control",
+    };
+    char wanted[] = CGROUP_OPTIONAL_CONTROLLERS;
+    char *save = NULL;
+
+    for (char *tok = strtok_r(wanted, " ", &save); tok;
+         tok = strtok_r(NULL, " ", &save)) {
+        if (controllers_enabled(paths[1], tok))
+            continue;
+        for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+            int fd = open(paths[i], O_WRONLY | O_CLOEXEC);
+            if (fd >= 0 && write(fd, tok, strlen(tok)) >= 0) {
+                close(fd);
+                continue;
+            }
+            if (fd >= 0)
+                close(fd);
+            fprintf(stderr, "cgroup controller %s is not available: %m; "
+                            "options that need it will fail\n", tok + 1);
+            break;
+        }
     }
-    close(fd);
 }
 
 /**
- * @brief Создаёт cgroup директорию, если отсутствует
+ * @brief Создаёт cgroup директорию, если отсутствует, и включает контроллеры
+ * для cgroup экземпляров
+ *
+ * Запись в cgroup.subtree_control сериализуется ядром для всей иерархии,
+ * поэтому при параллельных запусках она выполняется, только если контроллеры
+ * ещё не включены. Без обязательных контроллеров (CGROUP_CONTROLLERS)
+ * возвращается ошибка; необязательные (cpuset для размещения, io для
+ * ограничений ввода-вывода) включаются, если доступны.
+ *
+ * @return 0 или -errno
  */
-static void create_cgroup_directory()
+int cgroup_create_directory(void)
 {
     struct stat st;
     if (stat(CGROUP_PATH, &st) == -1) {
-        if (mkdir(CGROUP_PATH, 0755) == -1) {
-            perror("mkdir cgroup");
-            exit(EXIT_FAILURE);
-        }
+        if (mkdir(CGROUP_PATH, 0755) == -1 && errno != EEXIST)
+            return fail("mkdir cgroup: %m\n");
+    }
+
+    if (!controllers_enabled(CGROUP_PATH "/cgroup.subtree_control",
+                             CGROUP_CONTROLLERS)) {
+        int err = write_to_file(CGROUP_BASE "/cgroup.subtree_control",
+                                CGROUP_CONTROLLERS);
+        if (err)
+            return err;
+        err = write_to_file(CGROUP_PATH "/cgroup.subtree_control",
+                            CGROUP_CONTROLLERS);
+        if (err)
+            return err;
     }
+
+    pthread_once(&optional_once, enable_optional);
+    return 0;
+}
+
+/**
+ * @brief Проверяет, что в cgroup экземпляра есть файл контроллера
+ *
+ * @return 0 или -EOPNOTSUPP, если контроллер не включён
+ */
+static int require_controller(int cgroup_fd, const char *file,
+                              const char *controller)
+{
+    if (faccessat(cgroup_fd, file, F_OK, 0) == 0)
+        return 0;
+    errno = EOPNOTSUPP;
+    return fail("cgroup controller %s is not available\n", controller);
 }
 
 /**
  * @brief Устанавливает лимит CPU (cpu.max) в cgroup
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
  * @param max_us Ограничение процессорного времени в микросекундах (например "20000 100000" для 20%)
  */
-void cgroup_set_cpu_limit(const char *max_us)
+int cgroup_set_cpu_limit(int cgroup_fd, const char *max_us)
 {
-    char path[256];
-    snprintf(path, sizeof(path), "%s/cpu.max", CGROUP_PATH);
-    write_to_file(path, max_us);
+    return write_to_cgroup(cgroup_fd, "cpu.max", max_us);
+}
+
+/**
+ * @brief Устанавливает вес CPU (cpu.weight) в cgroup
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param weight Вес 1..10000 (например "1000")
+ */
+int cgroup_set_cpu_weight(int cgroup_fd, const char *weight)
+{
+    return write_to_cgroup(cgroup_fd, "cpu.weight", weight);
+}
+
+/**
+ * @brief Включает или выключает класс SCHED_IDLE для cgroup (cpu.idle)
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param idle 1 — включить, 0 — выключить
+ */
+int cgroup_set_cpu_idle(int cgroup_fd, int idle)
+{
+    return write_to_cgroup(cgroup_fd, "cpu.idle", idle ? "1" : "0");
+}
+
+/**
+ * @brief Устанавливает границы частоты CPU (cpu.uclamp.min, cpu.uclamp.max) в cgroup
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param min Нижняя граница в процентах (например "50")
+ * @param max Верхняя граница в процентах или "max"
+ */
+int cgroup_set_uclamp(int cgroup_fd, const char *min, const char *max)
+{
+    int err = write_to_cgroup(cgroup_fd, "cpu.uclamp.max", max);
+    if (err)
+        return err;
+    return write_to_cgroup(cgroup_fd, "cpu.uclamp.min", min);
 }
 
 /**
  * @brief Устанавливает лимит памяти (memory.max) в cgroup
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
  * @param max_bytes Размер памяти с суффиксом (например "50M", "52428800")
  */
-void cgroup_set_memory_limit(const char *max_bytes)
+int cgroup_set_memory_limit(int cgroup_fd, const char *max_bytes)
 {
-    char path[256];
-    snprintf(path, sizeof(path), "%s/memory.max", CGROUP_PATH);
-    write_to_file(path, max_bytes);
+    return write_to_cgroup(cgroup_fd, "memory.max", max_bytes);
+}
+
+/**
+ * @brief Устанавливает порог мягкого ограничения памяти (memory.high) в cgroup
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param high_bytes Порог в байтах или с суффиксом (например "40M")
+ */
+int cgroup_set_memory_high(int cgroup_fd, const char *high_bytes)
+{
+    return write_to_cgroup(cgroup_fd, "memory.high", high_bytes);
+}
+
+/**
+ * @brief Устанавливает ограничения ввода-вывода (io.max) в cgroup
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param io_limits Устройство и ограничения (например "259:0 rbps=10485760")
+ */
+int cgroup_set_io_limit(int cgroup_fd, const char *io_limits)
+{
+    return write_to_cgroup(cgroup_fd, "io.max", io_limits);
+}
+
+/**
+ * @brief Устанавливает целевую задержку ввода-вывода (io.latency) в cgroup
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param target Устройство и цель (например "259:0 target=2000")
+ */
+int cgroup_set_io_latency(int cgroup_fd, const char *target)
+{
+    return write_to_cgroup(cgroup_fd, "io.latency", target);
+}
+
+/**
+ * @brief Ищет блочное устройство — источник монтирования с номером dev
+ *
+ * btrfs и другие файловые системы с несколькими устройствами сообщают в
+ * st_dev анонимный номер (старший номер 0), а источник монтирования в
+ * /proc/self/mountinfo указывает на настоящее устройство.
+ *
+ * @param dev Номер устройства из st_dev
+ * @param rdev Номер блочного устройства источника
+ * @return 0 или -ENODEV
+ */
+static int mount_source(dev_t dev, dev_t *rdev)
+{
+    FILE *f = fopen("/proc/self/mountinfo", "re");
+    if (f == NULL)
+        return fail("open /proc/self/mountinfo: %m\n");
+
+    char *line = NULL;
+    size_t cap = 0;
+    int err = -ENODEV;
+    while (getline(&line, &cap, f) > 0) {
+        // "<id> <parent> MAJ:MIN <root> <mount> <opts> [поля...] - <fs> <source> ..."
+        unsigned int maj, min;
+        char source[256];
+        char *sep = strstr(line, " - ");
+        struct stat st;
+
+        if (sscanf(line, "%*d %*d %u:%u", &maj, &min) != 2 ||
+            makedev(maj, min) != dev || sep == NULL)
+            continue;
+        if (sscanf(sep, " - %*s %255s", source) == 1 &&
+            stat(source, &st) == 0 && S_ISBLK(st.st_mode)) {
+            *rdev = st.st_rdev;
+            err = 0;
+            break;
+        }
+    }
+    free(line);
+    fclose(f);
+    return err;
+}
+
+int cgroup_io_device(const char *path, char *dev, size_t len)
+{
+    unsigned int maj, min;
+    char end;
+    dev_t devno;
+
+    if (sscanf(path, "%u:%u%c", &maj, &min, &end) == 2) {
+        devno = makedev(maj, min);
+    } else {
+        struct stat st;
+        if (stat(path, &st))
+            return fail("stat %s: %m\n", path);
+        devno = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+        if (major(devno) == 0 && mount_source(devno, &devno)) {
+            errno = ENODEV;
+            return fail("%s is not backed by a block device\n", path);
+        }
+    }
+
+    // Раздел: его диск — родительский каталог в /sys, номер диска в файле dev
+    char sys[64];
+    char buf[32];
+    snprintf(sys, sizeof(sys), "/sys/dev/block/%u:%u/partition",
+             major(devno), minor(devno));
+    if (access(sys, F_OK) == 0) {
+        snprintf(sys, sizeof(sys), "/sys/dev/block/%u:%u/../dev",
+                 major(devno), minor(devno));
+        int fd = open(sys, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return fail("open %s: %m\n", sys);
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        buf[n > 0 ? n : 0] = '\0';
+        if (sscanf(buf, "%u:%u", &maj, &min) != 2) {
+            errno = EIO;
+            return fail("Failed to read %s\n", sys);
+        }
+        devno = makedev(maj, min);
+    }
+
+    snprintf(dev, len, "%u:%u", major(devno), minor(devno));
+    return 0;
+}
+
+int cgroup_set_io(int cgroup_fd, const struct cgroup_io_opts *io,
+                  const char *dev)
+{
+    static const char *const keys[] = { "rbps", "wbps", "riops", "wiops" };
+    const uint64_t values[] = { io->rbps, io->wbps, io->riops, io->wiops };
+    char buf[256];
+    int err;
+
+    if ((err = require_controller(cgroup_fd, "io.max", "io")))
+        return err;
+
+    // Неуказанные ключи не трогаем: они остаются "max"
+    int n = snprintf(buf, sizeof(buf), "%s", dev);
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+        if (values[i])
+            n += snprintf(buf + n, sizeof(buf) - n, " %s=%llu", keys[i],
+                          (unsigned long long) values[i]);
+    if (n > (int) strlen(dev) && (err = cgroup_set_io_limit(cgroup_fd, buf)))
+        return err;
+
+    if (io->latency_us) {
+        snprintf(buf, sizeof(buf), "%s target=%llu", dev,
+                 (unsigned long long) io->latency_us);
+        if ((err = cgroup_set_io_latency(cgroup_fd, buf)))
+            return err;
+    }
+    return 0;
 }
 
 /**
  * @brief Ограничивает количество процессов в cgroup (pids.max)
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
  * @param max_pids Максимальное количество процессов (например "50")
  */
-void cgroup_set_pids_limit(const char *max_pids)
+int cgroup_set_pids_limit(int cgroup_fd, const char *max_pids)
 {
-    char path[256];
-    snprintf(path, sizeof(path), "%s/pids.max", CGROUP_PATH);
-    write_to_file(path, max_pids);
+    return write_to_cgroup(cgroup_fd, "pids.max", max_pids);
+}
+
+/**
+ * @brief Привязывает cgroup к CPU и узлам NUMA (cpuset.cpus, cpuset.mems)
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @param cpus Список CPU (например "4-7,12-15")
+ * @param mems Список узлов NUMA (например "1")
+ */
+int cgroup_set_cpuset(int cgroup_fd, const char *cpus, const char *mems)
+{
+    int err = require_controller(cgroup_fd, "cpuset.cpus", "cpuset");
+    if (!err)
+        err = write_to_cgroup(cgroup_fd, "cpuset.cpus", cpus);
+    if (err)
+        return err;
+    return write_to_cgroup(cgroup_fd, "cpuset.mems", mems);
 }
 
 /**
  * @brief Добавляет процесс с pid в cgroup (cgroup.procs)
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
  * @param pid Идентификатор процесса
  */
-void cgroup_add_process(pid_t pid)
+int cgroup_add_process(int cgroup_fd, pid_t pid)
 {
-    char path[256];
-    snprintf(path, sizeof(path), "%s/cgroup.procs", CGROUP_PATH);
     char pid_str[32];
     snprintf(pid_str, sizeof(pid_str), "%d", pid);
-    write_to_file(path, pid_str);
+    return write_to_cgroup(cgroup_fd, "cgroup.procs", pid_str);
+}
+
+int cgroup_open(const char *name)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", CGROUP_PATH, name);
+
+    int cgroup_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cgroup_fd < 0)
+        return fail("open cgroup %s: %m\n", name);
+    return cgroup_fd;
 }
 
 /**
- * @brief Инициализирует cgroup и применяет все установленные ограничения к процессу
+ * @brief Удаляет cgroup экземпляра, оставшуюся от прошлого запуска
  *
- * @param pid PID процесса, для которого выделяется cgroup
+ * Такая cgroup остаётся, если её процессы не завершились за время разборки
+ * песочницы. Повторно использовать её нельзя: в ней могут быть живые
+ * процессы и прежние настройки (cpu.idle, uclamp, io.max, cpuset,
+ * memory.high, подстроенный по PSI).
+ *
+ * @param name Имя cgroup экземпляра внутри isolate_group
+ * @return 0 или -errno
  */
-void cgroup_init_and_limit(pid_t pid)
+static int remove_stale(const char *name)
 {
-    create_cgroup_directory();
+    int cgroup_fd = cgroup_open(name);
+    if (cgroup_fd < 0)
+        return cgroup_fd == -ENOENT ? 0 : cgroup_fd;
+
+    fprintf(stderr, "cgroup %s is left from a previous run, removing it\n",
+            name);
+    int err = cgroup_kill(cgroup_fd);
+    if (!err)
+        err = cgroup_wait_empty(cgroup_fd, CGROUP_STALE_MS);
+    close(cgroup_fd);
+    if (!err)
+        err = cgroup_remove(name);
+    return err;
+}
+
+/**
+ * @brief Создаёт cgroup экземпляра и применяет к нему все ограничения
+ *
+ * @param name Имя cgroup экземпляра внутри isolate_group
+ * @return Дескриптор директории cgroup экземпляра или -errno
+ */
+int cgroup_init_and_limit(const char *name)
+{
+    uint64_t ts = trace_begin();
+    int err = cgroup_create_directory();
+    trace_end("cgroup_init_and_limit.root", ts);
+    if (err)
+        return err;
+
+    ts = trace_begin();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", CGROUP_PATH, name);
+    if (mkdir(path, 0755) == -1) {
+        if (errno != EEXIST)
+            return fail("mkdir cgroup %s: %m\n", name);
+        if ((err = remove_stale(name)))
+            return err;
+        if (mkdir(path, 0755) == -1)
+            return fail("mkdir cgroup %s: %m\n", name);
+    }
+
+    int cgroup_fd = cgroup_open(name);
+    trace_end("cgroup_init_and_limit.mkdir", ts);
+    if (cgroup_fd < 0)
+        return cgroup_fd;
 
     // Пример лимитов
-    cgroup_set_cpu_limit("20000 100000");  // 20% CPU
-    cgroup_set_memory_limit("50M");        // 50 МБ памяти
-    cgroup_set_pids_limit("50");           // Максимум 50 процессов
+    ts = trace_begin();
+    if ((err = cgroup_set_cpu_limit(cgroup_fd, "20000 100000")) ||  // 20% CPU
+        (err = cgroup_set_memory_limit(cgroup_fd, "50M")) ||        // 50 МБ памяти
+        (err = cgroup_set_pids_limit(cgroup_fd, "50"))) {           // Максимум 50 процессов
+        close(cgroup_fd);
+        return err;
+    }
+    trace_end("cgroup_init_and_limit.limits", ts);
+
+    return cgroup_fd;
+}
+
+int cgroup_count_instances(void)
+{
+    DIR *dir = opendir(CGROUP_PATH);
+    if (dir == NULL)
+        return errno == ENOENT ? 0 : fail("open %s: %m\n", CGROUP_PATH);
+
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL)
+        if (de->d_type == DT_DIR && de->d_name[0] != '.')
+            n++;
+    closedir(dir);
+    return n;
+}
+
+/**
+ * @brief Читает файл интерфейса cgroup относительно директории cgroup
+ * @param cgroup_fd Дескриптор директории cgroup
+ * @param file Имя файла (например "cpu.stat")
+ * @param buf Буфер для содержимого (завершается '\0')
+ * @param size Размер буфера
+ * @return Длина содержимого или -1, если файл недоступен
+ */
+ssize_t cgroup_read_file(int cgroup_fd, const char *file,
+                         char *buf, size_t size)
+{
+    int fd = openat(cgroup_fd, file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0)
+        return -1;
+
+    buf[len] = '\0';
+    return len;
+}
+
+/**
+ * @brief Ищет значение ключа в файле формата "ключ значение" (cpu.stat, memory.events)
+ *
+ * @param buf Содержимое файла
+ * @param key Имя ключа
+ * @return Значение ключа или -1, если ключ не найден
+ */
+static long long flat_keyed(const char *buf, const char *key)
+{
+    size_t n = strlen(key);
+
+    for (const char *line = buf; line && *line; line = strchr(line, '\n')) {
+        if (*line == '\n')
+            line++;
+        if (!strncmp(line, key, n) && line[n] == ' ')
+            return strtoll(line + n + 1, NULL, 10);
+    }
+    return -1;
+}
+
+/**
+ * @brief Посылает SIGKILL процессам из cgroup.procs
+ *
+ * Процесс, созданный после чтения списка, не получит сигнал; в песочнице
+ * его всё равно завершит ядро вместе с init её PID namespace.
+ *
+ * @param cgroup_fd Дескриптор директории cgroup экземпляра
+ * @return 0 или -errno
+ */
+static int kill_procs(int cgroup_fd)
+{
+    char buf[4096];
+
+    if (cgroup_read_file(cgroup_fd, "cgroup.procs", buf, sizeof(buf)) < 0)
+        return fail("cgroup.procs: %m\n");
+
+    for (char *p = buf, *end; *p; p = end) {
+        pid_t pid = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        if (kill(pid, SIGKILL) && errno != ESRCH)
+            return fail("kill %d: %m\n", pid);
+    }
+    return 0;
+}
+
+int cgroup_kill(int cgroup_fd)
+{
+    int fd = openat(cgroup_fd, "cgroup.kill", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return kill_procs(cgroup_fd);
+        return fail("cgroup.kill: %m\n");
+    }
+
+    int err = 0;
+    if (write(fd, "1", 1) < 0)
+        err = fail("cgroup.kill: %m\n");
+    close(fd);
+    return err;
+}
+
+int cgroup_wait_empty(int cgroup_fd, int timeout_ms)
+{
+    char buf[256];
+    int err = 0;
+
+    int fd = openat(cgroup_fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    uint64_t deadline = timing_now_us() + (uint64_t) timeout_ms * 1000;
+    for (;;) {
+        // Чтение с начала сбрасывает уведомление: следующий POLLPRI придёт
+        // при новом изменении cgroup.events
+        ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (len < 0) {
+            err = fail("cgroup.events: %m\n");
+            break;
+        }
+        buf[len] = '\0';
+        if (flat_keyed(buf, "populated") <= 0)
+            break;
+
+        uint64_t now = timing_now_us();
+        struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+        if (now >= deadline ||
+            poll(&pfd, 1, (int) ((deadline - now + 999) / 1000)) == 0) {
+            errno = ETIMEDOUT;
+            err = fail("cgroup is still populated after %d ms\n", timeout_ms);
+            break;
+        }
+    }
+    close(fd);
+    return err;
+}
 
-    cgroup_add_process(pid);
+int cgroup_remove(const char *name)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", CGROUP_PATH, name);
+
+    if (rmdir(path) && errno != ENOENT)
+        return fail("rmdir cgroup %s: %m\n", name);
+    return 0;
+}
+
+void cgroup_read_usage(int cgroup_fd, struct cgroup_usage *usage)
+{
+    char buf[4096];
+
+    memset(usage, 0xff, sizeof(*usage));
+
+    if (cgroup_read_file(cgroup_fd, "cpu.stat", buf, sizeof(buf)) >= 0) {
+        usage->cpu_usage_usec = flat_keyed(buf, "usage_usec");
+        usage->cpu_user_usec = flat_keyed(buf, "user_usec");
+        usage->cpu_system_usec = flat_keyed(buf, "system_usec");
+        usage->cpu_nr_throttled = flat_keyed(buf, "nr_throttled");
+        usage->cpu_throttled_usec = flat_keyed(buf, "throttled_usec");
+    }
+
+    if (cgroup_read_file(cgroup_fd, "memory.peak", buf, sizeof(buf)) > 0)
+        usage->memory_peak = strtoll(buf, NULL, 10);
+
+    if (cgroup_read_file(cgroup_fd, "memory.events", buf, sizeof(buf)) >= 0) {
+        usage->memory_high = flat_keyed(buf, "high");
+        usage->memory_oom = flat_keyed(buf, "oom");
+        usage->memory_oom_kill = flat_keyed(buf, "oom_kill");
+    }
+
+    if (cgroup_read_file(cgroup_fd, "pids.peak", buf, sizeof(buf)) > 0)
+        usage->pids_peak = strtoll(buf, NULL, 10);
+
+    // io.stat: строка на устройство "MAJ:MIN rbytes=.. wbytes=.. rios=.. wios=.. ..."
+    if (cgroup_read_file(cgroup_fd, "io.stat", buf, sizeof(buf)) >= 0) {
+        usage->io_rbytes = usage->io_wbytes = 0;
+        usage->io_rios = usage->io_wios = 0;
+
+        char *save = NULL;
+        for (char *tok = strtok_r(buf, " \n", &save); tok;
+             tok = strtok_r(NULL, " \n", &save)) {
+            long long v;
+            if (sscanf(tok, "rbytes=%lld", &v) == 1)
+                usage->io_rbytes += v;
+            else if (sscanf(tok, "wbytes=%lld", &v) == 1)
+                usage->io_wbytes += v;
+            else if (sscanf(tok, "rios=%lld", &v) == 1)
+                usage->io_rios += v;
+            else if (sscanf(tok, "wios=%lld", &v) == 1)
+                usage->io_wios += v;
+        }
+    }
+}
+
+/**
+ * @brief Записывает пару "ключ":значение, -1 — как null
+ */
+static void write_json_value(FILE *f, const char *sep, const char *key,
+                             long long value)
+{
+    if (value < 0)
+        fprintf(f, "%s\"%s\":null", sep, key);
+    else
+        fprintf(f, "%s\"%s\":%lld", sep, key, value);
+}
+
+void cgroup_usage_write_json(FILE *f, const struct cgroup_usage *usage)
+{
+    write_json_value(f, "{\"cpu\":{", "usage_usec", usage->cpu_usage_usec);
+    write_json_value(f, ",", "user_usec", usage->cpu_user_usec);
+    write_json_value(f, ",", "system_usec", usage->cpu_system_usec);
+    write_json_value(f, ",", "nr_throttled", usage->cpu_nr_throttled);
+    write_json_value(f, ",", "throttled_usec", usage->cpu_throttled_usec);
+    write_json_value(f, "},\"memory\":{", "peak", usage->memory_peak);
+    write_json_value(f, ",", "high", usage->memory_high);
+    write_json_value(f, ",", "oom", usage->memory_oom);
+    write_json_value(f, ",", "oom_kill", usage->memory_oom_kill);
+    write_json_value(f, "},\"pids\":{", "peak", usage->pids_peak);
+    write_json_value(f, "},\"io\":{", "rbytes", usage->io_rbytes);
+    write_json_value(f, ",", "wbytes", usage->io_wbytes);
+    write_json_value(f, ",", "rios", usage->io_rios);
+    write_json_value(f, ",", "wios", usage->io_wios);
+    fputs("}}", f);
 }
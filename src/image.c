@@ -0,0 +1,426 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <linux/loop.h>
+#include <linux/magic.h>
+#include "../include/util.h"
+#include "../include/instance.h"
+#include "../include/image.h"
+
+#define IMAGE_REFS_MAGIC 0x696d6731u
+
+/**
+ * @def EROFS_SUPER_OFFSET
+ * @brief Смещение суперблока erofs от начала образа.
+ */
+#define EROFS_SUPER_OFFSET 1024
+
+/**
+ * @def IMAGE_HASH_CHUNK
+ * @brief Размер блока чтения при вычислении хэша образа.
+ */
+#define IMAGE_HASH_CHUNK (64 * 1024)
+
+/**
+ * @brief Экземпляры, использующие смонтированный образ; файл
+ *        IMAGE_MOUNT_DIR/<sha256>.refs, изменяется под flock()
+ */
+struct image_refs {
+    uint32_t magic;                         /**< IMAGE_REFS_MAGIC */
+    uint8_t held[INSTANCE_MAX / 8];         /**< Битовая карта номеров экземпляров */
+};
+
+int image_is_file(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/**
+ * @brief Считает SHA-256 содержимого файла
+ *
+ * @return 0 или -errno
+ */
+static int hash_file(int fd, const char *path, char digest[SHA256_HEX_SIZE])
+{
+    char *buf = malloc(IMAGE_HASH_CHUNK);
+    if (buf == NULL)
+        return -ENOMEM;
+
+    struct sha256 c;
+    sha256_init(&c);
+
+    ssize_t n;
+    off_t off = 0;
+    while ((n = pread(fd, buf, IMAGE_HASH_CHUNK, off)) > 0) {
+        sha256_update(&c, buf, n);
+        off += n;
+    }
+    free(buf);
+
+    if (n < 0)
+        return fail("Failed to read image %s: %m\n", path);
+
+    sha256_final_hex(&c, digest);
+    return 0;
+}
+
+/**
+ * @brief Копирует образ в хранилище под именем его хэша
+ *
+ * Копия пишется во временный файл и переименовывается, поэтому параллельные
+ * импорты одного образа не видят частично записанный файл. На файловых
+ * системах с reflink (btrfs, xfs) копирование не дублирует блоки. Исходный
+ * файл не связывается жёсткой ссылкой: его изменение на месте испортило бы
+ * образ, уже смонтированный у работающих экземпляров.
+ *
+ * @return 0 или -errno
+ */
+static int import(int fd, const char *path, const char *digest)
+{
+    char dst[PATH_MAX];
+    char tmp[PATH_MAX];
+    struct stat st;
+
+    snprintf(dst, sizeof(dst), IMAGE_STORE "/%s.img", digest);
+    if (access(dst, F_OK) == 0)
+        return 0;
+
+    if (fstat(fd, &st))
+        return fail("Failed to stat image %s: %m\n", path);
+
+    snprintf(tmp, sizeof(tmp), IMAGE_STORE "/.%s.%d", digest, gettid());
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444);
+    if (out < 0)
+        return fail("Failed to create %s: %m\n", tmp);
+
+    int err = 0;
+    if (ioctl(out, FICLONE, fd)) {
+        loff_t in_off = 0;
+        while (in_off < st.st_size) {
+            ssize_t n = copy_file_range(fd, &in_off, out, NULL,
+                                        st.st_size - in_off, 0);
+            if (n <= 0) {
+                if (n == 0)
+                    errno = EIO;
+                err = fail("Failed to copy image %s to %s: %m\n", path, tmp);
+                break;
+            }
+        }
+    }
+
+    if (!err && fsync(out))
+        err = fail("Failed to sync %s: %m\n", tmp);
+    close(out);
+
+    if (!err && rename(tmp, dst))
+        err = fail("Failed to rename %s to %s: %m\n", tmp, dst);
+    if (err)
+        unlink(tmp);
+    return err;
+}
+
+/**
+ * @brief Находит хэш образа и при необходимости импортирует его в хранилище
+ *
+ * Хэш файла запоминается в IMAGE_INDEX по устройству, inode, размеру и
+ * времени изменения, поэтому полное чтение образа нужно только при первом
+ * запуске с ним или после его изменения.
+ *
+ * @return 0 или -errno
+ */
+static int resolve(const char *path, char digest[SHA256_HEX_SIZE])
+{
+    char key[PATH_MAX];
+    char img[PATH_MAX];
+    struct stat st;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return fail("Failed to open image %s: %m\n", path);
+    if (fstat(fd, &st)) {
+        int err = fail("Failed to stat image %s: %m\n", path);
+        close(fd);
+        return err;
+    }
+
+    snprintf(key, sizeof(key), IMAGE_INDEX "/%lx-%lx-%lld-%lld.%09ld",
+             (unsigned long) st.st_dev, (unsigned long) st.st_ino,
+             (long long) st.st_size, (long long) st.st_mtim.tv_sec,
+             st.st_mtim.tv_nsec);
+
+    ssize_t n = readlink(key, digest, SHA256_HEX_SIZE);
+    if (n == SHA256_HEX_SIZE - 1) {
+        digest[n] = '\0';
+        snprintf(img, sizeof(img), IMAGE_STORE "/%s.img", digest);
+        if (access(img, F_OK) == 0) {
+            close(fd);
+            return 0;
+        }
+    }
+
+    int err = mkdirs(IMAGE_INDEX);
+    if (!err)
+        err = hash_file(fd, path, digest);
+    if (!err)
+        err = import(fd, path, digest);
+    close(fd);
+    if (err)
+        return err;
+
+    // Ссылка могла остаться от удалённого из хранилища образа
+    unlink(key);
+    if (symlink(digest, key) && errno != EEXIST)
+        fprintf(stderr, "Failed to index image %s: %m\n", path);
+    return 0;
+}
+
+/**
+ * @brief Определяет файловую систему образа по сигнатуре суперблока
+ *
+ * @return "erofs", "squashfs" или NULL
+ */
+static const char *image_fstype(int fd)
+{
+    uint32_t magic;
+
+    if (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+        magic == SQUASHFS_MAGIC)
+        return "squashfs";
+    if (pread(fd, &magic, sizeof(magic), EROFS_SUPER_OFFSET) == sizeof(magic) &&
+        magic == EROFS_SUPER_MAGIC_V1)
+        return "erofs";
+    return NULL;
+}
+
+/**
+ * @brief Настраивает loop-устройство поверх файла образа
+ *
+ * LOOP_CONFIGURE настраивает устройство одним вызовом, без гонки между
+ * LOOP_SET_FD и LOOP_SET_STATUS64. Прямой ввод-вывод исключает второй
+ * экземпляр страниц образа в кэше (файла и блочного устройства), а
+ * LO_FLAGS_AUTOCLEAR отключает устройство при последнем отмонтировании.
+ * Устройство, занятое другим процессом между LOOP_CTL_GET_FREE и
+ * настройкой, пропускается.
+ *
+ * @param file Дескриптор файла образа
+ * @param dev Буфер для пути к устройству
+ * @param len Размер буфера
+ * @return Дескриптор устройства или -errno
+ */
+static int loop_attach(int file, char *dev, size_t len)
+{
+    int ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl < 0)
+        return fail("Failed to open /dev/loop-control: %m\n");
+
+    struct loop_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.fd = file;
+    cfg.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO;
+
+    for (int attempt = 0; attempt < 16; attempt++) {
+        int n = ioctl(ctl, LOOP_CTL_GET_FREE);
+        if (n < 0)
+            break;
+
+        snprintf(dev, len, "/dev/loop%d", n);
+        int fd = open(dev, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            break;
+
+        int ret = ioctl(fd, LOOP_CONFIGURE, &cfg);
+        // Файловая система хранилища не поддерживает O_DIRECT
+        if (ret && errno == EINVAL && (cfg.info.lo_flags & LO_FLAGS_DIRECT_IO)) {
+            cfg.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+            ret = ioctl(fd, LOOP_CONFIGURE, &cfg);
+        }
+        if (ret == 0) {
+            close(ctl);
+            return fd;
+        }
+
+        int err = errno;
+        close(fd);
+        errno = err;
+        if (err != EBUSY)
+            break;
+    }
+
+    int err = fail("Failed to set up loop device for image: %m\n");
+    close(ctl);
+    return err;
+}
+
+/**
+ * @brief Проверяет, смонтирован ли образ: точка монтирования на другом
+ *        устройстве, чем IMAGE_MOUNT_DIR
+ */
+static int mounted(const char *dir)
+{
+    struct stat st, parent;
+    return stat(dir, &st) == 0 && stat(IMAGE_MOUNT_DIR, &parent) == 0 &&
+           st.st_dev != parent.st_dev;
+}
+
+/**
+ * @brief Монтирует образ из хранилища в точку монтирования
+ *
+ * @return 0 или -errno
+ */
+static int mount_image(const char *digest, const char *dir)
+{
+    char img[PATH_MAX];
+    char dev[32];
+
+    snprintf(img, sizeof(img), IMAGE_STORE "/%s.img", digest);
+    int file = open(img, O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+        return fail("Failed to open %s: %m\n", img);
+
+    int err = 0;
+    const char *fstype = image_fstype(file);
+    if (fstype == NULL) {
+        errno = EINVAL;
+        err = fail("Unknown image format %s, expected erofs or squashfs\n", img);
+    }
+
+    int loop = -1;
+    if (!err && (loop = loop_attach(file, dev, sizeof(dev))) < 0)
+        err = loop;
+    close(file);
+
+    if (!err && mkdir(dir, 0755) && errno != EEXIST)
+        err = fail("Failed to mkdir %s: %m\n", dir);
+    if (!err && mount(dev, dir, fstype, MS_RDONLY | MS_NODEV | MS_NOSUID, NULL))
+        err = fail("Failed to mount %s image %s: %m\n", fstype, img);
+
+    // После монтирования устройство держит суперблок; без монтирования
+    // закрытие отключает его благодаря LO_FLAGS_AUTOCLEAR
+    if (loop >= 0)
+        close(loop);
+    return err;
+}
+
+/**
+ * @brief Открывает и блокирует счётчик ссылок образа
+ *
+ * @param fd Указатель для дескриптора (блокировка снимается при закрытии)
+ * @return Отображённый счётчик или NULL (errno сохраняется)
+ */
+static struct image_refs *refs_open(const char *digest, int *fd)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), IMAGE_MOUNT_DIR "/%s.refs", digest);
+
+    *fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (*fd < 0) {
+        fail("Failed to open %s: %m\n", path);
+        return NULL;
+    }
+
+    struct image_refs *refs = MAP_FAILED;
+    if (flock(*fd, LOCK_EX))
+        fail("Failed to lock %s: %m\n", path);
+    else if (ftruncate(*fd, sizeof(struct image_refs)))
+        fail("Failed to resize %s: %m\n", path);
+    else if ((refs = mmap(NULL, sizeof(*refs), PROT_READ | PROT_WRITE,
+                          MAP_SHARED, *fd, 0)) == MAP_FAILED)
+        fail("Failed to map %s: %m\n", path);
+
+    if (refs == MAP_FAILED) {
+        int err = errno;
+        close(*fd);
+        errno = err;
+        return NULL;
+    }
+
+    if (refs->magic != IMAGE_REFS_MAGIC) {
+        memset(refs, 0, sizeof(*refs));
+        refs->magic = IMAGE_REFS_MAGIC;
+    }
+    return refs;
+}
+
+/**
+ * @brief Снимает ссылки завершившихся экземпляров
+ *
+ * @return Число оставшихся ссылок
+ */
+static int refs_purge(struct image_refs *refs)
+{
+    int count = 0;
+
+    for (int id = 0; id < INSTANCE_MAX; id++) {
+        if (!(refs->held[id / 8] & (1u << (id % 8))))
+            continue;
+        if (instance_running(id))
+            count++;
+        else
+            refs->held[id / 8] &= ~(1u << (id % 8));
+    }
+    return count;
+}
+
+int image_acquire(const char *path, int id, char digest[SHA256_HEX_SIZE],
+                  char *root, size_t len)
+{
+    int err = resolve(path, digest);
+    if (err)
+        return err;
+    if ((err = mkdirs(IMAGE_MOUNT_DIR)))
+        return err;
+
+    int fd;
+    struct image_refs *refs = refs_open(digest, &fd);
+    if (refs == NULL)
+        return -errno;
+
+    snprintf(root, len, IMAGE_MOUNT_DIR "/%s", digest);
+    if (!mounted(root))
+        err = mount_image(digest, root);
+    if (!err)
+        refs->held[id / 8] |= 1u << (id % 8);
+
+    munmap(refs, sizeof(*refs));
+    close(fd);
+    return err;
+}
+
+void image_release(const char *digest, int id)
+{
+    char root[PATH_MAX];
+    int fd;
+
+    struct image_refs *refs = refs_open(digest, &fd);
+    if (refs == NULL)
+        return;
+
+    refs->held[id / 8] &= ~(1u << (id % 8));
+
+    // Копии монтирования в namespaces песочниц не зависят от этого:
+    // loop-устройство отключится, когда исчезнет последняя из них
+    snprintf(root, sizeof(root), IMAGE_MOUNT_DIR "/%s", digest);
+    if (refs_purge(refs) == 0 && mounted(root)) {
+        if (umount2(root, MNT_DETACH))
+            fprintf(stderr, "Failed to unmount image %s: %m\n", root);
+        else
+            rmdir(root);
+    }
+
+    munmap(refs, sizeof(*refs));
+    close(fd);
+}
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "../include/util.h"
+#include "../include/instance.h"
+
+/**
+ * @brief Создаёт каталог, если он отсутствует
+ *
+ * @param path Путь к каталогу
+ * @return 0 или -errno
+ */
+static int ensure_dir(const char *path)
+{
+    if (mkdir(path, 0755) && errno != EEXIST)
+        return fail("Failed to mkdir %s: %m\n", path);
+    return 0;
+}
+
+/**
+ * @brief Пытается захватить номер экземпляра
+ *
+ * Файлы блокировок не удаляются: удаление файла под flock() позволило бы
+ * двум процессам заблокировать разные inode с одним именем.
+ *
+ * @param id Номер экземпляра
+ * @return Дескриптор с захваченной блокировкой, -EWOULDBLOCK, если номер
+ *         занят, или -errno
+ */
+static int try_lock(int id)
+{
+    char path[64];
+    snprintf(path, sizeof(path), INSTANCE_DIR "/%d.lock", id);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return fail("Failed to open %s: %m\n", path);
+
+    int err = -EWOULDBLOCK;
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        // PID предыдущего владельца номера больше не действителен
+        if (ftruncate(fd, 0) == 0)
+            return fd;
+        err = fail("Failed to truncate %s: %m\n", path);
+    } else if (errno != EWOULDBLOCK) {
+        err = fail("Failed to lock %s: %m\n", path);
+    }
+
+    close(fd);
+    return err;
+}
+
+int instance_acquire(int *lock_fd)
+{
+    int err;
+    if ((err = ensure_dir("/run/isolate")) || (err = ensure_dir(INSTANCE_DIR)))
+        return err;
+
+    // Разносим стартовые позиции параллельных процессов по пространству
+    // номеров; потоки одного процесса продолжают общий счётчик
+    static unsigned int next;
+    unsigned int start = (unsigned int) getpid() * 2654435761u;
+    unsigned int zero = 0;
+    __atomic_compare_exchange_n(&next, &zero, start, 0,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    for (int n = 0; n < INSTANCE_MAX; n++) {
+        int id = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) % INSTANCE_MAX;
+        int fd = try_lock(id);
+        if (fd >= 0) {
+            *lock_fd = fd;
+            return id;
+        }
+        if (fd != -EWOULDBLOCK)
+            return fd;
+    }
+
+    errno = EAGAIN;
+    return fail("No free instance id\n");
+}
+
+int instance_set_pid(int lock_fd, pid_t pid, const char *seccomp)
+{
+    char buf[32 + SHA256_HEX_SIZE];
+    int len = snprintf(buf, sizeof(buf), "%d %s\n", pid,
+                       *seccomp ? seccomp : "-");
+
+    if (pwrite(lock_fd, buf, len, 0) != len)
+        return fail("Failed to record pid of instance: %m\n");
+    return 0;
+}
+
+int instance_running(int id)
+{
+    char path[64];
+    snprintf(path, sizeof(path), INSTANCE_DIR "/%d.lock", id);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    int running = flock(fd, LOCK_SH | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+    close(fd);
+    return running;
+}
+
+int instance_pid(int id, pid_t *pid, char seccomp[SHA256_HEX_SIZE])
+{
+    char path[64];
+    char buf[32 + SHA256_HEX_SIZE];
+
+    if (id < 0 || id >= INSTANCE_MAX) {
+        errno = EINVAL;
+        return fail("Invalid instance id %d\n", id);
+    }
+
+    snprintf(path, sizeof(path), INSTANCE_DIR "/%d.lock", id);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return fail("No sandbox instance %d: %m\n", id);
+
+    // Номер занят, пока владелец держит блокировку
+    int err = 0;
+    if (flock(fd, LOCK_SH | LOCK_NB) == 0) {
+        errno = ESRCH;
+        err = fail("Sandbox instance %d is not running\n", id);
+    } else if (errno != EWOULDBLOCK) {
+        err = fail("Failed to check lock %s: %m\n", path);
+    }
+    if (err) {
+        close(fd);
+        return err;
+    }
+
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    close(fd);
+    if (len <= 0) {
+        errno = EAGAIN;
+        return fail("Sandbox instance %d is not started yet\n", id);
+    }
+    buf[len] = '\0';
+
+    // Строка "PID хэш" или "PID -" для песочницы без фильтра
+    char *end;
+    *pid = (pid_t) strtol(buf, &end, 10);
+    if (seccomp) {
+        seccomp[0] = '\0';
+        if (*end == ' ' && end[1] != '-')
+            sscanf(end + 1, "%64[0-9a-f]", seccomp);
+    }
+    return 0;
+}
+
+void instance_release(int lock_fd)
+{
+    close(lock_fd);
+}
+
+/**
+ * @brief Диапазон идентификаторов хоста, который делится между экземплярами
+ */
+struct subid_range {
+    unsigned long start;    /**< Первый идентификатор */
+    unsigned long count;    /**< Число идентификаторов */
+};
+
+static struct subid_range subuid, subgid;
+static pthread_once_t subid_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Ищет диапазон INSTANCE_SUBID_USER в файле формата /etc/subuid
+ *        ("имя:начало:количество"); без записи — диапазон по умолчанию
+ */
+static void read_subid_range(const char *path, struct subid_range *r)
+{
+    char line[256];
+    size_t nlen = strlen(INSTANCE_SUBID_USER);
+
+    r->start = INSTANCE_SUBID_BASE;
+    r->count = (unsigned long) INSTANCE_MAX * INSTANCE_SUBID_SIZE;
+
+    FILE *f = fopen(path, "re");
+    if (f == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long start, count;
+        if (!strncmp(line, INSTANCE_SUBID_USER, nlen) && line[nlen] == ':' &&
+            sscanf(line + nlen + 1, "%lu:%lu", &start, &count) == 2) {
+            r->start = start;
+            r->count = count;
+            break;
+        }
+    }
+    fclose(f);
+}
+
+static void read_subids(void)
+{
+    read_subid_range("/etc/subuid", &subuid);
+    read_subid_range("/etc/subgid", &subgid);
+}
+
+int instance_subids(int id, uid_t *uid, gid_t *gid)
+{
+    pthread_once(&subid_once, read_subids);
+
+    unsigned long off = (unsigned long) id * INSTANCE_SUBID_SIZE;
+    if (off + INSTANCE_SUBID_SIZE > subuid.count ||
+        off + INSTANCE_SUBID_SIZE > subgid.count) {
+        errno = ERANGE;
+        return fail("Subordinate id range of %s is too small for instance %d\n",
+                    INSTANCE_SUBID_USER, id);
+    }
+
+    *uid = subuid.start + off;
+    *gid = subgid.start + off;
+    return 0;
+}
+
+void instance_addrs(int id, char *host, char *peer, size_t len)
+{
+    struct in_addr addr;
+    uint32_t subnet = INSTANCE_SUBNET + 4u * id;
+
+    addr.s_addr = htonl(subnet + 1);
+    inet_ntop(AF_INET, &addr, host, len);
+
+    addr.s_addr = htonl(subnet + 2);
+    inet_ntop(AF_INET, &addr, peer, len);
+}
@@ -1,239 +1,341 @@
 #define _GNU_SOURCE
 #include <stdio.h>
-#include <sched.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <unistd.h>
-#include <sys/mount.h>
-#include <sys/prctl.h>
-#include <sys/stat.h>
-#include <wait.h>
-#include <memory.h>
-#include <syscall.h>
-#include <errno.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include "../include/util.h"
-#include "../include/netns.h"
-#include "../include/cgroup_control.h"
+#include "../include/sandbox.h"
+#include "../include/pool.h"
+#include "../include/trace.h"
+#include "../include/supervisor.h"
 
 /**
- * @brief Настраивает mount namespace с pivot_root и монтирует procfs
- *
- * @param rootfs Путь к корневой файловой системе
+ * @brief Параметры командной строки
  */
-static void prepare_mntns(char *rootfs);
+struct options {
+    char **argv;            /**< Аргументы для запускаемой команды */
+    int pool_size;          /**< Размер пула для режима демона (0 — одиночный запуск) */
+    int client;             /**< Передать команду демону пула */
+    const char *socket;     /**< Путь к unix-сокету демона пула */
+    struct sandbox_opts sandbox;  /**< Параметры песочниц */
+    const char *timings;    /**< Файл для JSON с длительностями фаз запуска */
+    const char *trace;      /**< Файл трассы в формате Chrome trace-event */
+    const char *report;     /**< Файл для итога запуска с потреблением ресурсов */
+    int exec_id;            /**< Номер экземпляра для isolate exec или -1 */
+    struct supervisor_limits limits;  /**< Лимит времени, границы адаптивных лимитов (PSI) и период сетевых счётчиков */
+};
 
 /**
- * @brief Монтирует файловую систему proc
+ * @brief Разбирает положительное целое значение опции
+ *
+ * @param name Имя опции для сообщения об ошибке
+ * @param arg Значение опции
+ * @return Значение; вызывает die() для некорректного значения
  */
-static void prepare_procfs();
+static uint64_t parse_count(const char *name, const char *arg)
+{
+    char *end;
+    uint64_t v = strtoull(arg, &end, 10);
 
-/**
- * @brief Структура параметров для передачи между процессами
- */
-struct params {
-    int fd[2];       /**< Дескрипторы для pipe связи между процессами */
-    char **argv;     /**< Аргументы для запускаемой команды */
-};
+    if (*end != '\0' || end == arg || v == 0)
+        die("Invalid %s %s\n", name, arg);
+    return v;
+}
 
 /**
  * @brief Парсит аргументы командной строки, пропуская имя бинарника
  *
+ * После опций следует команда или "exec <номер экземпляра> команда" для
+ * запуска команды в уже работающей песочнице.
+ *
+ * Поддерживаемые опции:
+ *   --pool N         запустить демон пула из N "тёплых" песочниц
+ *   --client         выполнить команду в песочнице из пула
+ *   --socket PATH    путь к unix-сокету демона пула
+ *   --rootfs PATH    корневая файловая система песочницы (по умолчанию rootfs):
+ *                    каталог или файл образа erofs/squashfs
+ *   --overlay        смонтировать rootfs как нижний слой overlay с записью в tmpfs
+ *   --seccomp FILE   фильтр системных вызовов по политике из FILE
+ *   --profile P      класс задержки: latency-critical, normal, batch или idle
+ *   --timings FILE   записать длительности фаз запуска в FILE (JSON)
+ *   --trace FILE     записать трассу шагов запуска в FILE (Chrome trace-event)
+ *   --placement P    привязать к CPU: pack (плотно) или spread (по доменам LLC)
+ *   --cpus N         число CPU исключительного среза (по умолчанию 1)
+ *   --exclusive      исключительный срез из целых ядер вместо общего домена LLC
+ *   --net-driver D   интерфейсы песочницы: veth (по умолчанию), veth-mq,
+ *                    ipvlan, macvlan или netkit
+ *   --uplink IF      интерфейс хоста для ipvlan и macvlan
+ *   --rate R         лимит скорости сети в каждую сторону, бит/с (100m, 1g)
+ *   --burst N        запас лимита скорости в байтах (суффиксы K, M)
+ *   --psi-memory MIN:MAX  подстраивать memory.high по memory.pressure
+ *                    в пределах MIN..MAX байт (суффиксы K, M, G)
+ *   --psi-cpu MIN:MAX     подстраивать квоту cpu.max по cpu.pressure
+ *                    в пределах MIN..MAX процентов одного CPU
+ *   --timeout SEC    завершить песочницу через SEC секунд (допускаются доли)
+ *   --net-stats SEC  каждые SEC секунд писать в stderr сетевые счётчики
+ *                    и потребление ресурсов песочниц (с --perf — и счётчики perf)
+ *   --perf           считать такты, инструкции, промахи LLC и переключения
+ *                    контекста в cgroup песочницы (perf_event) для --report
+ *   --log-dir DIR    писать stdout и stderr команды в DIR/<id>-<pid>.stdout
+ *                    и .stderr вместо терминала
+ *   --log-size N     размер файла журнала (суффиксы K, M, G; по умолчанию 1M),
+ *                    заполненный файл переименовывается в .1
+ *   --log-rate N     лимит записи журналов песочницы, байт/с (суффиксы K, M, G)
+ *   --log-tee        дублировать вывод в stdout/stderr isolate, если это каналы
+ *   --io-rbps N      лимит чтения с диска rootfs, байт/с (суффиксы K, M, G)
+ *   --io-wbps N      лимит записи на диск rootfs, байт/с (суффиксы K, M, G)
+ *   --io-riops N     лимит операций чтения в секунду
+ *   --io-wiops N     лимит операций записи в секунду
+ *   --io-latency MS  целевая задержка ввода-вывода (io.latency), мс
+ *   --io-device DEV  диск для --io-* (путь или MAJ:MIN) вместо диска rootfs
+ *   --report FILE    дописать в FILE итог запуска с потреблением ресурсов
+ *                    cgroup (JSON, строка на запуск; "-" — stderr)
+ *
  * @param argc Количество аргументов
  * @param argv Массив аргументов
- * @param params Структура параметров для заполнения
+ * @param opts Структура параметров для заполнения
  */
 static void parse_args(int argc, char **argv,
-                       struct params *params)
+                       struct options *opts)
 {
 #define NEXT_ARG() do { argc--; argv++; } while (0)
+#define ARG_VALUE() do { \
+        NEXT_ARG(); \
+        if (argc < 1) \
+            die("Option %s requires a value\n", argv[-1]); \
+    } while (0)
 
     // Пропускаем имя исполняемого файла
     NEXT_ARG();
 
+    while (argc > 0 && argv[0][0] == '-') {
+        if (!strcmp(argv[0], "--")) {
+            NEXT_ARG();
+            break;
+        } else if (!strcmp(argv[0], "--pool")) {
+            ARG_VALUE();
+            uint64_t n = parse_count("pool size", argv[0]);
+            if (n > POOL_MAX)
+                die("Pool size must be in 1..%d\n", POOL_MAX);
+            opts->pool_size = (int) n;
+        } else if (!strcmp(argv[0], "--client")) {
+            opts->client = 1;
+        } else if (!strcmp(argv[0], "--socket")) {
+            ARG_VALUE();
+            opts->socket = argv[0];
+        } else if (!strcmp(argv[0], "--rootfs")) {
+            ARG_VALUE();
+            opts->sandbox.rootfs = argv[0];
+        } else if (!strcmp(argv[0], "--overlay")) {
+            opts->sandbox.overlay = 1;
+        } else if (!strcmp(argv[0], "--seccomp")) {
+            ARG_VALUE();
+            opts->sandbox.seccomp = argv[0];
+        } else if (!strcmp(argv[0], "--profile")) {
+            ARG_VALUE();
+            opts->sandbox.profile = profile_parse(argv[0]);
+        } else if (!strcmp(argv[0], "--timings")) {
+            ARG_VALUE();
+            opts->timings = argv[0];
+            opts->sandbox.timings = 1;
+        } else if (!strcmp(argv[0], "--trace")) {
+            ARG_VALUE();
+            opts->trace = argv[0];
+        } else if (!strcmp(argv[0], "--report")) {
+            ARG_VALUE();
+            opts->report = argv[0];
+        } else if (!strcmp(argv[0], "--placement")) {
+            ARG_VALUE();
+            opts->sandbox.placement.policy = placement_policy_parse(argv[0]);
+        } else if (!strcmp(argv[0], "--cpus")) {
+            ARG_VALUE();
+            uint64_t n = parse_count("CPU count", argv[0]);
+            if (n > CPU_SETSIZE)
+                die("CPU count must be in 1..%d\n", CPU_SETSIZE);
+            opts->sandbox.placement.cpus = (int) n;
+        } else if (!strcmp(argv[0], "--exclusive")) {
+            opts->sandbox.placement.exclusive = 1;
+        } else if (!strcmp(argv[0], "--net-driver")) {
+            ARG_VALUE();
+            opts->sandbox.net.driver = net_driver_parse(argv[0]);
+        } else if (!strcmp(argv[0], "--uplink")) {
+            ARG_VALUE();
+            opts->sandbox.net.uplink = argv[0];
+        } else if (!strcmp(argv[0], "--rate")) {
+            ARG_VALUE();
+            net_parse_rate(argv[0], &opts->sandbox.net);
+        } else if (!strcmp(argv[0], "--burst")) {
+            ARG_VALUE();
+            net_parse_burst(argv[0], &opts->sandbox.net);
+        } else if (!strcmp(argv[0], "--psi-memory")) {
+            ARG_VALUE();
+            psi_parse_memory(argv[0], &opts->limits.psi);
+        } else if (!strcmp(argv[0], "--psi-cpu")) {
+            ARG_VALUE();
+            psi_parse_cpu(argv[0], &opts->limits.psi);
+        } else if (!strcmp(argv[0], "--timeout")) {
+            char *end;
+            ARG_VALUE();
+            double sec = strtod(argv[0], &end);
+            if (*end != '\0' || sec <= 0)
+                die("Invalid timeout %s\n", argv[0]);
+            opts->limits.timeout_ms = (uint64_t) (sec * 1000 + 0.5);
+        } else if (!strcmp(argv[0], "--log-dir")) {
+            ARG_VALUE();
+            opts->sandbox.log.dir = argv[0];
+        } else if (!strcmp(argv[0], "--log-size")) {
+            ARG_VALUE();
+            opts->sandbox.log.size = capture_parse_size(argv[0]);
+        } else if (!strcmp(argv[0], "--log-rate")) {
+            ARG_VALUE();
+            opts->sandbox.log.rate = capture_parse_size(argv[0]);
+        } else if (!strcmp(argv[0], "--log-tee")) {
+            opts->sandbox.log.tee = 1;
+        } else if (!strcmp(argv[0], "--io-rbps")) {
+            ARG_VALUE();
+            opts->sandbox.io.rbps = capture_parse_size(argv[0]);
+        } else if (!strcmp(argv[0], "--io-wbps")) {
+            ARG_VALUE();
+            opts->sandbox.io.wbps = capture_parse_size(argv[0]);
+        } else if (!strcmp(argv[0], "--io-riops")) {
+            ARG_VALUE();
+            opts->sandbox.io.riops = parse_count("read IOPS", argv[0]);
+        } else if (!strcmp(argv[0], "--io-wiops")) {
+            ARG_VALUE();
+            opts->sandbox.io.wiops = parse_count("write IOPS", argv[0]);
+        } else if (!strcmp(argv[0], "--io-latency")) {
+            char *end;
+            ARG_VALUE();
+            double ms = strtod(argv[0], &end);
+            if (*end != '\0' || ms < 0.001)
+                die("Invalid I/O latency target %s\n", argv[0]);
+            opts->sandbox.io.latency_us = (uint64_t) (ms * 1000 + 0.5);
+        } else if (!strcmp(argv[0], "--io-device")) {
+            ARG_VALUE();
+            opts->sandbox.io.device = argv[0];
+        } else if (!strcmp(argv[0], "--perf")) {
+            opts->sandbox.perf = 1;
+        } else if (!strcmp(argv[0], "--net-stats")) {
+            char *end;
+            ARG_VALUE();
+            double sec = strtod(argv[0], &end);
+            if (*end != '\0' || sec < 0.001)
+                die("Invalid network stats interval %s\n", argv[0]);
+            opts->limits.net_stats_ms = (uint64_t) (sec * 1000 + 0.5);
+        } else {
+            die("Unknown option %s\n", argv[0]);
+        }
+        NEXT_ARG();
+    }
+
+    // Демону пула команда не нужна
+    if (opts->pool_size > 0)
+        return;
+
+    if (argc > 0 && !strcmp(argv[0], "exec")) {
+        char *end;
+        ARG_VALUE();
+        opts->exec_id = (int) strtol(argv[0], &end, 10);
+        if (*end != '\0' || opts->exec_id < 0)
+            die("Invalid instance id %s\n", argv[0]);
+        NEXT_ARG();
+    }
+
     if (argc < 1) {
         printf("Nothing to do!\n");
         exit(0);
     }
 
-    params->argv = argv;
+    opts->argv = argv;
+#undef ARG_VALUE
 #undef NEXT_ARG
 }
 
-#define STACKSIZE (1024*1024)
-static char cmd_stack[STACKSIZE];
-
-/**
- * @brief Ожидает сигнал о завершении настройки из pipe
- *
- * @param pipe Файловый дескриптор для чтения из pipe
- */
-void await_setup(int pipe)
-{
-    char buf[2];
-    if (read(pipe, buf, 2) != 2)
-        die("Failed to read from pipe: %m\n");
-}
-
 /**
- * @brief Функция, которая будет исполнена в дочернем процессе.
- * Создаёт IPC очередь (демонстрация работы IPC namespace),
- * монтирует файловые системы, снижает привилегии и запускает команду.
+ * @brief Ждёт завершения песочницы под супервизором: лимит времени, OOM kill
+ *        и адаптивные лимиты обрабатываются по мере появления событий
  *
- * @param arg Аргумент с параметрами командной строки
- * @return int Возвращает 1 при ошибке
+ * @param sb Запущенная песочница
+ * @param limits Ограничения экземпляра
+ * @return Статус завершения в формате waitpid()
  */
-static int cmd_exec(void *arg)
+static int supervise(struct sandbox *sb, const struct supervisor_limits *limits)
 {
-    if (prctl(PR_SET_PDEATHSIG, SIGKILL))
-        die("cannot PR_SET_PDEATHSIG for child process: %m\n");
-
-    struct params *params = (struct params*) arg;
-
-    // Ожидаем, пока основной процесс закончит настройки
-    await_setup(params->fd[0]);
-
-    // Настраиваем mount namespace с корневой файловой системой rootfs
-    prepare_mntns("rootfs");
-
-    // Демонстрация IPC namespace — создаём очередь сообщений
-    int msqid = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
-    if (msqid == -1)
-        die("msgget failed: %m\n");
-    printf("Created IPC message queue with id: %d\n", msqid);
-
-    // Снижаем привилегии пользователя внутри user namespace
-    if (setgid(0) == -1)
-        die("Failed to setgid: %m\n");
-    if (setuid(0) == -1)
-        die("Failed to setuid: %m\n");
-
-    char **argv = params->argv;
-    char *cmd = argv[0];
-    printf("===========%s============\n", cmd);
+    struct supervisor sv;
+    struct supervisor_watch w;
+    struct supervisor_watch *done;
+
+    // Без pidfd (старые ядра) остаётся только блокирующее ожидание
+    if (sb->pidfd < 0) {
+        if (limits->timeout_ms > 0 || limits->psi.mem_max > 0 ||
+            limits->psi.cpu_max > 0 || limits->net_stats_ms > 0 ||
+            sb->log.opts)
+            die("--timeout, --net-stats, --log-dir and --psi-* require "
+                "pidfd support\n");
+        return sandbox_wait(sb);
+    }
 
-    if (execvp(cmd, argv) == -1)
-        die("Failed to exec %s: %m\n", cmd);
+    supervisor_init(&sv);
+    int n = supervisor_add(&sv, &w, sb, limits, NULL);
+    while (n == 0)
+        n = supervisor_dispatch(&sv, -1, &done, 1);
+    supervisor_close(&sv);
 
-    die("¯\\_(ツ)_/¯");
-    return 1;
+    // Без супервизора песочница не должна работать без ограничений
+    if (n < 0) {
+        syscall(SYS_pidfd_send_signal, sb->pidfd, SIGKILL, NULL, 0);
+        return sandbox_wait(sb);
+    }
+    return w.status;
 }
 
 /**
- * @brief Записывает строку в файл, с обработкой ошибок
+ * @brief Записывает длительности фаз запуска песочницы в JSON файл
  *
  * @param path Путь к файлу
- * @param line Строка для записи
+ * @param sb Запущенная песочница
  */
-static void write_file(char path[100], char line[100])
+static void write_timings(const char *path, const struct sandbox *sb)
 {
     FILE *f = fopen(path, "w");
-    if (f == NULL) {
+    if (f == NULL)
         die("Failed to open file %s: %m\n", path);
-    }
-    if (fwrite(line, 1, strlen(line), f) < 0) {
-        die("Failed to write to file %s:\n", path);
-    }
-    if (fclose(f) != 0) {
-        die("Failed to close file %s: %m\n", path);
-    }
-}
 
-/**
- * @brief Настраивает user namespace (маппинг UID/GID)
- *
- * @param pid PID дочернего процесса для настройки
- */
-static void prepare_userns(int pid)
-{
-    char path[100];
-    char line[100];
-
-    int uid = 1000;
-
-    sprintf(path, "/proc/%d/uid_map", pid);
-    sprintf(line, "0 %d 1\n", uid);
-    write_file(path, line);
-
-    sprintf(path, "/proc/%d/setgroups", pid);
-    sprintf(line, "deny");
-    write_file(path, line);
-
-    sprintf(path, "/proc/%d/gid_map", pid);
-    sprintf(line, "0 %d 1\n", uid);
-    write_file(path, line);
-}
-
-static void prepare_mntns(char *rootfs)
-{
-    const char *mnt = rootfs;
-
-    if (mount(rootfs, mnt, "ext4", MS_BIND, ""))
-        die("Failed to mount %s at %s: %m\n", rootfs, mnt);
-
-    if (chdir(mnt))
-        die("Failed to chdir to rootfs mounted at %s: %m\n", mnt);
-
-    const char *put_old = ".put_old";
-    if (mkdir(put_old, 0777) && errno != EEXIST)
-        die("Failed to mkdir put_old %s: %m\n", put_old);
-
-    if (syscall(SYS_pivot_root, ".", put_old))
-        die("Failed to pivot_root from %s to %s: %m\n", rootfs, put_old);
-
-    if (chdir("/"))
-        die("Failed to chdir to new root: %m\n");
-
-    prepare_procfs();
-
-    if (umount2(put_old, MNT_DETACH))
-        die("Failed to umount put_old %s: %m\n", put_old);
-}
-
-static void prepare_procfs()
-{
-    if (mkdir("/proc", 0555) && errno != EEXIST)
-        die("Failed to mkdir /proc: %m\n");
+    fprintf(f, "{\"id\":%d,\"phases_us\":", sb->id);
+    timing_write_json(f, &sb->timings);
+    fprintf(f, "}\n");
 
-    if (mount("proc", "/proc", "proc", 0, ""))
-        die("Failed to mount proc: %m\n");
+    if (fclose(f) != 0)
+        die("Failed to close file %s: %m\n", path);
 }
 
 /**
- * @brief Настраивает network namespace, создаёт виртуальные интерфейсы, настраивает адреса
+ * @brief Дописывает итог запуска песочницы в файл
  *
- * @param cmd_pid PID дочернего процесса
+ * @param path Путь к файлу или "-" для stderr
+ * @param sb Завершившаяся песочница
+ * @param status Статус завершения
  */
-static void prepare_netns(int cmd_pid)
+static void write_report(const char *path, const struct sandbox *sb, int status)
 {
-    char *veth = "veth0";
-    char *vpeer = "veth1";
-    char *veth_addr = "10.1.1.1";
-    char *vpeer_addr = "10.1.1.2";
-    char *netmask = "255.255.255.0";
-
-    int sock_fd = create_socket(
-            PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
-
-    create_veth(sock_fd, veth, vpeer);
-
-    if_up(veth, veth_addr, netmask);
-
-    int mynetns = get_netns_fd(getpid());
-    int child_netns = get_netns_fd(cmd_pid);
-
-    move_if_to_pid_netns(sock_fd, vpeer, child_netns);
-
-    if (setns(child_netns, CLONE_NEWNET))
-        die("Failed to setns for command at pid %d: %m\n", cmd_pid);
+    if (!strcmp(path, "-")) {
+        sandbox_write_report(stderr, sb, status);
+        return;
+    }
 
-    if_up(vpeer, vpeer_addr, netmask);
+    FILE *f = fopen(path, "a");
+    if (f == NULL)
+        die("Failed to open file %s: %m\n", path);
 
-    if (setns(mynetns, CLONE_NEWNET))
-        die("Failed to restore previous net namespace: %m\n");
+    sandbox_write_report(f, sb, status);
 
-    close(sock_fd);
+    if (fclose(f) != 0)
+        die("Failed to close file %s: %m\n", path);
 }
 
 /**
@@ -246,46 +348,67 @@ static void prepare_netns(int cmd_pid)
  */
 int main(int argc, char **argv)
 {
-    struct params params;
-    memset(&params, 0, sizeof(struct params));
-
-    parse_args(argc, argv, &params);
+    struct options opts;
+    memset(&opts, 0, sizeof(struct options));
+    opts.socket = POOL_SOCKET_PATH;
+    opts.sandbox.rootfs = SANDBOX_ROOTFS;
+    opts.exec_id = -1;
+
+    uint64_t ts = timing_now_us();
+    parse_args(argc, argv, &opts);
+
+    if (opts.trace) {
+        if (trace_open(opts.trace))
+            return 1;
+        trace_end("main.parse_args", ts);
+    }
 
-    // Создаём pipe для связи между главным и дочерним процессом
-    if (pipe(params.fd) < 0)
-        die("Failed to create pipe: %m");
+    if (opts.pool_size > 0) {
+        pool_serve(opts.socket, opts.pool_size, &opts.sandbox, &opts.limits);
+        trace_close();
+        return 0;
+    }
 
-    // Флаги для clone с пространствами имён, включая IPC
-    int clone_flags =
-            SIGCHLD |
-            CLONE_NEWUTS | CLONE_NEWUSER |
-            CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWNET | CLONE_NEWIPC;
+    if (opts.client)
+        return pool_submit(opts.socket, opts.argv);
 
-    // Клонируем дочерний процесс с изоляцией
-    int cmd_pid = clone(
-        cmd_exec, cmd_stack + STACKSIZE, clone_flags, &params);
+    if (opts.exec_id >= 0) {
+        int status = sandbox_exec(opts.exec_id, opts.argv);
+        if (status < 0)
+            return 1;
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
 
-    if (cmd_pid < 0)
-        die("Failed to clone: %m\n");
+    struct sandbox sb;
+    ts = trace_begin();
+    int err = sandbox_create(&sb, &opts.sandbox, opts.argv);
+    trace_end("main.sandbox_create", ts);
+    if (err) {
+        trace_close();
+        return 1;
+    }
 
-    // Подключаем процесс к cgroup с ограничениями ресурсов
-    cgroup_init_and_limit(cmd_pid);
+    if (opts.timings || opts.trace) {
+        // Отчёт дочернего процесса приходит перед execvp(), а фаза execvp
+        // завершается, когда он закрывает сокет
+        ts = trace_begin();
+        int err = sandbox_await_exec(&sb);
+        trace_end("main.await_exec", ts);
 
-    // Конец pipe для записи
-    int pipe = params.fd[1];
+        if (opts.timings && err == 0)
+            write_timings(opts.timings, &sb);
+    } else if (close(sb.ctl)) {
+        die("Failed to close pipe: %m");
+    }
 
-    // Настраиваем user и network namespaces для дочернего процесса
-    prepare_userns(cmd_pid);
-    prepare_netns(cmd_pid);
+    ts = trace_begin();
+    int status = supervise(&sb, &opts.limits);
+    trace_end("main.wait", ts);
 
-    // Сообщаем дочернему процессу, что настройка завершена
-    if (write(pipe, "OK", 2) != 2)
-        die("Failed to write to pipe: %m");
-    if (close(pipe))
-        die("Failed to close pipe: %m");
+    if (opts.report)
+        write_report(opts.report, &sb, status);
 
-    if (waitpid(cmd_pid, NULL, 0) == -1)
-        die("Failed to wait pid %d: %m\n", cmd_pid);
+    trace_close();
 
     return 0;
 }
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "../include/libisolate.h"
+
+struct isolate {
+    struct sandbox sb;
+    int waited;     /**< sandbox_wait() уже вызван */
+};
+
+int isolate_spawn(struct isolate **out, const struct sandbox_opts *opts,
+                  char **argv)
+{
+    struct isolate *iso = calloc(1, sizeof(*iso));
+    if (iso == NULL)
+        return -ENOMEM;
+
+    int err = sandbox_create(&iso->sb, opts, argv);
+    if (err) {
+        free(iso);
+        return err;
+    }
+
+    // Неудачный execvp() завершает процесс песочницы: дожидаемся его
+    err = sandbox_await_exec(&iso->sb);
+    if (err) {
+        sandbox_wait(&iso->sb);
+        free(iso);
+        return err;
+    }
+
+    *out = iso;
+    return 0;
+}
+
+int isolate_id(const struct isolate *iso)
+{
+    return iso->sb.id;
+}
+
+int isolate_pidfd(const struct isolate *iso)
+{
+    return iso->sb.pidfd;
+}
+
+int isolate_kill(struct isolate *iso, int sig)
+{
+    if (iso->waited)
+        return -ESRCH;
+
+    int ret = iso->sb.pidfd >= 0
+              ? syscall(SYS_pidfd_send_signal, iso->sb.pidfd, sig, NULL, 0)
+              : kill(iso->sb.pid, sig);
+    return ret ? -errno : 0;
+}
+
+int isolate_wait(struct isolate *iso, struct cgroup_usage *usage)
+{
+    if (iso->waited)
+        return -ECHILD;
+
+    int status = sandbox_wait(&iso->sb);
+    iso->waited = 1;
+
+    if (usage)
+        *usage = iso->sb.usage;
+    return status;
+}
+
+int isolate_net_stats(const struct isolate *iso, struct net_stats *st)
+{
+    if (iso->waited) {
+        *st = iso->sb.net_stats;
+        return 0;
+    }
+
+    struct nl_rx rx = { NULL, 0 };
+    int sock_fd = create_socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+                                NETLINK_ROUTE);
+    if (sock_fd < 0)
+        return sock_fd;
+    int err = sandbox_net_stats(&iso->sb, sock_fd, &rx, st);
+    nl_rx_free(&rx);
+    close(sock_fd);
+    return err;
+}
+
+void isolate_free(struct isolate *iso)
+{
+    if (iso == NULL)
+        return;
+
+    if (!iso->waited) {
+        isolate_kill(iso, SIGKILL);
+        isolate_wait(iso, NULL);
+    }
+    free(iso);
+}
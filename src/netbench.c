@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "../include/util.h"
+#include "../include/instance.h"
+#include "../include/sandbox.h"
+
+/**
+ * @def NETBENCH_PORT
+ * @brief TCP порт сервера бенчмарка в песочнице.
+ */
+#define NETBENCH_PORT 5201
+
+/**
+ * @def NETBENCH_STREAMS_MAX
+ * @brief Максимальное число параллельных потоков передачи.
+ */
+#define NETBENCH_STREAMS_MAX 64
+
+/**
+ * @brief Параметры командной строки бенчмарка сети
+ */
+struct options {
+    int seconds;                  /**< Длительность замера пропускной способности */
+    int streams;                  /**< Число параллельных TCP соединений */
+    size_t msg_size;              /**< Размер одной записи в потоке */
+    int requests;                 /**< Число обменов запрос-ответ для задержки */
+    const char *output;           /**< Файл для JSON с результатами */
+    struct sandbox_opts sandbox;  /**< Параметры песочницы */
+};
+
+/**
+ * @brief Соединение потока передачи и его итог
+ */
+struct stream {
+    const struct options *opts;   /**< Параметры бенчмарка */
+    struct sockaddr_in addr;      /**< Адрес сервера в песочнице */
+    uint64_t bytes;               /**< Байт, принятых сервером */
+    uint64_t ns;                  /**< Время от connect() до подтверждения сервера */
+};
+
+/**
+ * @brief Парсит аргументы командной строки, пропуская имя бинарника
+ *
+ * Поддерживаемые опции:
+ *   --seconds N      длительность замера пропускной способности (по умолчанию 3)
+ *   --streams N      число параллельных TCP соединений (по умолчанию 1)
+ *   --msg-size N     размер записи в потоке в байтах (по умолчанию 131072)
+ *   --requests N     число обменов запрос-ответ (по умолчанию 20000)
+ *   --output FILE    файл для JSON с результатами (по умолчанию netbench.json)
+ *   --net-driver D   интерфейсы песочницы: veth, veth-mq, ipvlan, macvlan, netkit
+ *   --uplink IF      интерфейс хоста для ipvlan и macvlan
+ *   --rate R         лимит скорости сети в каждую сторону, бит/с (100m, 1g)
+ *   --burst N        запас лимита скорости в байтах (суффиксы K, M)
+ *   --placement P    привязать песочницу к CPU: pack или spread
+ *   --cpus N         число CPU исключительного среза
+ *   --rootfs PATH    корневая файловая система песочницы (каталог или образ)
+ *
+ * @param argc Количество аргументов
+ * @param argv Массив аргументов
+ * @param opts Структура параметров для заполнения
+ */
+static void parse_args(int argc, char **argv, struct options *opts)
+{
+#define NEXT_ARG() do { argc--; argv++; } while (0)
+#define ARG_VALUE() do { \
+        NEXT_ARG(); \
+        if (argc < 1) \
+            die("Option %s requires a value\n", argv[-1]); \
+    } while (0)
+
+    NEXT_ARG();
+
+    while (argc > 0) {
+        if (!strcmp(argv[0], "--seconds")) {
+            ARG_VALUE();
+            opts->seconds = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "--streams")) {
+            ARG_VALUE();
+            opts->streams = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "--msg-size")) {
+            ARG_VALUE();
+            opts->msg_size = strtoul(argv[0], NULL, 10);
+        } else if (!strcmp(argv[0], "--requests")) {
+            ARG_VALUE();
+            opts->requests = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "--output")) {
+            ARG_VALUE();
+            opts->output = argv[0];
+        } else if (!strcmp(argv[0], "--net-driver")) {
+            ARG_VALUE();
+            opts->sandbox.net.driver = net_driver_parse(argv[0]);
+        } else if (!strcmp(argv[0], "--uplink")) {
+            ARG_VALUE();
+            opts->sandbox.net.uplink = argv[0];
+        } else if (!strcmp(argv[0], "--rate")) {
+            ARG_VALUE();
+            net_parse_rate(argv[0], &opts->sandbox.net);
+        } else if (!strcmp(argv[0], "--burst")) {
+            ARG_VALUE();
+            net_parse_burst(argv[0], &opts->sandbox.net);
+        } else if (!strcmp(argv[0], "--placement")) {
+            ARG_VALUE();
+            opts->sandbox.placement.policy = placement_policy_parse(argv[0]);
+        } else if (!strcmp(argv[0], "--cpus")) {
+            ARG_VALUE();
+            opts->sandbox.placement.cpus = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "--rootfs")) {
+            ARG_VALUE();
+            opts->sandbox.rootfs = argv[0];
+        } else {
+            die("Usage: isolate-netbench [--seconds N] [--streams N] "
+                "[--msg-size N] [--requests N] [--output FILE] "
+                "[--net-driver D] [--uplink IF] [--rate R] [--burst N] "
+                "[--placement P] [--cpus N] [--rootfs PATH]\n");
+        }
+        NEXT_ARG();
+    }
+
+    if (opts->seconds < 1 || opts->requests < 1 || opts->msg_size < 1 ||
+        opts->streams < 1 || opts->streams > NETBENCH_STREAMS_MAX)
+        die("Invalid benchmark parameters\n");
+#undef ARG_VALUE
+#undef NEXT_ARG
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_all(int fd, const void *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            die("Failed to send: %m\n");
+        buf = (const char *) buf + n;
+        len -= n;
+    }
+}
+
+static void read_all(int fd, void *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n <= 0)
+            die("Failed to receive: %m\n");
+        buf = (char *) buf + n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Обслуживает одно соединение на стороне песочницы
+ *
+ * Первый байт задаёт режим: 'S' — принимать поток до EOF и ответить числом
+ * принятых байт, 'R' — возвращать каждый принятый байт (запрос-ответ).
+ */
+static void *serve(void *arg)
+{
+    int fd = (int) (intptr_t) arg;
+    char mode;
+    char *buf = malloc(1 << 20);
+    if (buf == NULL)
+        die("Failed to allocate buffer: %m\n");
+
+    read_all(fd, &mode, 1);
+    if (mode == 'S') {
+        uint64_t total = 0;
+        ssize_t n;
+        while ((n = read(fd, buf, 1 << 20)) > 0)
+            total += n;
+        write_all(fd, &total, sizeof(total));
+    } else {
+        while (read(fd, buf, 1) == 1)
+            write_all(fd, buf, 1);
+    }
+
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+static void *accept_loop(void *arg)
+{
+    int listener = (int) (intptr_t) arg;
+
+    for (;;) {
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            die("Failed to accept: %m\n");
+
+        pthread_t t;
+        if (pthread_create(&t, NULL, serve, (void *) (intptr_t) fd))
+            die("Failed to start server thread\n");
+        pthread_detach(t);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Создаёт слушающий сокет в network namespace песочницы
+ *
+ * setns(CLONE_NEWNET) действует на поток, а сокет остаётся в namespace, где
+ * создан, поэтому после возврата потока на хост сервер продолжает принимать
+ * соединения внутри песочницы. Процессу песочницы не нужен свой сервер,
+ * и rootfs может не содержать никаких программ.
+ */
+static int listen_in_sandbox(const struct sandbox *sb, const struct sockaddr_in *addr)
+{
+    int host = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+    int netns = get_netns_fd(sb->pid);
+    if (host < 0 || netns < 0 || setns(netns, CLONE_NEWNET))
+        die("Failed to enter network namespace of sandbox %d: %m\n", sb->id);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (const struct sockaddr *) addr, sizeof(*addr)) ||
+        listen(fd, NETBENCH_STREAMS_MAX))
+        die("Failed to listen in sandbox %d: %m\n", sb->id);
+
+    if (setns(host, CLONE_NEWNET))
+        die("Failed to return to host network namespace: %m\n");
+    close(netns);
+    close(host);
+    return fd;
+}
+
+static int connect_to(const struct sockaddr_in *addr, char mode)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr *) addr, sizeof(*addr)))
+        die("Failed to connect to sandbox: %m\n");
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    write_all(fd, &mode, 1);
+    return fd;
+}
+
+/**
+ * @brief Передаёт данные серверу opts->seconds секунд и ждёт, пока сервер
+ *        подтвердит число принятых байт
+ */
+static void *stream_run(void *arg)
+{
+    struct stream *st = arg;
+    size_t len = st->opts->msg_size;
+    char *buf = calloc(1, len);
+    if (buf == NULL)
+        die("Failed to allocate buffer: %m\n");
+
+    uint64_t start = now_ns();
+    uint64_t deadline = start + st->opts->seconds * 1000000000ULL;
+    int fd = connect_to(&st->addr, 'S');
+
+    while (now_ns() < deadline)
+        write_all(fd, buf, len);
+
+    shutdown(fd, SHUT_WR);
+    read_all(fd, &st->bytes, sizeof(st->bytes));
+    st->ns = now_ns() - start;
+
+    close(fd);
+    free(buf);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Перцентиль по методу ближайшего ранга
+ */
+static uint64_t percentile(const uint64_t *sorted, int n, int p)
+{
+    int rank = (n * p + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * @brief Бенчмарк сети между хостом и песочницей: пропускная способность TCP
+ *        (opts.streams соединений) и задержка обмена запрос-ответ по одному
+ *        байту.
+ */
+int main(int argc, char **argv)
+{
+    struct options opts;
+    memset(&opts, 0, sizeof(struct options));
+    opts.seconds = 3;
+    opts.streams = 1;
+    opts.msg_size = 128 * 1024;
+    opts.requests = 20000;
+    opts.output = "netbench.json";
+    opts.sandbox.rootfs = SANDBOX_ROOTFS;
+
+    parse_args(argc, argv, &opts);
+
+    // "Тёплая" песочница: процесс ждёт задание, сеть уже настроена
+    struct sandbox sb;
+    if (sandbox_create(&sb, &opts.sandbox, NULL))
+        die("Failed to create sandbox\n");
+
+    char host_ip[INET_ADDRSTRLEN];
+    char peer_ip[INET_ADDRSTRLEN];
+    instance_addrs(sb.id, host_ip, peer_ip, INET_ADDRSTRLEN);
+
+    struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(NETBENCH_PORT),
+    };
+    inet_pton(AF_INET, peer_ip, &addr.sin_addr);
+
+    pthread_t server;
+    int listener = listen_in_sandbox(&sb, &addr);
+    if (pthread_create(&server, NULL, accept_loop, (void *) (intptr_t) listener))
+        die("Failed to start server\n");
+    pthread_detach(server);
+
+    // Задержка: один байт туда и обратно, соединение без алгоритма Нейгла
+    uint64_t *rtt = calloc(opts.requests, sizeof(uint64_t));
+    if (rtt == NULL)
+        die("Failed to allocate samples: %m\n");
+
+    int fd = connect_to(&addr, 'R');
+    for (int i = 0; i < opts.requests; i++) {
+        char c = 'x';
+        uint64_t start = now_ns();
+        write_all(fd, &c, 1);
+        read_all(fd, &c, 1);
+        rtt[i] = now_ns() - start;
+    }
+    close(fd);
+    qsort(rtt, opts.requests, sizeof(uint64_t), cmp_u64);
+
+    // Пропускная способность: хост передаёт в песочницу
+    struct stream streams[NETBENCH_STREAMS_MAX];
+    pthread_t threads[NETBENCH_STREAMS_MAX];
+    for (int i = 0; i < opts.streams; i++) {
+        streams[i] = (struct stream) { .opts = &opts, .addr = addr };
+        if (pthread_create(&threads[i], NULL, stream_run, &streams[i]))
+            die("Failed to start stream\n");
+    }
+
+    uint64_t bytes = 0;
+    uint64_t ns = 0;
+    for (int i = 0; i < opts.streams; i++) {
+        pthread_join(threads[i], NULL);
+        bytes += streams[i].bytes;
+        if (streams[i].ns > ns)
+            ns = streams[i].ns;
+    }
+    double gbps = ns ? bytes * 8.0 / ns : 0;
+
+    // Закрытие управляющего сокета завершает "тёплую" песочницу
+    close(sb.ctl);
+    sandbox_wait(&sb);
+    close(listener);
+
+    FILE *f = fopen(opts.output, "we");
+    if (f == NULL)
+        die("Failed to open file %s: %m\n", opts.output);
+
+    int n = opts.requests;
+    fprintf(f, "{\"driver\":\"%s\",\"streams\":%d,\"msg_size\":%zu,"
+               "\"bytes\":%llu,\"elapsed_ns\":%llu,\"gbit_per_sec\":%.3f,"
+               "\"requests\":%d,\"rtt_ns\":{\"p50\":%llu,\"p90\":%llu,"
+               "\"p99\":%llu,\"max\":%llu}}\n",
+            net_driver_name(opts.sandbox.net.driver),
+            opts.streams, opts.msg_size, (unsigned long long) bytes,
+            (unsigned long long) ns, gbps, n,
+            (unsigned long long) percentile(rtt, n, 50),
+            (unsigned long long) percentile(rtt, n, 90),
+            (unsigned long long) percentile(rtt, n, 99),
+            (unsigned long long) rtt[n - 1]);
+
+    if (fclose(f) != 0)
+        die("Failed to close file %s: %m\n", opts.output);
+
+    fprintf(stderr, "driver=%s streams=%d gbit_per_sec=%.3f "
+                    "rtt_us p50=%.1f p99=%.1f -> %s\n",
+            net_driver_name(opts.sandbox.net.driver), opts.streams, gbps,
+            percentile(rtt, n, 50) / 1000.0, percentile(rtt, n, 99) / 1000.0,
+            opts.output);
+
+    free(rtt);
+    return 0;
+}
@@ -1,7 +1,14 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <linux/rtnetlink.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
 #include <linux/veth.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <linux/pkt_sched.h>
+#include <linux/pkt_cls.h>
 #include <net/if.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -13,25 +20,65 @@
 #include "../include/netns.h"
 #include "../include/util.h"
 
+// Заголовки ядра до 6.7 не описывают netkit
+#ifndef IFLA_NETKIT_PEER_INFO
+#define IFLA_NETKIT_PEER_INFO 1
+#endif
+
+/**
+ * @def TC_RTAB_SIZE
+ * @brief Размер таблицы скоростей (256 значений), которую ядро требует
+ *        вместе с tc_ratespec полисера.
+ */
+#define TC_RTAB_SIZE 1024
+
+/**
+ * @def TC_TICK_SHIFT
+ * @brief Тик планировщика пакетов — 64 нс (PSCHED_SHIFT ядра); в тиках
+ *        задаётся запас (burst) полисера.
+ */
+#define TC_TICK_SHIFT 6
+
+/**
+ * @brief Тип ссылки (IFLA_INFO_KIND) и префикс имени интерфейса хоста
+ *        для каждого драйвера
+ */
+static const struct {
+    const char *name;   /**< Имя драйвера для --net-driver */
+    const char *kind;   /**< IFLA_INFO_KIND */
+    const char *prefix; /**< Префикс имени интерфейса на стороне хоста */
+} drivers[] = {
+        [NET_DRIVER_VETH] = { "veth", "veth", "veth" },
+        [NET_DRIVER_VETH_MQ] = { "veth-mq", "veth", "veth" },
+        [NET_DRIVER_IPVLAN] = { "ipvlan", "ipvlan", "ipvl" },
+        [NET_DRIVER_MACVLAN] = { "macvlan", "macvlan", "mvl" },
+        [NET_DRIVER_NETKIT] = { "netkit", "netkit", "nk" },
+};
+
 /**
  * @brief Добавляет атрибут (RT attribute) к Netlink сообщению.
+ *
+ * При нехватке места атрибут не добавляется, а в пакете запоминается
+ * ошибка: её вернёт nl_batch_send().
  * 
+ * @param b Пакет запросов, в котором находится сообщение
  * @param n Указатель на Netlink заголовок
- * @param maxlen Максимально допустимый размер сообщения
  * @param type Тип атрибута (rta_type)
  * @param data Указатель на данные для атрибута (может быть NULL)
  * @param datalen Размер данных в байтах
  */
 static void addattr_l(
-        struct nlmsghdr *n, int maxlen, __u16 type,
+        struct nl_batch *b, struct nlmsghdr *n, __u16 type,
         const void *data, __u16 datalen)
 {
     __u16 attr_len = RTA_LENGTH(datalen);
+    __u32 maxlen = NL_BATCH_SIZE - ((char *) n - b->buf);
 
     __u32 newlen = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(attr_len);
-    if (newlen > maxlen)
-        die("cannot add attribute. size (%d) exceeded maxlen (%d)\n",
-            newlen, maxlen);
+    if (newlen > maxlen) {
+        b->error = -ENOBUFS;
+        return;
+    }
 
     struct rtattr *rta = NLMSG_TAIL(n);
     rta->rta_type = type;
@@ -45,19 +92,44 @@ static void addattr_l(
 /**
  * @brief Начинает вложенный атрибут (nested rtattr) в Netlink сообщении.
  * 
+ * @param b Пакет запросов, в котором находится сообщение
  * @param n Указатель на Netlink сообщение
- * @param maxlen Максимально допустимый размер сообщения
  * @param type Тип вложенного атрибута
  * @return Указатель на начало вложенного атрибута для последующего закрытия
  */
 static struct rtattr *addattr_nest(
-        struct nlmsghdr *n, int maxlen, __u16 type)
+        struct nl_batch *b, struct nlmsghdr *n, __u16 type)
 {
     struct rtattr *nest = NLMSG_TAIL(n);
-    addattr_l(n, maxlen, type, NULL, 0);
+    addattr_l(b, n, type, NULL, 0);
     return nest;
 }
 
+/**
+ * @brief Добавляет к сообщению данные без заголовка атрибута.
+ *
+ * Буфер пакета не обнуляется заранее, поэтому вложенные заголовки
+ * (ifinfomsg второго конца veth) копируются целиком, а не резервируются.
+ *
+ * @param b Пакет запросов, в котором находится сообщение
+ * @param n Указатель на Netlink сообщение
+ * @param data Данные
+ * @param len Размер данных, кратный NLMSG_ALIGNTO
+ */
+static void addraw(struct nl_batch *b, struct nlmsghdr *n,
+                   const void *data, __u32 len)
+{
+    __u32 maxlen = NL_BATCH_SIZE - ((char *) n - b->buf);
+    __u32 newlen = NLMSG_ALIGN(n->nlmsg_len) + NLMSG_ALIGN(len);
+    if (newlen > maxlen) {
+        b->error = -ENOBUFS;
+        return;
+    }
+
+    memcpy(NLMSG_TAIL(n), data, len);
+    n->nlmsg_len = newlen;
+}
+
 /**
  * @brief Завершает вложенный атрибут, устанавливая правильную длину.
  * 
@@ -70,105 +142,378 @@ static void addattr_nest_end(struct nlmsghdr *n, struct rtattr *nest)
 }
 
 /**
- * @brief Считывает ответ из Netlink сокета.
+ * @brief Создаёт сетевой сокет с указанными параметрами.
  * 
- * @param fd Дескриптор Netlink сокета
- * @param msg Структура msghdr для recvmsg
- * @param response Указатель на буфер для сохранения ответа
- * @return Размер принятого сообщения, или завершение программы при ошибке
+ * @param domain Домен сокета (например, PF_INET, AF_NETLINK)
+ * @param type Тип сокета (например, SOCK_DGRAM, SOCK_RAW)
+ * @param protocol Протокол (например, IPPROTO_IP, NETLINK_ROUTE)
+ * @return Дескриптор созданного сокета или -errno
  */
-static ssize_t read_response(
-        int fd, struct msghdr *msg, char **response)
+int create_socket(int domain, int type, int protocol)
 {
-    struct iovec *iov = msg->msg_iov;
-    iov->iov_base = *response;
-    iov->iov_len = MAX_PAYLOAD;
+    int sock_fd = socket(domain, type, protocol);
+    if (sock_fd < 0)
+        return fail("cannot open socket: %m\n");
 
-    ssize_t resp_len = recvmsg(fd, msg, 0);
+    return sock_fd;
+}
 
-    if (resp_len == 0)
-        die("EOF on netlink\n");
+/**
+ * @brief Получает дескриптор сетевого пространства имен процесса по его PID.
+ * 
+ * @param pid Идентификатор процесса
+ * @return Дескриптор сетевого пространства имен процесса или -errno
+ */
+int get_netns_fd(int pid)
+{
+    char path[256];
+    sprintf(path, "/proc/%d/ns/net", pid);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return fail("cannot read netns file %s: %m\n", path);
 
-    if (resp_len < 0)
-        die("netlink receive error: %m\n");
+    return fd;
+}
 
-    return resp_len;
+void nl_batch_init(struct nl_batch *b)
+{
+    b->len = 0;
+    b->seq = 0;
+    b->pending = 0;
+    b->optional = 0;
+    b->error = 0;
+    b->quiet = 0;
 }
 
 /**
- * @brief Проверяет ответ Netlink сокета на ошибки.
- * 
- * @param sock_fd Дескриптор Netlink сокета
- * @note Вызывает die() при обнаружении ошибки.
+ * @brief Добавляет в пакет новое сообщение с фиксированным заголовком.
+ *
+ * @param b Пакет запросов
+ * @param type Тип сообщения (RTM_*)
+ * @param flags Дополнительные флаги (NLM_F_REQUEST и NLM_F_ACK ставятся всегда)
+ * @param hdr Фиксированный заголовок (ifinfomsg, ifaddrmsg и т.п.)
+ * @param hdrlen Размер фиксированного заголовка
+ * @return Указатель на сообщение для добавления атрибутов или NULL, если
+ *         пакет переполнен
  */
-static void check_response(int sock_fd)
+static struct nlmsghdr *nl_batch_add(
+        struct nl_batch *b, __u16 type, __u16 flags,
+        const void *hdr, __u32 hdrlen)
 {
-    struct iovec iov;
-    struct msghdr msg = {
-            .msg_name = NULL,
-            .msg_namelen = 0,
-            .msg_iov = &iov,
-            .msg_iovlen = 1
-    };
-    char *resp = malloc(MAX_PAYLOAD);
+    __u32 off = NLMSG_ALIGN(b->len);
+    if (off + NLMSG_LENGTH(hdrlen) > NL_BATCH_SIZE) {
+        b->error = -ENOBUFS;
+        return NULL;
+    }
+
+    struct nlmsghdr *n = (struct nlmsghdr *) (b->buf + off);
+    memset(n, 0, NLMSG_LENGTH(hdrlen));
+    n->nlmsg_len = NLMSG_LENGTH(hdrlen);
+    n->nlmsg_type = type;
+    n->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    n->nlmsg_seq = ++b->seq;
+    memcpy(NLMSG_DATA(n), hdr, hdrlen);
 
-    ssize_t resp_len = read_response(sock_fd, &msg, &resp);
+    b->len = off + n->nlmsg_len;
+    b->pending++;
+    return n;
+}
 
-    struct nlmsghdr *hdr = (struct nlmsghdr *) resp;
-    int nlmsglen = hdr->nlmsg_len;
-    int datalen = nlmsglen - sizeof(*hdr);
+/**
+ * @brief Фиксирует длину пакета после добавления атрибутов к последнему сообщению.
+ */
+static void nl_batch_close(struct nl_batch *b, struct nlmsghdr *n)
+{
+    b->len = ((char *) n - b->buf) + n->nlmsg_len;
+}
 
-    if (datalen < 0 || nlmsglen > resp_len) {
-        if (msg.msg_flags & MSG_TRUNC)
-            die("received truncated message\n");
+/**
+ * @brief Добавляет к сообщению RTM_NEWLINK число очередей передачи и приёма
+ */
+static void add_queues(struct nl_batch *b, struct nlmsghdr *n, __u32 queues)
+{
+    if (queues <= 1)
+        return;
+    addattr_l(b, n, IFLA_NUM_TX_QUEUES, &queues, sizeof(queues));
+    addattr_l(b, n, IFLA_NUM_RX_QUEUES, &queues, sizeof(queues));
+}
 
-        die("malformed message: nlmsg_len=%d\n", nlmsglen);
-    }
+void nl_batch_pair(struct nl_batch *b, const char *kind, const char *ifname,
+                   const char *peername, int peer_netns, int queues)
+{
+    struct ifinfomsg ifi = { .ifi_family = PF_UNSPEC };
+    struct nlmsghdr *n = nl_batch_add(
+            b, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &ifi, sizeof(ifi));
+    if (n == NULL)
+        return;
 
-    if (hdr->nlmsg_type == NLMSG_ERROR) {
-        struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(hdr);
+    addattr_l(b, n, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+    add_queues(b, n, queues);
 
-        if (datalen < sizeof(struct nlmsgerr))
-            fprintf(stderr, "ERROR truncated!\n");
+    struct rtattr *linfo = addattr_nest(b, n, IFLA_LINKINFO);
+    addattr_l(b, n, IFLA_INFO_KIND, kind, strlen(kind) + 1);
 
-        if(err->error) {
-            errno = -err->error;
-            die("RTNETLINK: %m\n");
-        }
+    struct rtattr *linfodata = addattr_nest(b, n, IFLA_INFO_DATA);
+
+    // Второй конец создаётся сразу в namespace песочницы; у veth и netkit
+    // атрибут второго конца имеет один номер и одинаковый формат
+    struct rtattr *peerinfo = addattr_nest(b, n, VETH_INFO_PEER);
+    addraw(b, n, &ifi, sizeof(ifi));
+    addattr_l(b, n, IFLA_IFNAME, peername, strlen(peername) + 1);
+    addattr_l(b, n, IFLA_NET_NS_FD, &peer_netns, sizeof(peer_netns));
+    add_queues(b, n, queues);
+    addattr_nest_end(n, peerinfo);
+
+    addattr_nest_end(n, linfodata);
+    addattr_nest_end(n, linfo);
+
+    nl_batch_close(b, n);
+}
+
+void nl_batch_slave(struct nl_batch *b, const char *kind, const char *ifname,
+                    int uplink, int netns)
+{
+    struct ifinfomsg ifi = { .ifi_family = PF_UNSPEC };
+    struct nlmsghdr *n = nl_batch_add(
+            b, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &ifi, sizeof(ifi));
+    if (n == NULL)
+        return;
+
+    addattr_l(b, n, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+    addattr_l(b, n, IFLA_LINK, &uplink, sizeof(uplink));
+    if (netns >= 0)
+        addattr_l(b, n, IFLA_NET_NS_FD, &netns, sizeof(netns));
+
+    struct rtattr *linfo = addattr_nest(b, n, IFLA_LINKINFO);
+    addattr_l(b, n, IFLA_INFO_KIND, kind, strlen(kind) + 1);
+
+    // Режимы, в которых интерфейсы одного uplink обмениваются пакетами
+    // напрямую, не выходя в сеть
+    struct rtattr *linfodata = addattr_nest(b, n, IFLA_INFO_DATA);
+    if (!strcmp(kind, "macvlan")) {
+        __u32 mode = MACVLAN_MODE_BRIDGE;
+        addattr_l(b, n, IFLA_MACVLAN_MODE, &mode, sizeof(mode));
+    } else {
+        __u16 mode = IPVLAN_MODE_L2;
+        addattr_l(b, n, IFLA_IPVLAN_MODE, &mode, sizeof(mode));
     }
+    addattr_nest_end(n, linfodata);
+    addattr_nest_end(n, linfo);
 
-    free(resp);
+    nl_batch_close(b, n);
 }
 
 /**
- * @brief Создаёт сетевой сокет с указанными параметрами.
- * 
- * @param domain Домен сокета (например, PF_INET, AF_NETLINK)
- * @param type Тип сокета (например, SOCK_DGRAM, SOCK_RAW)
- * @param protocol Протокол (например, IPPROTO_IP, NETLINK_ROUTE)
- * @return Дескриптор созданного сокета
- * @note Завершает программу при ошибке создания сокета.
+ * @brief Заполняет параметры скорости для tbf и police
+ *
+ * Тип канального уровня указан явно, поэтому ядро не определяет его по
+ * таблице скоростей и содержимое таблицы не важно.
  */
-int create_socket(int domain, int type, int protocol)
+static void tc_rate(struct tc_ratespec *spec, uint64_t rate)
 {
-    int sock_fd = socket(domain, type, protocol);
-    if (sock_fd < 0)
-        die("cannot open socket: %m\n");
-
-    return sock_fd;
+    memset(spec, 0, sizeof(*spec));
+    spec->cell_log = 3;
+    spec->cell_align = -1;
+    spec->linklayer = TC_LINKLAYER_ETHERNET;
+    spec->rate = rate < UINT32_MAX ? rate : UINT32_MAX;
 }
 
 /**
- * @brief Отправляет Netlink сообщение и проверяет ответ.
- * 
- * @param sock_fd Дескриптор Netlink сокета
- * @param n Указатель на Netlink сообщение, готовое к отправке
+ * @brief Добавляет в пакет запрос RTM_NEWQDISC или RTM_NEWTFILTER
+ *
+ * @return Сообщение для добавления TCA_OPTIONS или NULL
  */
-static void send_nlmsg(int sock_fd, struct nlmsghdr *n)
+static struct nlmsghdr *nl_batch_tc(struct nl_batch *b, __u16 type, int ifindex,
+                                    __u32 handle, __u32 parent, __u32 info,
+                                    const char *kind)
+{
+    struct tcmsg tcm = {
+            .tcm_family = AF_UNSPEC,
+            .tcm_ifindex = ifindex,
+            .tcm_handle = handle,
+            .tcm_parent = parent,
+            .tcm_info = info,
+    };
+    struct nlmsghdr *n = nl_batch_add(
+            b, type, NLM_F_CREATE | NLM_F_EXCL, &tcm, sizeof(tcm));
+    if (n == NULL)
+        return NULL;
+
+    addattr_l(b, n, TCA_KIND, kind, strlen(kind) + 1);
+    return n;
+}
+
+void nl_batch_shape(struct nl_batch *b, int ifindex, uint64_t rate, __u32 burst)
+{
+    static const __u32 rtab[TC_RTAB_SIZE / sizeof(__u32)];
+    uint64_t rate64 = rate;
+    struct nlmsghdr *n;
+
+    // Исходящий трафик интерфейса (в песочницу): tbf с общим лимитом
+    struct tc_tbf_qopt tbf;
+    memset(&tbf, 0, sizeof(tbf));
+    tc_rate(&tbf.rate, rate);
+    // Очередь tbf — 50 мс на заданной скорости сверх запаса
+    uint64_t limit = burst + rate / 20;
+    tbf.limit = limit < UINT32_MAX ? limit : UINT32_MAX;
+
+    n = nl_batch_tc(b, RTM_NEWQDISC, ifindex, TC_H_MAKE(1 << 16, 0),
+                    TC_H_ROOT, 0, "tbf");
+    if (n == NULL)
+        return;
+    struct rtattr *opts = addattr_nest(b, n, TCA_OPTIONS);
+    addattr_l(b, n, TCA_TBF_PARMS, &tbf, sizeof(tbf));
+    if (rate >= UINT32_MAX)
+        addattr_l(b, n, TCA_TBF_RATE64, &rate64, sizeof(rate64));
+    addattr_l(b, n, TCA_TBF_BURST, &burst, sizeof(burst));
+    addattr_nest_end(n, opts);
+    nl_batch_close(b, n);
+
+    // fq внутри лимита делит полосу между потоками песочницы; без sch_fq
+    // остаётся очередь FIFO, созданная tbf
+    n = nl_batch_tc(b, RTM_NEWQDISC, ifindex, TC_H_MAKE(10 << 16, 0),
+                    TC_H_MAKE(1 << 16, 1), 0, "fq");
+    if (n == NULL)
+        return;
+    nl_batch_close(b, n);
+    if (n->nlmsg_seq <= 32)
+        b->optional |= 1u << (n->nlmsg_seq - 1);
+
+    // Входящий трафик (из песочницы): полисер отбрасывает пакеты сверх
+    // скорости, очереди на приёме нет
+    n = nl_batch_tc(b, RTM_NEWQDISC, ifindex, TC_H_MAKE(TC_H_INGRESS, 0),
+                    TC_H_INGRESS, 0, "ingress");
+    if (n == NULL)
+        return;
+    nl_batch_close(b, n);
+
+    struct tc_police police;
+    memset(&police, 0, sizeof(police));
+    police.action = TC_ACT_SHOT;
+    tc_rate(&police.rate, rate);
+    police.burst = ((uint64_t) burst * 1000000000ULL / rate) >> TC_TICK_SHIFT;
+
+    // u32 с одним нулевым ключом совпадает с любым пакетом
+    struct {
+        struct tc_u32_sel sel;
+        struct tc_u32_key key;
+    } sel;
+    memset(&sel, 0, sizeof(sel));
+    sel.sel.flags = TC_U32_TERMINAL;
+    sel.sel.nkeys = 1;
+
+    n = nl_batch_tc(b, RTM_NEWTFILTER, ifindex, 0, TC_H_MAKE(TC_H_INGRESS, 0),
+                    TC_H_MAKE(1 << 16, htons(ETH_P_ALL)), "u32");
+    if (n == NULL)
+        return;
+    opts = addattr_nest(b, n, TCA_OPTIONS);
+    addattr_l(b, n, TCA_U32_SEL, &sel, sizeof(sel));
+    struct rtattr *acts = addattr_nest(b, n, TCA_U32_ACT);
+    struct rtattr *act = addattr_nest(b, n, 1);
+    addattr_l(b, n, TCA_ACT_KIND, "police", 7);
+    struct rtattr *popts = addattr_nest(b, n, TCA_ACT_OPTIONS);
+    addattr_l(b, n, TCA_POLICE_TBF, &police, sizeof(police));
+    addattr_l(b, n, TCA_POLICE_RATE, rtab, sizeof(rtab));
+    if (rate >= UINT32_MAX)
+        addattr_l(b, n, TCA_POLICE_RATE64, &rate64, sizeof(rate64));
+    addattr_nest_end(n, popts);
+    addattr_nest_end(n, act);
+    addattr_nest_end(n, acts);
+    addattr_nest_end(n, opts);
+    nl_batch_close(b, n);
+}
+
+void nl_batch_dellink(struct nl_batch *b, const char *ifname)
+{
+    struct ifinfomsg ifi = { .ifi_family = PF_UNSPEC };
+    struct nlmsghdr *n = nl_batch_add(b, RTM_DELLINK, 0, &ifi, sizeof(ifi));
+    if (n == NULL)
+        return;
+
+    addattr_l(b, n, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+    nl_batch_close(b, n);
+
+    if (n->nlmsg_seq <= 32)
+        b->optional |= 1u << (n->nlmsg_seq - 1);
+}
+
+void nl_batch_getlink(struct nl_batch *b, const char *ifname)
+{
+    struct ifinfomsg ifi = { .ifi_family = PF_UNSPEC };
+    struct nlmsghdr *n = nl_batch_add(b, RTM_GETLINK, 0, &ifi, sizeof(ifi));
+    if (n == NULL)
+        return;
+
+    addattr_l(b, n, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+    nl_batch_close(b, n);
+}
+
+void nl_batch_getstats(struct nl_batch *b, int ifindex)
+{
+    struct if_stats_msg ifsm = {
+        .family = AF_UNSPEC,
+        .ifindex = ifindex,
+        .filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64),
+    };
+    nl_batch_add(b, RTM_GETSTATS, ifindex ? 0 : NLM_F_DUMP,
+                 &ifsm, sizeof(ifsm));
+}
+
+void nl_batch_addr(struct nl_batch *b, int ifindex,
+                   const char *ip, int prefixlen)
+{
+    struct ifaddrmsg ifa = {
+            .ifa_family = AF_INET,
+            .ifa_prefixlen = prefixlen,
+            .ifa_scope = RT_SCOPE_UNIVERSE,
+            .ifa_index = ifindex,
+    };
+    struct nlmsghdr *n = nl_batch_add(
+            b, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, &ifa, sizeof(ifa));
+    if (n == NULL)
+        return;
+
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip, &addr) != 1) {
+        b->error = -EINVAL;
+        return;
+    }
+
+    struct in_addr brd = addr;
+    if (prefixlen < 32)
+        brd.s_addr |= htonl(0xffffffffu >> prefixlen);
+
+    addattr_l(b, n, IFA_LOCAL, &addr, sizeof(addr));
+    addattr_l(b, n, IFA_ADDRESS, &addr, sizeof(addr));
+    addattr_l(b, n, IFA_BROADCAST, &brd, sizeof(brd));
+
+    nl_batch_close(b, n);
+}
+
+void nl_batch_link_up(struct nl_batch *b, int ifindex)
+{
+    struct ifinfomsg ifi = {
+            .ifi_family = PF_UNSPEC,
+            .ifi_index = ifindex,
+            .ifi_flags = IFF_UP,
+            .ifi_change = IFF_UP,
+    };
+
+    nl_batch_add(b, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+}
+
+int nl_batch_send(int sock_fd, struct nl_batch *b)
 {
+    if (b->error) {
+        errno = -b->error;
+        return fail("cannot build netlink batch: %m\n");
+    }
+
     struct iovec iov = {
-            .iov_base = n,
-            .iov_len = n->nlmsg_len
+            .iov_base = b->buf,
+            .iov_len = b->len
     };
 
     struct msghdr msg = {
@@ -178,131 +523,514 @@ static void send_nlmsg(int sock_fd, struct nlmsghdr *n)
             .msg_iovlen = 1
     };
 
-    n->nlmsg_seq++;
-
     ssize_t status = sendmsg(sock_fd, &msg, 0);
     if (status < 0)
-        die("cannot talk to rtnetlink: %m\n");
+        return fail("cannot talk to rtnetlink: %m\n");
+    return 0;
+}
 
-    check_response(sock_fd);
+void nl_rx_free(struct nl_rx *rx)
+{
+    free(rx->buf);
+    rx->buf = NULL;
+    rx->size = 0;
 }
 
 /**
- * @brief Получает дескриптор сетевого пространства имен процесса по его PID.
- * 
- * @param pid Идентификатор процесса
- * @return Дескриптор сетевого пространства имен процесса
- * @note Завершает программу при ошибке открытия файла netns.
+ * @brief Принимает одну датаграмму Netlink в буфер, при необходимости
+ *        увеличивая его
+ *
+ * Длина датаграммы сначала узнаётся через MSG_PEEK | MSG_TRUNC, поэтому
+ * большое сообщение не обрезается.
+ *
+ * @return Длина датаграммы или -errno
  */
-int get_netns_fd(int pid)
+static ssize_t nl_recv(int sock_fd, struct nl_rx *rx)
 {
-    char path[256];
-    sprintf(path, "/proc/%d/ns/net", pid);
+    ssize_t len = recv(sock_fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (len < 0)
+        return fail("netlink receive error: %m\n");
+    if (len == 0) {
+        errno = ECONNRESET;
+        return fail("EOF on netlink\n");
+    }
 
-    int fd = open(path, O_RDONLY);
+    if ((size_t) len > rx->size || rx->buf == NULL) {
+        size_t size = len > NL_RECV_SIZE ? (size_t) len : NL_RECV_SIZE;
+        char *buf = realloc(rx->buf, size);
+        if (buf == NULL) {
+            errno = ENOMEM;
+            return fail("cannot allocate netlink buffer: %m\n");
+        }
+        rx->buf = buf;
+        rx->size = size;
+    }
 
-    if (fd < 0)
-        die("cannot read netns file %s: %m\n", path);
+    len = recv(sock_fd, rx->buf, rx->size, 0);
+    if (len < 0)
+        return fail("netlink receive error: %m\n");
+    return len;
+}
 
-    return fd;
+int nl_batch_wait(int sock_fd, struct nl_batch *b, struct nl_rx *rx,
+                  nl_handler handler, void *arg)
+{
+    int first = 0;
+
+    while (b->pending > 0) {
+        ssize_t resp_len = nl_recv(sock_fd, rx);
+        if (resp_len < 0)
+            return resp_len;
+
+        // В одной датаграмме может прийти несколько ответов, а ответ на
+        // запрос NLM_F_DUMP — занять несколько датаграмм (NLM_F_MULTI)
+        int len = resp_len;
+        struct nlmsghdr *hdr = (struct nlmsghdr *) rx->buf;
+        for (; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len)) {
+            int error = 0;
+
+            if (hdr->nlmsg_type == NLMSG_DONE) {
+                // Конец дампа; ошибка дампа передаётся в его теле
+                if (hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(int)))
+                    memcpy(&error, NLMSG_DATA(hdr), sizeof(int));
+            } else if (hdr->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(hdr);
+                if (hdr->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+                    errno = EBADMSG;
+                    return fail("ERROR truncated!\n");
+                }
+                error = err->error;
+            } else {
+                if (handler)
+                    handler(hdr, arg);
+                continue;
+            }
+
+            __u32 seq = hdr->nlmsg_seq;
+            int optional = seq >= 1 && seq <= 32 &&
+                           (b->optional & (1u << (seq - 1)));
+
+            // Остальные подтверждения дочитываются, чтобы сокет можно было
+            // использовать для следующего пакета
+            if (error && !first &&
+                !(optional && (error == -ENODEV || error == -ENOENT))) {
+                errno = -error;
+                first = error == b->quiet ? error : fail("RTNETLINK: %m\n");
+            }
+
+            b->pending--;
+        }
+
+        if (len) {
+            errno = EBADMSG;
+            return fail("malformed message: %d trailing bytes\n", len);
+        }
+    }
+    return first;
 }
 
 /**
- * @brief Активирует сетевой интерфейс, назначая IP и маску.
- * 
- * @param ifname Имя интерфейса (например, "eth0")
- * @param ip IP-адрес в виде строки (например, "192.168.1.10")
- * @param netmask Маска подсети в виде строки (например, "255.255.255.0")
+ * @brief Индексы интерфейса и его пары из ответа RTM_GETLINK.
  */
-void if_up(
-        char *ifname, char *ip, char *netmask)
+struct link_index {
+    int ifindex;    /**< Индекс интерфейса */
+    int link;       /**< Индекс второго конца пары (IFLA_LINK) в его namespace */
+};
+
+/**
+ * @brief Обработчик ответа RTM_GETLINK: сохраняет ifi_index и IFLA_LINK.
+ */
+static void store_link_index(struct nlmsghdr *n, void *arg)
 {
-    int sock_fd = create_socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
+    struct link_index *idx = arg;
+
+    if (n->nlmsg_type != RTM_NEWLINK)
+        return;
+
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+    idx->ifindex = ifi->ifi_index;
+
+    int len = IFLA_PAYLOAD(n);
+    for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+         rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_LINK)
+            memcpy(&idx->link, RTA_DATA(rta), sizeof(int));
+    }
+}
 
+/**
+ * @brief Включает GRO на интерфейсе через ethtool
+ *
+ * Для veth включённый GRO переводит приём на NAPI с отдельным контекстом на
+ * каждую очередь, вместо обработки пакета в контексте отправителя.
+ *
+ * @param sock_fd Любой сокет в namespace интерфейса
+ * @param ifname Имя интерфейса
+ * @return 0 или -errno
+ */
+static int enable_gro(int sock_fd, const char *ifname)
+{
+    struct ethtool_value val = { .cmd = ETHTOOL_SGRO, .data = 1 };
     struct ifreq ifr;
-    memset(&ifr, 0, sizeof(struct ifreq));
-    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
 
-    struct sockaddr_in saddr;
-    memset(&saddr, 0, sizeof(struct sockaddr_in));
-    saddr.sin_family = AF_INET;
-    saddr.sin_port = 0;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+    ifr.ifr_data = (void *) &val;
+
+    if (ioctl(sock_fd, SIOCETHTOOL, &ifr))
+        return fail("cannot enable GRO on %s: %m\n", ifname);
+    return 0;
+}
+
+/**
+ * @brief Создаёт интерфейсы выбранного драйвера и узнаёт их индексы
+ *
+ * @return 0, -EOPNOTSUPP, если ядро не знает тип ссылки, или -errno
+ */
+static int create_links(int sock_fd, int peer_sock_fd, int peer_netns,
+                        const struct net_opts *net, int queues,
+                        const char *ifname, const char *peername,
+                        struct nl_rx *rx, struct link_index *idx)
+{
+    struct nl_batch b;
+    const char *kind = drivers[net->driver].kind;
+    int err;
+
+    // Интерфейс с тем же именем мог остаться от предыдущего владельца
+    // номера экземпляра, если его namespace ещё не уничтожен ядром
+    nl_batch_init(&b);
+    nl_batch_dellink(&b, ifname);
+
+    // Без поддержки netkit в ядре create_net_link() переходит на veth
+    if (net->driver == NET_DRIVER_NETKIT)
+        b.quiet = -EOPNOTSUPP;
+
+    if (net->driver == NET_DRIVER_IPVLAN || net->driver == NET_DRIVER_MACVLAN) {
+        int uplink = net->uplink ? if_nametoindex(net->uplink) : 0;
+        if (uplink == 0) {
+            errno = ENODEV;
+            return fail("%s requires an existing --uplink interface\n", kind);
+        }
+
+        // Интерфейс хоста — такой же дочерний интерфейс того же uplink:
+        // хост и песочница обмениваются пакетами внутри драйвера
+        nl_batch_slave(&b, kind, ifname, uplink, -1);
+        nl_batch_slave(&b, kind, peername, uplink, peer_netns);
+    } else {
+        nl_batch_pair(&b, kind, ifname, peername, peer_netns,
+                      net->driver == NET_DRIVER_VETH_MQ ? queues : 1);
+    }
+    nl_batch_getlink(&b, ifname);
+
+    if ((err = nl_batch_send(sock_fd, &b)) ||
+        (err = nl_batch_wait(sock_fd, &b, rx, store_link_index, idx)))
+        return err;
+
+    // У veth и netkit IFLA_LINK — индекс второго конца в его namespace,
+    // у ipvlan и macvlan — индекс uplink, поэтому индекс в песочнице
+    // запрашивается отдельно
+    if (net->driver == NET_DRIVER_IPVLAN || net->driver == NET_DRIVER_MACVLAN) {
+        struct link_index peer = { 0, 0 };
+
+        nl_batch_init(&b);
+        nl_batch_getlink(&b, peername);
+        if ((err = nl_batch_send(peer_sock_fd, &b)) ||
+            (err = nl_batch_wait(peer_sock_fd, &b, rx, store_link_index, &peer)))
+            return err;
+        idx->link = peer.ifindex;
+    }
+
+    if (net->driver == NET_DRIVER_VETH_MQ &&
+        ((err = enable_gro(sock_fd, ifname)) ||
+         (err = enable_gro(peer_sock_fd, peername))))
+        return err;
+    return 0;
+}
+
+int create_net_link(int sock_fd, int peer_sock_fd, int peer_netns,
+                    const struct net_opts *net, int queues,
+                    int id, const char *peername,
+                    const char *ip, const char *peer_ip, int prefixlen,
+                    int *ifindex, int *peer_ifindex, struct timings *t)
+{
+    static int no_netkit;
+    char ifname[IFNAMSIZ];
+    struct nl_rx rx = { NULL, 0 };
+    struct nl_batch b;
+    struct nl_batch peer_b;
+    struct link_index idx = { 0, 0 };
+    struct net_opts veth = *net;
+    uint64_t start = timing_now_us();
+    int err;
+
+    veth.driver = NET_DRIVER_VETH;
+
+    // Трафик ipvlan и macvlan во внешнюю сеть не проходит через интерфейс
+    // хоста, и лимит на нём ограничил бы только обмен с хостом
+    if (net->rate && (net->driver == NET_DRIVER_IPVLAN ||
+                      net->driver == NET_DRIVER_MACVLAN)) {
+        errno = EINVAL;
+        return fail("--rate is not supported with %s\n",
+                    drivers[net->driver].name);
+    }
+
+    if (net->driver == NET_DRIVER_NETKIT &&
+        __atomic_load_n(&no_netkit, __ATOMIC_RELAXED))
+        net = &veth;
 
-    char *p = (char *) &saddr;
+    // Создаём интерфейсы и сразу узнаём индексы обоих концов
+    net_ifname(net->driver, id, ifname, sizeof(ifname));
+    err = create_links(sock_fd, peer_sock_fd, peer_netns, net, queues,
+                       ifname, peername, &rx, &idx);
+    if (err == -EOPNOTSUPP && net->driver == NET_DRIVER_NETKIT) {
+        if (!__atomic_exchange_n(&no_netkit, 1, __ATOMIC_RELAXED))
+            fprintf(stderr, "netkit is not supported by the kernel, "
+                            "using veth\n");
+        net = &veth;
+        net_ifname(net->driver, id, ifname, sizeof(ifname));
+        idx.ifindex = idx.link = 0;
+        err = create_links(sock_fd, peer_sock_fd, peer_netns, net, queues,
+                           ifname, peername, &rx, &idx);
+    }
+    if (!err && (!idx.ifindex || !idx.link)) {
+        errno = ENODEV;
+        err = fail("cannot resolve ifindex of %s/%s\n", ifname, peername);
+    }
+    if (err)
+        goto out;
 
-    saddr.sin_addr.s_addr = inet_addr(ip);
-    memcpy(&ifr.ifr_addr, p, sizeof(struct sockaddr));
-    if (ioctl(sock_fd, SIOCSIFADDR, &ifr))
-        die("cannot set ip addr %s, %s: %m\n", ifname, ip);
+    uint64_t created = timing_now_us();
 
-    saddr.sin_addr.s_addr = inet_addr(netmask);
-    memcpy(&ifr.ifr_addr, p, sizeof(struct sockaddr));
-    if (ioctl(sock_fd, SIOCSIFNETMASK, &ifr))
-        die("cannot set netmask for addr %s, %s: %m\n", ifname, netmask);
+    // Адреса и IFF_UP для обоих концов: два пакета на двух сокетах,
+    // подтверждения собираются после отправки обоих
+    nl_batch_init(&peer_b);
+    nl_batch_addr(&peer_b, idx.link, peer_ip, prefixlen);
+    nl_batch_link_up(&peer_b, idx.link);
+    if ((err = nl_batch_send(peer_sock_fd, &peer_b)))
+        goto out;
 
-    ifr.ifr_flags |= IFF_UP | IFF_BROADCAST |
-                     IFF_RUNNING | IFF_MULTICAST;
-    if (ioctl(sock_fd, SIOCSIFFLAGS, &ifr))
-        die("cannot set flags for addr %s, %s: %m\n", ifname, ip);
+    nl_batch_init(&b);
+    nl_batch_addr(&b, idx.ifindex, ip, prefixlen);
+    if (net->rate)
+        nl_batch_shape(&b, idx.ifindex, net->rate,
+                       net->burst ? net->burst : net_default_burst(net->rate));
+    nl_batch_link_up(&b, idx.ifindex);
+    if ((err = nl_batch_send(sock_fd, &b)))
+        goto out;
 
-    close(sock_fd);
+    // Подтверждения читаются с обоих сокетов, даже если первый вернул ошибку
+    err = nl_batch_wait(peer_sock_fd, &peer_b, &rx, NULL, NULL);
+    int err2 = nl_batch_wait(sock_fd, &b, &rx, NULL, NULL);
+    if (!err)
+        err = err2;
+    if (err)
+        goto out;
+
+    *ifindex = idx.ifindex;
+    *peer_ifindex = idx.link;
+    if (t) {
+        t->us[TIMING_VETH] = created - start;
+        t->us[TIMING_ADDR] = timing_now_us() - created;
+    }
+out:
+    nl_rx_free(&rx);
+    return err;
+}
+
+void net_ifname(enum net_driver driver, int id, char *buf, size_t len)
+{
+    snprintf(buf, len, "%s%d", drivers[driver].prefix, id);
+}
+
+int net_release(int sock_fd, struct nl_rx *rx, enum net_driver driver, int id)
+{
+    char ifname[IFNAMSIZ];
+    struct nl_batch b;
+    int err;
+
+    // Второй конец veth и netkit удаляется вместе с namespace песочницы
+    if (driver != NET_DRIVER_IPVLAN && driver != NET_DRIVER_MACVLAN)
+        return 0;
+
+    net_ifname(driver, id, ifname, sizeof(ifname));
+    nl_batch_init(&b);
+    nl_batch_dellink(&b, ifname);
+    if ((err = nl_batch_send(sock_fd, &b)) == 0)
+        err = nl_batch_wait(sock_fd, &b, rx, NULL, NULL);
+    return err;
 }
 
 /**
- * @brief Создает пару виртуальных Ethernet интерфейсов (veth pair) с заданными именами.
- * 
- * @param sock_fd Дескриптор Netlink сокета
- * @param ifname Имя первой стороны veth (например, "veth0")
- * @param peername Имя второй стороны veth (например, "veth1")
+ * @brief Обработчик дампа и его аргумент для parse_stats()
  */
-void create_veth(int sock_fd, char *ifname, char *peername)
-{
-    // Формируем Netlink запрос на создание link
-    __u16 flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK;
-    struct nl_req req = {
-            .n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
-            .n.nlmsg_flags = flags,
-            .n.nlmsg_type = RTM_NEWLINK,
-            .i.ifi_family = PF_NETLINK,
-    };
-    struct nlmsghdr *n = &req.n;
-    int maxlen = sizeof(req);
+struct stats_dump {
+    net_stats_handler handler;  /**< Обработчик счётчиков */
+    void *arg;                  /**< Аргумент обработчика */
+    int peer;                   /**< Интерфейс в песочнице: rx и tx не меняются местами */
+};
 
-    addattr_l(n, maxlen, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+/**
+ * @brief Обработчик ответа RTM_GETSTATS: переводит IFLA_STATS_LINK_64
+ *        интерфейса в счётчики песочницы
+ */
+static void parse_stats(struct nlmsghdr *n, void *arg)
+{
+    struct stats_dump *dump = arg;
 
-    struct rtattr *linfo = addattr_nest(n, maxlen, IFLA_LINKINFO);
-    addattr_l(&req.n, sizeof(req), IFLA_INFO_KIND, "veth", 5);
+    if (n->nlmsg_type != RTM_NEWSTATS ||
+        n->nlmsg_len < NLMSG_LENGTH(sizeof(struct if_stats_msg)))
+        return;
 
-    struct rtattr *linfodata = addattr_nest(n, maxlen, IFLA_INFO_DATA);
+    struct if_stats_msg *ifsm = NLMSG_DATA(n);
+    int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifsm));
+    struct rtattr *rta = (struct rtattr *) ((char *) ifsm +
+                                            NLMSG_ALIGN(sizeof(*ifsm)));
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type != IFLA_STATS_LINK_64)
+            continue;
 
-    struct rtattr *peerinfo = addattr_nest(n, maxlen, VETH_INFO_PEER);
-    n->nlmsg_len += sizeof(struct ifinfomsg);
-    addattr_l(n, maxlen, IFLA_IFNAME, peername, strlen(peername) + 1);
-    addattr_nest_end(n, peerinfo);
+        // Атрибут выровнен на 4 байта, а размер структуры растёт с версией ядра
+        struct rtnl_link_stats64 link = { 0 };
+        size_t size = RTA_PAYLOAD(rta);
+        memcpy(&link, RTA_DATA(rta), size < sizeof(link) ? size : sizeof(link));
 
-    addattr_nest_end(n, linfodata);
-    addattr_nest_end(n, linfo);
+        // У интерфейса хоста что хост отправил, песочница приняла, и наоборот
+        int swap = !dump->peer;
+        struct net_stats st = {
+            .rx_bytes = swap ? link.tx_bytes : link.rx_bytes,
+            .tx_bytes = swap ? link.rx_bytes : link.tx_bytes,
+            .rx_packets = swap ? link.tx_packets : link.rx_packets,
+            .tx_packets = swap ? link.rx_packets : link.tx_packets,
+            .rx_dropped = swap ? link.tx_dropped : link.rx_dropped,
+            .tx_dropped = swap ? link.rx_dropped : link.tx_dropped,
+            .rx_errors = swap ? link.tx_errors : link.rx_errors,
+            .tx_errors = swap ? link.rx_errors : link.tx_errors,
+        };
+        dump->handler(ifsm->ifindex, &st, dump->arg);
+        return;
+    }
+}
 
-    send_nlmsg(sock_fd, n);
+/**
+ * @brief Обработчик net_stats_read(): сохраняет счётчики интерфейса
+ */
+static void store_stats(int ifindex, const struct net_stats *st, void *arg)
+{
+    (void) ifindex;
+    *(struct net_stats *) arg = *st;
 }
 
 /**
- * @brief Перемещает сетевой интерфейс в сетевое пространство имен процесса.
- * 
- * @param sock_fd Дескриптор Netlink сокета
- * @param ifname Имя интерфейса для перемещения
- * @param netns Файловый дескриптор сетевого пространства имен назначения
+ * @brief Отправляет запрос RTM_GETSTATS и передаёт ответы обработчику
  */
-void move_if_to_pid_netns(int sock_fd, char *ifname, int netns)
+static int get_stats(int sock_fd, struct nl_rx *rx, int ifindex, int peer,
+                     net_stats_handler handler, void *arg)
 {
-    struct nl_req req = {
-            .n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
-            .n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK,
-            .n.nlmsg_type = RTM_NEWLINK,
-            .i.ifi_family = PF_NETLINK,
-    };
+    struct stats_dump dump = { handler, arg, peer };
+    struct nl_batch b;
+    int err;
+
+    nl_batch_init(&b);
+    nl_batch_getstats(&b, ifindex);
+    if ((err = nl_batch_send(sock_fd, &b)))
+        return err;
+    return nl_batch_wait(sock_fd, &b, rx, parse_stats, &dump);
+}
+
+int net_stats_read(int sock_fd, struct nl_rx *rx, int ifindex,
+                   struct net_stats *st)
+{
+    return get_stats(sock_fd, rx, ifindex, 0, store_stats, st);
+}
+
+int net_stats_read_peer(int sock_fd, struct nl_rx *rx, int ifindex,
+                        struct net_stats *st)
+{
+    return get_stats(sock_fd, rx, ifindex, 1, store_stats, st);
+}
+
+int net_stats_dump(int sock_fd, struct nl_rx *rx, net_stats_handler handler,
+                   void *arg)
+{
+    return get_stats(sock_fd, rx, 0, 0, handler, arg);
+}
+
+void net_stats_write_json(FILE *f, const struct net_stats *st)
+{
+    fprintf(f, "{\"rx_bytes\":%llu,\"tx_bytes\":%llu,"
+               "\"rx_packets\":%llu,\"tx_packets\":%llu,"
+               "\"rx_dropped\":%llu,\"tx_dropped\":%llu,"
+               "\"rx_errors\":%llu,\"tx_errors\":%llu}",
+            (unsigned long long) st->rx_bytes,
+            (unsigned long long) st->tx_bytes,
+            (unsigned long long) st->rx_packets,
+            (unsigned long long) st->tx_packets,
+            (unsigned long long) st->rx_dropped,
+            (unsigned long long) st->tx_dropped,
+            (unsigned long long) st->rx_errors,
+            (unsigned long long) st->tx_errors);
+}
+
+__u32 net_default_burst(uint64_t rate)
+{
+    uint64_t burst = rate / 100;
+    if (burst < NET_BURST_MIN)
+        burst = NET_BURST_MIN;
+    return burst < UINT32_MAX ? burst : UINT32_MAX;
+}
+
+/**
+ * @brief Разбирает число с десятичным (k, m, g) или двоичным (K, M, G)
+ *        множителем
+ */
+static uint64_t parse_scaled(const char *s, char **end, int decimal)
+{
+    uint64_t v = strtoull(s, end, 10);
+    uint64_t unit = decimal ? 1000 : 1024;
+
+    switch (**end) {
+        case 'G': case 'g': v *= unit; /* fallthrough */
+        case 'M': case 'm': v *= unit; /* fallthrough */
+        case 'K': case 'k': v *= unit; (*end)++;
+        default: break;
+    }
+    return v;
+}
+
+void net_parse_rate(const char *arg, struct net_opts *net)
+{
+    char *end;
+
+    // Скорость в битах в секунду, как принято для сети
+    uint64_t bits = parse_scaled(arg, &end, 1);
+    if (strcmp(end, "bit") && *end != '\0')
+        die("Invalid rate %s, expected bits per second (e.g. 100m)\n", arg);
+    if (bits < 8)
+        die("Invalid rate %s\n", arg);
+    net->rate = bits / 8;
+}
+
+void net_parse_burst(const char *arg, struct net_opts *net)
+{
+    char *end;
+    uint64_t burst = parse_scaled(arg, &end, 0);
+
+    if (*end != '\0' || burst == 0 || burst > UINT32_MAX)
+        die("Invalid burst %s, expected bytes (e.g. 256K)\n", arg);
+    net->burst = burst;
+}
+
+const char *net_driver_name(enum net_driver driver)
+{
+    return drivers[driver].name;
+}
+
+enum net_driver net_driver_parse(const char *name)
+{
+    for (size_t i = 0; i < sizeof(drivers) / sizeof(drivers[0]); i++)
+        if (!strcmp(name, drivers[i].name))
+            return i;
 
-    addattr_l(&req.n, sizeof(req), IFLA_NET_NS_FD, &netns, sizeof(netns));
-    addattr_l(&req.n, sizeof(req), IFLA_IFNAME, ifname, strlen(ifname) + 1);
-    send_nlmsg(sock_fd, &req.n);
+    die("Unknown network driver %s\n", name);
+    return NET_DRIVER_VETH;
 }
@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../include/util.h"
+#include "../include/cgroup_control.h"
+#include "../include/perf.h"
+
+/**
+ * @struct perf_counter_def
+ * @brief Событие perf_event и его имя в отчётах.
+ */
+struct perf_counter_def {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const struct perf_counter_def counters[PERF_COUNTERS] = {
+        [PERF_CYCLES] = { "cycles", PERF_TYPE_HARDWARE,
+                          PERF_COUNT_HW_CPU_CYCLES },
+        [PERF_INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE,
+                                PERF_COUNT_HW_INSTRUCTIONS },
+        [PERF_LLC_MISSES] = { "llc_misses", PERF_TYPE_HARDWARE,
+                              PERF_COUNT_HW_CACHE_MISSES },
+        [PERF_CONTEXT_SWITCHES] = { "context_switches", PERF_TYPE_SOFTWARE,
+                                    PERF_COUNT_SW_CONTEXT_SWITCHES },
+        [PERF_CPU_CLOCK] = { "cpu_clock_ns", PERF_TYPE_SOFTWARE,
+                             PERF_COUNT_SW_CPU_CLOCK },
+};
+
+/**
+ * @brief Отмечает в set CPU из списка формата cpuset.cpus ("0-3,8");
+ *        пустой список означает все CPU
+ */
+static void parse_cpus(const char *list, char *set, int n)
+{
+    const char *p = list;
+
+    memset(set, *list == '\0' || *list == '\n', n);
+    while (*p && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long cpu = first; cpu <= last && cpu < n; cpu++)
+            set[cpu] = 1;
+        if (*end != ',')
+            break;
+        p = end + 1;
+    }
+}
+
+static int open_counter(int cgroup_fd, int cpu, int leader,
+                        enum perf_counter c)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counters[c].type;
+    attr.config = counters[c].config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, cgroup_fd, cpu, leader,
+                   PERF_FLAG_PID_CGROUP | PERF_FLAG_FD_CLOEXEC);
+}
+
+static void close_fds(struct perf *p)
+{
+    for (int i = 0; i < p->ncpus * PERF_COUNTERS; i++) {
+        if (p->fd[i] >= 0)
+            close(p->fd[i]);
+        p->fd[i] = -1;
+    }
+}
+
+/**
+ * @brief Открывает группу счётчиков на каждом CPU из set; первый открытый
+ *        счётчик CPU становится лидером группы
+ *
+ * @return 0 или -errno первой неудачи
+ */
+static int open_groups(struct perf *p, int cgroup_fd, const char *set)
+{
+    for (int cpu = 0; cpu < p->ncpus; cpu++) {
+        int *fd = &p->fd[cpu * PERF_COUNTERS];
+        int leader = -1;
+
+        if (!set[cpu])
+            continue;
+        for (int c = 0; c < PERF_COUNTERS; c++) {
+            if (counters[c].type == PERF_TYPE_HARDWARE && !p->hardware)
+                continue;
+            fd[c] = open_counter(cgroup_fd, cpu, leader, c);
+            if (fd[c] >= 0) {
+                if (leader < 0)
+                    leader = fd[c];
+                continue;
+            }
+            // Отключённый CPU: процессы экземпляра на нём не работают
+            if (errno == ENODEV && leader < 0)
+                break;
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+int perf_open(struct perf *p, int cgroup_fd)
+{
+    static int no_pmu;
+    char cpus[4096];
+    int err;
+
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    p->ncpus = n > 0 ? n : 1;
+    p->fd = malloc(p->ncpus * PERF_COUNTERS * sizeof(*p->fd));
+    char *set = malloc(p->ncpus);
+    if (p->fd == NULL || set == NULL) {
+        free(set);
+        free(p->fd);
+        p->fd = NULL;
+        return fail("Failed to allocate perf counters: %m\n");
+    }
+    for (int i = 0; i < p->ncpus * PERF_COUNTERS; i++)
+        p->fd[i] = -1;
+
+    // Без контроллера cpuset процессы экземпляра могут работать на любом CPU
+    if (cgroup_read_file(cgroup_fd, "cpuset.cpus.effective", cpus,
+                         sizeof(cpus)) < 0)
+        cpus[0] = '\0';
+    parse_cpus(cpus, set, p->ncpus);
+
+    p->hardware = 1;
+    err = open_groups(p, cgroup_fd, set);
+
+    // Без аппаратного PMU (обычно в виртуальных машинах) ядро не знает
+    // событий PERF_TYPE_HARDWARE
+    if (err == -ENOENT || err == -EOPNOTSUPP) {
+        close_fds(p);
+        if (!__atomic_exchange_n(&no_pmu, 1, __ATOMIC_RELAXED))
+            fprintf(stderr, "Hardware performance counters are not "
+                            "available, counting software events only\n");
+        p->hardware = 0;
+        err = open_groups(p, cgroup_fd, set);
+    }
+    free(set);
+
+    if (err) {
+        perf_close(p);
+        errno = -err;
+        return fail("Failed to open perf counters: %m\n");
+    }
+    return 0;
+}
+
+/**
+ * @brief Дописывает в список CPU диапазон first-last
+ */
+static void append_range(char *buf, size_t *len, int first, int last)
+{
+    int n;
+
+    if (first < 0 || *len >= PERF_CPUS_LEN)
+        return;
+    if (first == last)
+        n = snprintf(buf + *len, PERF_CPUS_LEN - *len, "%s%d",
+                     *len ? "," : "", first);
+    else
+        n = snprintf(buf + *len, PERF_CPUS_LEN - *len, "%s%d-%d",
+                     *len ? "," : "", first, last);
+    *len += n;
+}
+
+void perf_read(const struct perf *p, struct perf_counts *counts)
+{
+    uint64_t buf[3 + PERF_COUNTERS];
+    size_t len = 0;
+    int first = -1;
+    int last = -1;
+
+    memset(counts, 0, sizeof(*counts));
+    counts->hardware = p->hardware;
+    if (p->fd == NULL)
+        return;
+
+    for (int cpu = 0; cpu < p->ncpus; cpu++) {
+        const int *fd = &p->fd[cpu * PERF_COUNTERS];
+        int leader = -1;
+
+        for (int c = 0; c < PERF_COUNTERS && leader < 0; c++)
+            leader = fd[c];
+        if (leader < 0)
+            continue;
+
+        // Формат группы: число счётчиков, время включения и работы, значения
+        ssize_t n = read(leader, buf, sizeof(buf));
+        if (n < (ssize_t) (3 * sizeof(uint64_t)))
+            continue;
+        uint64_t nr = buf[0];
+        uint64_t enabled = buf[1];
+        uint64_t running = buf[2];
+        if (running == 0)
+            continue;
+
+        // Время cgroup-счётчиков идёт, только пока экземпляр работает на CPU
+        uint64_t k = 3;
+        for (int c = 0; c < PERF_COUNTERS && k < 3 + nr; c++) {
+            if (fd[c] < 0)
+                continue;
+            uint64_t v = buf[k++];
+            if (running < enabled) {
+                v = (uint64_t) ((double) v * enabled / running);
+                counts->multiplexed = 1;
+            }
+            counts->value[c] += v;
+        }
+
+        if (cpu == last + 1 && first >= 0) {
+            last = cpu;
+        } else {
+            append_range(counts->cpus, &len, first, last);
+            first = last = cpu;
+        }
+    }
+    append_range(counts->cpus, &len, first, last);
+}
+
+void perf_close(struct perf *p)
+{
+    if (p->fd == NULL)
+        return;
+    close_fds(p);
+    free(p->fd);
+    p->fd = NULL;
+}
+
+void perf_write_json(FILE *f, const struct perf_counts *counts)
+{
+    const uint64_t *v = counts->value;
+
+    fprintf(f, "{\"mode\":\"%s\"", counts->hardware ? "hardware" : "software");
+    for (int c = 0; c < PERF_COUNTERS; c++) {
+        if (counters[c].type == PERF_TYPE_HARDWARE && !counts->hardware)
+            fprintf(f, ",\"%s\":null", counters[c].name);
+        else
+            fprintf(f, ",\"%s\":%llu", counters[c].name,
+                    (unsigned long long) v[c]);
+    }
+    if (counts->hardware && v[PERF_CYCLES] > 0)
+        fprintf(f, ",\"ipc\":%.3f",
+                (double) v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]);
+    else
+        fputs(",\"ipc\":null", f);
+    fprintf(f, ",\"multiplexed\":%s,\"cpus\":\"%s\"}",
+            counts->multiplexed ? "true" : "false", counts->cpus);
+}
@@ -0,0 +1,537 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "../include/util.h"
+#include "../include/instance.h"
+#include "../include/placement.h"
+
+#ifndef PLACEMENT_SYSFS
+#define PLACEMENT_SYSFS "/sys/devices/system"
+#endif
+
+#define PLACEMENT_MAGIC 0x706c6331u
+
+/**
+ * @brief Топология хоста
+ */
+struct topology {
+    int error;                              /**< Ошибка чтения топологии (-errno) или 0 */
+    int ncpus;                              /**< Наибольший номер CPU + 1 */
+    cpu_set_t online;                       /**< Доступные CPU */
+    int core[CPU_SETSIZE];                  /**< Первый CPU физического ядра (SMT-соседи совпадают) */
+    int llc[CPU_SETSIZE];                   /**< Индекс домена LLC */
+    int node[CPU_SETSIZE];                  /**< Узел NUMA */
+    int nllc;                               /**< Число доменов LLC */
+    cpu_set_t llc_cpus[PLACEMENT_LLC_MAX];  /**< CPU каждого домена LLC */
+};
+
+/**
+ * @brief Занятость CPU, разделяемая процессами isolate через PLACEMENT_STATE
+ */
+struct placement_state {
+    uint32_t magic;                         /**< PLACEMENT_MAGIC */
+    uint32_t ncpus;                         /**< Топология, для которой записано состояние */
+    uint16_t owner[CPU_SETSIZE];            /**< Номер экземпляра + 1, занявшего CPU исключительно */
+    uint16_t shared_llc[INSTANCE_MAX];      /**< Домен LLC + 1 экземпляра с общим срезом */
+    uint16_t shared_load[PLACEMENT_LLC_MAX];  /**< Число экземпляров с общим срезом в домене */
+};
+
+static struct topology topo;
+static pthread_once_t topo_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Читает небольшой файл sysfs
+ *
+ * @return Длина содержимого или -1, если файл недоступен
+ */
+static ssize_t read_sysfs(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0)
+        return -1;
+
+    buf[len] = '\0';
+    return len;
+}
+
+/**
+ * @brief Разбирает список вида "0-3,8-11" в множество
+ *
+ * @return 0 или -1, если файл недоступен
+ */
+static int read_list(const char *path, cpu_set_t *set)
+{
+    char buf[4096];
+
+    CPU_ZERO(set);
+    if (read_sysfs(path, buf, sizeof(buf)) < 0)
+        return -1;
+
+    for (char *p = buf; *p && *p != '\n';) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p)
+            break;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long i = first; i <= last && i < CPU_SETSIZE; i++)
+            CPU_SET(i, set);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+/**
+ * @brief Записывает множество в формате списка cpuset ("0-3,8")
+ *
+ * @return 0 или -ENOSPC, если список не помещается в буфер
+ */
+static int format_list(const cpu_set_t *set, char *buf, size_t len)
+{
+    size_t off = 0;
+    buf[0] = '\0';
+
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        if (!CPU_ISSET(i, set))
+            continue;
+        int j = i;
+        while (j + 1 < CPU_SETSIZE && CPU_ISSET(j + 1, set))
+            j++;
+
+        int n = i == j ?
+                snprintf(buf + off, len - off, "%s%d", off ? "," : "", i) :
+                snprintf(buf + off, len - off, "%s%d-%d", off ? "," : "", i, j);
+        if (n < 0 || (size_t) n >= len - off) {
+            errno = ENOSPC;
+            return fail("cpuset list does not fit in %zu bytes\n", len);
+        }
+        off += n;
+        i = j;
+    }
+    return 0;
+}
+
+static int first_cpu(const cpu_set_t *set)
+{
+    for (int i = 0; i < CPU_SETSIZE; i++)
+        if (CPU_ISSET(i, set))
+            return i;
+    return -1;
+}
+
+/**
+ * @brief Читает домен LLC процессора: кэш наибольшего уровня из cache/index*
+ *
+ * @return 0 или -1, если сведений о кэше нет
+ */
+static int read_llc(int cpu, cpu_set_t *set)
+{
+    char path[256];
+    char buf[32];
+    int best = -1;
+
+    for (int i = 0; ; i++) {
+        snprintf(path, sizeof(path),
+                 PLACEMENT_SYSFS "/cpu/cpu%d/cache/index%d/level", cpu, i);
+        if (read_sysfs(path, buf, sizeof(buf)) < 0)
+            break;
+
+        int level = atoi(buf);
+        if (level < best)
+            continue;
+
+        snprintf(path, sizeof(path),
+                 PLACEMENT_SYSFS "/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+        if (read_list(path, set) == 0)
+            best = level;
+    }
+    return best < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Читает топологию; вызывается один раз на процесс через pthread_once()
+ */
+static void read_topology(void)
+{
+    char path[256];
+    cpu_set_t set;
+
+    if (read_list(PLACEMENT_SYSFS "/cpu/online", &topo.online) < 0) {
+        topo.error = fail("Failed to read online CPUs: %m\n");
+        return;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        topo.core[cpu] = topo.llc[cpu] = -1;
+        topo.node[cpu] = 0;
+        if (!CPU_ISSET(cpu, &topo.online))
+            continue;
+        topo.ncpus = cpu + 1;
+
+        snprintf(path, sizeof(path),
+                 PLACEMENT_SYSFS "/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        topo.core[cpu] = read_list(path, &set) == 0 ? first_cpu(&set) : cpu;
+
+        // Без сведений о кэше (часть виртуальных машин) все CPU — один домен
+        if (read_llc(cpu, &set) < 0)
+            set = topo.online;
+        CPU_AND(&set, &set, &topo.online);
+
+        int i;
+        for (i = 0; i < topo.nllc; i++)
+            if (CPU_ISSET(cpu, &topo.llc_cpus[i]))
+                break;
+        if (i == topo.nllc) {
+            if (topo.nllc == PLACEMENT_LLC_MAX) {
+                errno = E2BIG;
+                topo.error = fail("Too many LLC domains\n");
+                return;
+            }
+            topo.llc_cpus[topo.nllc++] = set;
+        }
+        topo.llc[cpu] = i;
+    }
+
+    // Узлы NUMA; без sysfs node все CPU относятся к узлу 0
+    cpu_set_t nodes;
+    if (read_list(PLACEMENT_SYSFS "/node/online", &nodes) == 0) {
+        for (int n = 0; n < CPU_SETSIZE; n++) {
+            if (!CPU_ISSET(n, &nodes))
+                continue;
+            snprintf(path, sizeof(path), PLACEMENT_SYSFS "/node/node%d/cpulist", n);
+            if (read_list(path, &set) < 0)
+                continue;
+            for (int cpu = 0; cpu < topo.ncpus; cpu++)
+                if (CPU_ISSET(cpu, &set))
+                    topo.node[cpu] = n;
+        }
+    }
+}
+
+static int load_topology(void)
+{
+    pthread_once(&topo_once, read_topology);
+    return topo.error;
+}
+
+/**
+ * @brief Открывает и блокирует разделяемое состояние размещения
+ *
+ * @param fd Указатель для дескриптора (блокировка снимается при закрытии)
+ * @return Отображённое состояние или NULL (errno сохраняется)
+ */
+static struct placement_state *state_open(int *fd)
+{
+    *fd = open(PLACEMENT_STATE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (*fd < 0) {
+        fail("Failed to open %s: %m\n", PLACEMENT_STATE);
+        return NULL;
+    }
+
+    struct placement_state *st = MAP_FAILED;
+    if (flock(*fd, LOCK_EX))
+        fail("Failed to lock %s: %m\n", PLACEMENT_STATE);
+    else if (ftruncate(*fd, sizeof(struct placement_state)))
+        fail("Failed to resize %s: %m\n", PLACEMENT_STATE);
+    else if ((st = mmap(NULL, sizeof(*st), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, *fd, 0)) == MAP_FAILED)
+        fail("Failed to map %s: %m\n", PLACEMENT_STATE);
+
+    if (st == MAP_FAILED) {
+        int err = errno;
+        close(*fd);
+        errno = err;
+        return NULL;
+    }
+
+    // Новый файл или другая топология (CPU hotplug): начинаем заново
+    if (st->magic != PLACEMENT_MAGIC || st->ncpus != (uint32_t) topo.ncpus) {
+        memset(st, 0, sizeof(*st));
+        st->magic = PLACEMENT_MAGIC;
+        st->ncpus = topo.ncpus;
+    }
+    return st;
+}
+
+static void state_close(struct placement_state *st, int fd)
+{
+    munmap(st, sizeof(*st));
+    close(fd);
+}
+
+/**
+ * @brief Снимает все записи экземпляра
+ */
+static void forget(struct placement_state *st, int id)
+{
+    for (int cpu = 0; cpu < topo.ncpus; cpu++)
+        if (st->owner[cpu] == id + 1)
+            st->owner[cpu] = 0;
+
+    if (st->shared_llc[id]) {
+        int llc = st->shared_llc[id] - 1;
+        if (llc < topo.nllc && st->shared_load[llc])
+            st->shared_load[llc]--;
+        st->shared_llc[id] = 0;
+    }
+}
+
+/**
+ * @brief Освобождает записи экземпляров, завершившихся без placement_release()
+ *
+ * @return Число освобождённых экземпляров
+ */
+static int purge(struct placement_state *st)
+{
+    int purged = 0;
+
+    for (int cpu = 0; cpu < topo.ncpus; cpu++) {
+        int id = st->owner[cpu] - 1;
+        if (id >= 0 && !instance_running(id)) {
+            forget(st, id);
+            purged++;
+        }
+    }
+    for (int id = 0; id < INSTANCE_MAX; id++) {
+        if (st->shared_llc[id] && !instance_running(id)) {
+            forget(st, id);
+            purged++;
+        }
+    }
+    return purged;
+}
+
+/**
+ * @brief CPU физических ядер домена, у которых все SMT-соседи свободны
+ */
+static void free_cores(const struct placement_state *st, int llc, cpu_set_t *set)
+{
+    cpu_set_t busy;
+
+    // Ядро с хотя бы одним занятым соседом не выдаётся
+    CPU_ZERO(&busy);
+    for (int cpu = 0; cpu < topo.ncpus; cpu++)
+        if (topo.llc[cpu] == llc && st->owner[cpu])
+            CPU_SET(topo.core[cpu], &busy);
+
+    CPU_ZERO(set);
+    for (int cpu = 0; cpu < topo.ncpus; cpu++)
+        if (topo.llc[cpu] == llc && !CPU_ISSET(topo.core[cpu], &busy))
+            CPU_SET(cpu, set);
+}
+
+/**
+ * @brief Выбирает домен LLC для исключительного среза
+ *
+ * Домены с общими экземплярами пропускаются: их cpuset охватывает весь
+ * домен и не сужается, поэтому они работали бы и на "исключительных" ядрах.
+ * Среди остальных pack выбирает домен с наименьшим подходящим числом
+ * свободных CPU, spread — с наибольшим.
+ *
+ * @return Индекс домена или -1, если ни в одном домене нет need свободных CPU
+ */
+static int pick_exclusive(const struct placement_state *st,
+                          enum placement_policy policy, int need)
+{
+    int best = -1, best_free = 0;
+
+    for (int llc = 0; llc < topo.nllc; llc++) {
+        cpu_set_t set;
+        free_cores(st, llc, &set);
+        int nfree = CPU_COUNT(&set);
+        if (nfree < need || st->shared_load[llc])
+            continue;
+
+        int better = best < 0 || (policy == PLACEMENT_PACK ?
+                                  nfree < best_free : nfree > best_free);
+        if (better) {
+            best = llc;
+            best_free = nfree;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Занимает целые ядра: сначала из домена first, затем из остальных
+ *        доменов без общих экземпляров
+ *
+ * @return Число занятых CPU
+ */
+static int take_cores(struct placement_state *st, int id, int first,
+                      int need, cpu_set_t *out)
+{
+    int taken = 0;
+
+    for (int n = 0; n < topo.nllc && taken < need; n++) {
+        int llc = (first + n) % topo.nllc;
+        cpu_set_t set;
+        if (st->shared_load[llc])
+            continue;
+        free_cores(st, llc, &set);
+
+        for (int cpu = 0; cpu < topo.ncpus && taken < need; cpu++) {
+            if (!CPU_ISSET(cpu, &set) || topo.core[cpu] != cpu)
+                continue;
+            // Ядро целиком, вместе с SMT-соседями
+            for (int sib = 0; sib < topo.ncpus; sib++) {
+                if (topo.core[sib] == cpu && CPU_ISSET(sib, &set)) {
+                    st->owner[sib] = id + 1;
+                    CPU_SET(sib, out);
+                    taken++;
+                }
+            }
+        }
+    }
+    return taken;
+}
+
+/**
+ * @brief Свободные от исключительных срезов CPU домена
+ */
+static void shared_cpus(const struct placement_state *st, int llc, cpu_set_t *set)
+{
+    *set = topo.llc_cpus[llc];
+    for (int cpu = 0; cpu < topo.ncpus; cpu++)
+        if (st->owner[cpu])
+            CPU_CLR(cpu, set);
+}
+
+/**
+ * @brief Выбирает домен LLC для общего среза
+ *
+ * Вместимость домена — число его CPU, свободных от исключительных срезов.
+ * pack выбирает самый загруженный домен, где есть место, spread — наименее
+ * загруженный. При overcommit != 0 вместимость не учитывается.
+ *
+ * @return Индекс домена или -1
+ */
+static int pick_shared(const struct placement_state *st,
+                       enum placement_policy policy, int overcommit)
+{
+    int best = -1;
+    double best_ratio = 0;
+
+    for (int llc = 0; llc < topo.nllc; llc++) {
+        cpu_set_t set;
+        shared_cpus(st, llc, &set);
+        int cap = CPU_COUNT(&set);
+        int load = st->shared_load[llc];
+        if (cap == 0 || (!overcommit && load >= cap))
+            continue;
+
+        double ratio = (double) load / cap;
+        int better = best < 0 || (policy == PLACEMENT_PACK && !overcommit ?
+                                  ratio > best_ratio : ratio < best_ratio);
+        if (better) {
+            best = llc;
+            best_ratio = ratio;
+        }
+    }
+    return best;
+}
+
+int placement_assign(int id, const struct placement_opts *opts,
+                     char *cpus, char *mems, size_t len)
+{
+    cpu_set_t set, nodes;
+    int fd;
+
+    int err = load_topology();
+    if (err)
+        return err;
+
+    struct placement_state *st = state_open(&fd);
+    if (st == NULL)
+        return -errno;
+
+    // Записи прежнего владельца номера, завершившегося аварийно
+    forget(st, id);
+    CPU_ZERO(&set);
+
+    if (opts->exclusive) {
+        int need = opts->cpus > 0 ? opts->cpus : 1;
+        int llc = pick_exclusive(st, opts->policy, need);
+        if (llc < 0 && purge(st))
+            llc = pick_exclusive(st, opts->policy, need);
+
+        // Ни один домен не вмещает срез целиком: добираем ядра из соседних
+        if (take_cores(st, id, llc < 0 ? 0 : llc, need, &set) < need) {
+            forget(st, id);
+            state_close(st, fd);
+            errno = EBUSY;
+            return fail("Not enough free CPUs outside LLC domains with shared "
+                        "instances for %d exclusive CPUs\n", need);
+        }
+    } else {
+        int llc = pick_shared(st, opts->policy, 0);
+        if (llc < 0 && purge(st))
+            llc = pick_shared(st, opts->policy, 0);
+        if (llc < 0)
+            llc = pick_shared(st, opts->policy, 1);
+        if (llc < 0) {
+            state_close(st, fd);
+            errno = EBUSY;
+            return fail("No CPUs left for shared placement\n");
+        }
+
+        shared_cpus(st, llc, &set);
+        st->shared_llc[id] = llc + 1;
+        st->shared_load[llc]++;
+    }
+
+    state_close(st, fd);
+
+    CPU_ZERO(&nodes);
+    for (int cpu = 0; cpu < topo.ncpus; cpu++)
+        if (CPU_ISSET(cpu, &set))
+            CPU_SET(topo.node[cpu], &nodes);
+
+    if ((err = format_list(&set, cpus, len)) ||
+        (err = format_list(&nodes, mems, len))) {
+        placement_release(id);
+        return err;
+    }
+    return 0;
+}
+
+void placement_release(int id)
+{
+    int fd;
+
+    if (load_topology())
+        return;
+
+    struct placement_state *st = state_open(&fd);
+    if (st == NULL)
+        return;
+    forget(st, id);
+    state_close(st, fd);
+}
+
+enum placement_policy placement_policy_parse(const char *name)
+{
+    if (!strcmp(name, "pack"))
+        return PLACEMENT_PACK;
+    if (!strcmp(name, "spread"))
+        return PLACEMENT_SPREAD;
+
+    die("Unknown placement policy %s\n", name);
+    return PLACEMENT_NONE;
+}
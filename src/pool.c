@@ -0,0 +1,557 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "../include/util.h"
+#include "../include/sandbox.h"
+#include "../include/pool.h"
+#include "../include/trace.h"
+#include "../include/timing.h"
+#include "../include/supervisor.h"
+
+/**
+ * @brief Состояние задания в демоне пула
+ */
+enum job_state {
+    JOB_FREE = 0,   /**< Слот свободен */
+    JOB_PENDING,    /**< Клиент подключился, задание ещё не получено */
+    JOB_STARTING,   /**< Задание передано песочнице, ждём execvp() */
+    JOB_RUNNING,    /**< Команда запущена, песочница под супервизором */
+};
+
+/**
+ * @brief Задание клиента и песочница, в которой оно выполняется
+ */
+struct job {
+    enum job_state state;
+    int client;                 /**< Соединение с клиентом */
+    int hit;                    /**< Песочница взята из пула */
+    struct sandbox sb;          /**< Песочница задания */
+    struct timespec claimed;    /**< Момент передачи задания песочнице */
+    struct supervisor_watch watch;  /**< Наблюдение за запущенной командой */
+};
+
+/**
+ * @brief Состояние демона пула
+ */
+struct pool {
+    const struct sandbox_opts *opts;    /**< Параметры создаваемых песочниц */
+    const struct supervisor_limits *limits;  /**< Ограничения запущенных заданий */
+    struct supervisor sv;               /**< Супервизор запущенных заданий */
+    int size;                           /**< Целевое число "тёплых" песочниц */
+    int nparked;                        /**< Текущее число "тёплых" песочниц */
+    struct sandbox parked[POOL_MAX];    /**< "Тёплые" песочницы */
+    struct job jobs[POOL_JOBS_MAX];     /**< Задания */
+
+    unsigned long hits;                 /**< Задания, получившие готовую песочницу */
+    unsigned long misses;               /**< Задания, для которых песочница создавалась */
+    unsigned long execs;                /**< Число измеренных запусков */
+    uint64_t refill_at_us;              /**< Не пополнять пул раньше этого момента */
+    uint64_t refill_backoff_ms;         /**< Пауза после следующей неудачи пополнения */
+    uint64_t lat_sum_us;                /**< Сумма задержек claim → exec */
+    uint64_t lat_max_us;                /**< Максимальная задержка claim → exec */
+};
+
+static uint64_t elapsed_us(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000ULL +
+           (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+static void print_stats(struct pool *pool)
+{
+    fprintf(stderr,
+            "pool: size=%d parked=%d hits=%lu misses=%lu "
+            "claim_to_exec_us avg=%llu max=%llu\n",
+            pool->size, pool->nparked, pool->hits, pool->misses,
+            (unsigned long long) (pool->execs ?
+                                  pool->lat_sum_us / pool->execs : 0),
+            (unsigned long long) pool->lat_max_us);
+}
+
+static void reply(struct job *job, int error, int status)
+{
+    struct pool_reply r = { .error = error, .status = status };
+
+    // Клиент мог отключиться: ответ не обязателен
+    send(job->client, &r, sizeof(r), MSG_NOSIGNAL);
+    close(job->client);
+
+    if (job->sb.ctl >= 0)
+        close(job->sb.ctl);
+
+    memset(job, 0, sizeof(*job));
+}
+
+/**
+ * @brief Создаёт песочницу для пула: без pidfd демон не может следить за ней
+ *
+ * @return 0 или -errno
+ */
+static int spawn(struct pool *pool, struct sandbox *sb)
+{
+    int err = sandbox_create(sb, pool->opts, NULL);
+    if (err)
+        return err;
+    if (sb->pidfd < 0)
+        die("Pool mode requires pidfd support\n");
+    return 0;
+}
+
+/**
+ * @brief Закрывает все дескрипторы, полученные в сообщении через SCM_RIGHTS
+ */
+static void close_rights(struct msghdr *msg)
+{
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < n; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(fd));
+            close(fd);
+        }
+    }
+}
+
+/**
+ * @brief Получает задание клиента и передаёт его готовой или новой песочнице
+ */
+static void claim(struct pool *pool, struct job *job)
+{
+    char buf[SANDBOX_JOB_MAX];
+    int stdio[3];
+    char cbuf[CMSG_SPACE(sizeof(stdio))];
+
+    struct iovec iov = {
+            .iov_base = buf,
+            .iov_len = sizeof(buf)
+    };
+    struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = cbuf,
+            .msg_controllen = sizeof(cbuf)
+    };
+
+    ssize_t len = recvmsg(job->client, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cmsg = len > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+
+    // Усечённое задание или сообщение с лишними данными отбрасывается
+    // целиком, полученные с ним дескрипторы закрываются
+    if (len <= 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+        !cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(stdio)) ||
+        CMSG_NXTHDR(&msg, cmsg)) {
+        fprintf(stderr, "pool: dropping malformed job\n");
+        if (len > 0)
+            close_rights(&msg);
+        job->sb.ctl = -1;
+        reply(job, EINVAL, 0);
+        return;
+    }
+    memcpy(stdio, CMSG_DATA(cmsg), sizeof(stdio));
+
+    clock_gettime(CLOCK_MONOTONIC, &job->claimed);
+
+    if (pool->nparked > 0) {
+        job->sb = pool->parked[--pool->nparked];
+        job->hit = 1;
+        pool->hits++;
+    } else {
+        int err = spawn(pool, &job->sb);
+        if (err) {
+            for (int i = 0; i < 3; i++)
+                close(stdio[i]);
+            job->sb.ctl = -1;
+            reply(job, -err, 0);
+            return;
+        }
+        job->hit = 0;
+        pool->misses++;
+    }
+
+    int err = sandbox_send_job(&job->sb, buf, len, stdio);
+    for (int i = 0; i < 3; i++)
+        close(stdio[i]);
+
+    if (err) {
+        // Без задания песочница завершается сама, получив EOF
+        close(job->sb.ctl);
+        job->sb.ctl = -1;
+        sandbox_wait(&job->sb);
+        reply(job, -err, 0);
+        return;
+    }
+
+    job->state = JOB_STARTING;
+}
+
+/**
+ * @brief Обрабатывает EOF или errno на управляющем сокете запускаемого задания
+ */
+static void exec_done(struct pool *pool, struct job *job)
+{
+    int err = sandbox_await_exec(&job->sb);
+    uint64_t lat = elapsed_us(&job->claimed);
+
+    if (err) {
+        fprintf(stderr, "pool: sandbox %d failed to exec: %s\n",
+                job->sb.id, strerror(-err));
+        // Процесс песочницы завершается сразу после отправки errno
+        sandbox_wait(&job->sb);
+        reply(job, -err, 0);
+        return;
+    }
+
+    pool->execs++;
+    pool->lat_sum_us += lat;
+    if (lat > pool->lat_max_us)
+        pool->lat_max_us = lat;
+
+    fprintf(stderr, "pool: job pid=%d id=%d %s claim_to_exec_us=%llu\n",
+            job->sb.pid, job->sb.id, job->hit ? "hit" : "miss",
+            (unsigned long long) lat);
+
+    err = supervisor_add(&pool->sv, &job->watch, &job->sb, pool->limits, job);
+    if (err) {
+        // Без супервизора задание работало бы без лимитов: завершаем только его
+        fprintf(stderr, "pool: cannot supervise sandbox %d, killing\n",
+                job->sb.id);
+        syscall(SYS_pidfd_send_signal, job->sb.pidfd, SIGKILL, NULL, 0);
+        sandbox_wait(&job->sb);
+        reply(job, -err, 0);
+        return;
+    }
+    job->state = JOB_RUNNING;
+}
+
+/**
+ * @brief Отвечает клиенту задания, наблюдение за которым завершил супервизор
+ */
+static void job_exited(struct job *job)
+{
+    int status = job->watch.status;
+
+    fputs("pool: usage ", stderr);
+    sandbox_write_report(stderr, &job->sb, status);
+
+    reply(job, 0, status);
+}
+
+/**
+ * @brief Завершает все песочницы пула и заданий при остановке демона
+ *
+ * Без этого процессы завершились бы по PR_SET_PDEATHSIG, но cgroup
+ * экземпляров, их номера и CPU остались бы занятыми.
+ */
+static void release_all(struct pool *pool)
+{
+    // Получив EOF вместо задания, "тёплая" песочница завершается сама
+    for (int i = 0; i < pool->nparked; i++) {
+        close(pool->parked[i].ctl);
+        sandbox_wait(&pool->parked[i]);
+    }
+    pool->nparked = 0;
+
+    for (int i = 0; i < POOL_JOBS_MAX; i++) {
+        struct job *job = &pool->jobs[i];
+
+        if (job->state != JOB_STARTING && job->state != JOB_RUNNING)
+            continue;
+        syscall(SYS_pidfd_send_signal, job->sb.pidfd, SIGKILL, NULL, 0);
+        sandbox_wait(&job->sb);
+        reply(job, 0, W_EXITCODE(0, SIGKILL));
+    }
+}
+
+/**
+ * @brief Удаляет из пула "тёплую" песочницу, процесс которой завершился
+ */
+static void parked_died(struct pool *pool, int i)
+{
+    fprintf(stderr, "pool: parked sandbox %d died\n", pool->parked[i].id);
+    sandbox_wait(&pool->parked[i]);
+    close(pool->parked[i].ctl);
+    pool->parked[i] = pool->parked[--pool->nparked];
+}
+
+/**
+ * @brief Добавляет в пул одну "тёплую" песочницу. Неудача (например,
+ *        исчерпаны номера экземпляров или память) не останавливает демон:
+ *        следующая попытка откладывается, пауза удваивается до
+ *        POOL_REFILL_BACKOFF_MAX_MS
+ */
+static void refill(struct pool *pool)
+{
+    if (spawn(pool, &pool->parked[pool->nparked]) == 0) {
+        pool->nparked++;
+        pool->refill_backoff_ms = 0;
+        return;
+    }
+
+    if (pool->refill_backoff_ms == 0)
+        pool->refill_backoff_ms = POOL_REFILL_BACKOFF_MS;
+    fprintf(stderr, "pool: failed to refill, retrying in %llu ms\n",
+            (unsigned long long) pool->refill_backoff_ms);
+    pool->refill_at_us = timing_now_us() + pool->refill_backoff_ms * 1000;
+    pool->refill_backoff_ms *= 2;
+    if (pool->refill_backoff_ms > POOL_REFILL_BACKOFF_MAX_MS)
+        pool->refill_backoff_ms = POOL_REFILL_BACKOFF_MAX_MS;
+}
+
+static int listen_socket(const char *sock_path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(sock_path) >= sizeof(addr.sun_path))
+        die("Socket path too long: %s\n", sock_path);
+    strcpy(addr.sun_path, sock_path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        die("cannot open socket: %m\n");
+
+    unlink(sock_path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)))
+        die("Failed to bind %s: %m\n", sock_path);
+    if (listen(fd, SOMAXCONN))
+        die("Failed to listen on %s: %m\n", sock_path);
+
+    return fd;
+}
+
+void pool_serve(const char *sock_path, int size,
+                const struct sandbox_opts *opts,
+                const struct supervisor_limits *limits)
+{
+    static struct pool pool;
+    struct pollfd pfd[3 + POOL_MAX + POOL_JOBS_MAX];
+    struct job *pjob[3 + POOL_MAX + POOL_JOBS_MAX];
+    int pidx[3 + POOL_MAX + POOL_JOBS_MAX];
+    struct supervisor_watch *done[SUPERVISOR_EVENTS_MAX];
+
+    if (size < 1 || size > POOL_MAX)
+        die("Pool size must be in 1..%d\n", POOL_MAX);
+
+    pool.size = size;
+    pool.opts = opts;
+    pool.limits = limits;
+    supervisor_init(&pool.sv);
+
+    // Завершение процессов отслеживается через pidfd, сигналы — через signalfd
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL))
+        die("Failed to block signals: %m\n");
+
+    int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sig_fd < 0)
+        die("Failed to create signalfd: %m\n");
+
+    int listen_fd = listen_socket(sock_path);
+    fprintf(stderr, "pool: serving %d sandboxes on %s\n", size, sock_path);
+
+    for (;;) {
+        int nfds = 0;
+
+        pfd[nfds] = (struct pollfd) { .fd = listen_fd, .events = POLLIN };
+        pjob[nfds++] = NULL;
+        pfd[nfds] = (struct pollfd) { .fd = sig_fd, .events = POLLIN };
+        pjob[nfds++] = NULL;
+        // Запущенные задания ждут в epoll супервизора
+        pfd[nfds] = (struct pollfd) { .fd = pool.sv.epfd, .events = POLLIN };
+        pjob[nfds++] = NULL;
+
+        int busy = 0;
+        for (int i = 0; i < POOL_JOBS_MAX; i++) {
+            struct job *job = &pool.jobs[i];
+            if (job->state == JOB_PENDING)
+                pfd[nfds].fd = job->client;
+            else if (job->state == JOB_STARTING)
+                pfd[nfds].fd = job->sb.ctl;
+            else
+                continue;
+            busy++;
+            pfd[nfds].events = POLLIN;
+            pfd[nfds].revents = 0;
+            pjob[nfds++] = job;
+        }
+
+        // pidfd "тёплых" песочниц: процесс мог завершиться до получения задания
+        int nparked_fds = 0;
+        for (int i = 0; i < pool.nparked; i++) {
+            pfd[nfds] = (struct pollfd) {
+                    .fd = pool.parked[i].pidfd, .events = POLLIN };
+            pjob[nfds] = NULL;
+            pidx[nfds++] = i;
+            nparked_fds++;
+        }
+
+        // Пока пул не заполнен, не блокируемся: пополняем его между заданиями.
+        // Пополнение откладывается, пока есть задания в обработке,
+        // чтобы не задерживать их запуск, и после неудачи пополнения
+        int timeout = -1;
+        if (pool.nparked < pool.size && !busy) {
+            uint64_t now = timing_now_us();
+            timeout = now >= pool.refill_at_us ? 0 :
+                      (int) ((pool.refill_at_us - now + 999) / 1000);
+        }
+
+        int ready = poll(pfd, nfds, timeout);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            die("poll failed: %m\n");
+        }
+
+        if (ready == 0) {
+            refill(&pool);
+            continue;
+        }
+
+        // Удаляем завершившиеся "тёплые" песочницы с конца, чтобы индексы
+        // оставшихся не сдвигались
+        for (int i = nfds - 1; i >= nfds - nparked_fds; i--)
+            if (pfd[i].revents)
+                parked_died(&pool, pidx[i]);
+        nfds -= nparked_fds;
+
+        for (int i = 3; i < nfds; i++) {
+            struct job *job = pjob[i];
+            if (!pfd[i].revents || job->state == JOB_FREE)
+                continue;
+            if (job->state == JOB_PENDING)
+                claim(&pool, job);
+            else if (job->state == JOB_STARTING)
+                exec_done(&pool, job);
+        }
+
+        if (pfd[2].revents & POLLIN) {
+            int ndone = supervisor_dispatch(&pool.sv, 0, done,
+                                            SUPERVISOR_EVENTS_MAX);
+            for (int i = 0; i < ndone; i++)
+                job_exited(done[i]->data);
+        }
+
+        if (pfd[1].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+                print_stats(&pool);
+                if (si.ssi_signo != SIGUSR1) {
+                    unlink(sock_path);
+                    release_all(&pool);
+                    trace_close();
+                    exit(0);
+                }
+            }
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client < 0) {
+                fprintf(stderr, "pool: accept failed: %m\n");
+                continue;
+            }
+
+            struct job *job = NULL;
+            for (int i = 0; i < POOL_JOBS_MAX && !job; i++)
+                if (pool.jobs[i].state == JOB_FREE)
+                    job = &pool.jobs[i];
+
+            if (!job) {
+                struct pool_reply r = { .error = EAGAIN };
+                send(client, &r, sizeof(r), MSG_NOSIGNAL);
+                close(client);
+                continue;
+            }
+
+            job->state = JOB_PENDING;
+            job->client = client;
+            job->sb.ctl = -1;
+        }
+    }
+}
+
+int pool_submit(const char *sock_path, char **argv)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char buf[SANDBOX_JOB_MAX];
+    size_t len = 0;
+
+    if (strlen(sock_path) >= sizeof(addr.sun_path))
+        die("Socket path too long: %s\n", sock_path);
+    strcpy(addr.sun_path, sock_path);
+
+    // argv передаётся как последовательность строк с завершающим '\0'
+    for (char **arg = argv; *arg; arg++) {
+        size_t n = strlen(*arg) + 1;
+        if (len + n > sizeof(buf))
+            die("Command line too long\n");
+        memcpy(buf + len, *arg, n);
+        len += n;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        die("cannot open socket: %m\n");
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+        die("Failed to connect to %s: %m\n", sock_path);
+
+    int stdio[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char cbuf[CMSG_SPACE(sizeof(stdio))];
+    memset(cbuf, 0, sizeof(cbuf));
+
+    struct iovec iov = {
+            .iov_base = buf,
+            .iov_len = len
+    };
+    struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = cbuf,
+            .msg_controllen = sizeof(cbuf)
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(stdio));
+    memcpy(CMSG_DATA(cmsg), stdio, sizeof(stdio));
+
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0)
+        die("Failed to send job: %m\n");
+
+    struct pool_reply r;
+    if (recv(fd, &r, sizeof(r), 0) != sizeof(r))
+        die("No reply from pool daemon\n");
+    close(fd);
+
+    if (r.error) {
+        errno = r.error;
+        fprintf(stderr, "Failed to run %s: %m\n", argv[0]);
+        return 127;
+    }
+
+    if (WIFSIGNALED(r.status))
+        return 128 + WTERMSIG(r.status);
+    return WEXITSTATUS(r.status);
+}
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include "../include/util.h"
+#include "../include/cgroup_control.h"
+#include "../include/profile.h"
+
+/**
+ * @struct profile_params
+ * @brief Значения файлов cgroup и политика планировщика профиля.
+ */
+struct profile_params {
+    const char *name;       /**< Имя для опции --profile и отчётов */
+    const char *weight;     /**< cpu.weight или NULL (не менять) */
+    int idle;               /**< Записать 1 в cpu.idle */
+    const char *uclamp_min; /**< cpu.uclamp.min, процент */
+    const char *uclamp_max; /**< cpu.uclamp.max, процент или "max" */
+    const char *cpu_max;    /**< cpu.max вместо квоты по умолчанию или NULL */
+    int policy;             /**< Политика планировщика процессов песочницы */
+};
+
+static const struct profile_params profiles[] = {
+        [PROFILE_NONE] = { "none", NULL, 0, NULL, NULL, NULL, SCHED_OTHER },
+        [PROFILE_LATENCY] = { "latency-critical", "1000", 0, "50", "max", "max",
+                              SCHED_OTHER },
+        [PROFILE_NORMAL] = { "normal", "100", 0, "0", "max", NULL, SCHED_OTHER },
+        [PROFILE_BATCH] = { "batch", "20", 0, "0", "50", NULL, SCHED_BATCH },
+        // Вес idle-группы не задаётся: ядро отвергает запись cpu.weight
+        [PROFILE_IDLE] = { "idle", NULL, 1, "0", "20", NULL, SCHED_IDLE },
+};
+
+/**
+ * @brief Проверяет, что ядро поддерживает файл cgroup; об отсутствии
+ *        предупреждает один раз на процесс
+ */
+static int supported(int cgroup_fd, const char *file, int *warned)
+{
+    if (faccessat(cgroup_fd, file, F_OK, 0) == 0)
+        return 1;
+    if (!__atomic_exchange_n(warned, 1, __ATOMIC_RELAXED))
+        fprintf(stderr, "%s is not supported, profiles are applied "
+                        "without it\n", file);
+    return 0;
+}
+
+int profile_apply_cgroup(enum profile p, int cgroup_fd)
+{
+    static int no_idle, no_uclamp;
+    const struct profile_params *pp = &profiles[p];
+    int err;
+
+    if (p == PROFILE_NONE)
+        return 0;
+
+    if (pp->cpu_max && (err = cgroup_set_cpu_limit(cgroup_fd, pp->cpu_max)))
+        return err;
+    if (pp->weight && (err = cgroup_set_cpu_weight(cgroup_fd, pp->weight)))
+        return err;
+    if (pp->idle && supported(cgroup_fd, "cpu.idle", &no_idle) &&
+        (err = cgroup_set_cpu_idle(cgroup_fd, 1)))
+        return err;
+    if (supported(cgroup_fd, "cpu.uclamp.min", &no_uclamp) &&
+        (err = cgroup_set_uclamp(cgroup_fd, pp->uclamp_min, pp->uclamp_max)))
+        return err;
+    return 0;
+}
+
+int profile_apply_sched(enum profile p)
+{
+    struct sched_param param = { .sched_priority = 0 };
+
+    if (profiles[p].policy == SCHED_OTHER)
+        return 0;
+    if (sched_setscheduler(0, profiles[p].policy, &param))
+        return fail("Failed to set %s scheduling policy: %m\n",
+                    profiles[p].name);
+    return 0;
+}
+
+const char *profile_name(enum profile p)
+{
+    return profiles[p].name;
+}
+
+enum profile profile_parse(const char *name)
+{
+    for (size_t i = PROFILE_LATENCY; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+        if (!strcmp(name, profiles[i].name))
+            return i;
+
+    die("Unknown profile %s\n", name);
+    return PROFILE_NONE;
+}
@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../include/util.h"
+#include "../include/cgroup_control.h"
+#include "../include/timing.h"
+#include "../include/psi.h"
+
+static void apply_memory(int cgroup_fd, long long bytes)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", bytes);
+    cgroup_set_memory_high(cgroup_fd, buf);
+}
+
+static void apply_cpu(int cgroup_fd, long long pct)
+{
+    // Период cpu.max 100 мс: 1% одного CPU — 1000 мкс квоты
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld 100000", pct * 1000);
+    cgroup_set_cpu_limit(cgroup_fd, buf);
+}
+
+/**
+ * @brief Разбирает размер с необязательным суффиксом K, M или G
+ */
+static long long parse_size(const char *s, char **end)
+{
+    long long v = strtoll(s, end, 10);
+
+    switch (**end) {
+        case 'G': case 'g': v <<= 10; /* fallthrough */
+        case 'M': case 'm': v <<= 10; /* fallthrough */
+        case 'K': case 'k': v <<= 10; (*end)++;
+        default: break;
+    }
+    return v;
+}
+
+void psi_parse_memory(const char *arg, struct psi_bounds *b)
+{
+    char *end;
+
+    b->mem_min = parse_size(arg, &end);
+    if (*end != ':')
+        die("Invalid memory bounds %s, expected MIN:MAX\n", arg);
+    b->mem_max = parse_size(end + 1, &end);
+
+    if (*end != '\0' || b->mem_min <= 0 || b->mem_max < b->mem_min)
+        die("Invalid memory bounds %s\n", arg);
+}
+
+void psi_parse_cpu(const char *arg, struct psi_bounds *b)
+{
+    if (sscanf(arg, "%d:%d", &b->cpu_min, &b->cpu_max) != 2 ||
+        b->cpu_min <= 0 || b->cpu_max < b->cpu_min)
+        die("Invalid CPU bounds %s, expected MIN:MAX in percent\n", arg);
+}
+
+/**
+ * @brief Регистрирует триггер PSI: событие POLLPRI, если простой "some"
+ *        за окно PSI_WINDOW_US превысил PSI_THRESHOLD_US
+ *
+ * @return Дескриптор или -errno
+ */
+static int open_trigger(int cgroup_fd, const char *file)
+{
+    char trigger[64];
+
+    int fd = openat(cgroup_fd, file, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return fail("Failed to open %s: %m\n", file);
+
+    snprintf(trigger, sizeof(trigger), "some %d %d",
+             PSI_THRESHOLD_US, PSI_WINDOW_US);
+    if (write(fd, trigger, strlen(trigger) + 1) < 0) {
+        int err = fail("Failed to register PSI trigger on %s: %m\n", file);
+        close(fd);
+        return err;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Читает суммарное время простоя "some" из файла PSI, мкс
+ *
+ * @return 0 или -errno
+ */
+static int some_total(int cgroup_fd, const char *file, uint64_t *value)
+{
+    char buf[256];
+
+    if (cgroup_read_file(cgroup_fd, file, buf, sizeof(buf)) < 0)
+        return fail("Failed to read %s: %m\n", file);
+
+    char *total = strstr(buf, "total=");
+    *value = total ? strtoull(total + 6, NULL, 10) : 0;
+    return 0;
+}
+
+/**
+ * @brief Сдвигает лимит на шаг в пределах границ и пишет изменение в журнал
+ *
+ * @param dir +1 — поднять лимит, -1 — снизить
+ * @param reason Причина: trigger, pressure или calm
+ * @param stall Доля простоя за период, % (отрицательная — неизвестна)
+ */
+static void adjust(struct psi *p, struct psi_resource *r, int dir,
+                   const char *reason, double stall)
+{
+    long long v = dir > 0 ? r->value + r->up : r->value - r->down;
+    if (v > r->max)
+        v = r->max;
+    if (v < r->min)
+        v = r->min;
+    if (v == r->value)
+        return;
+
+    fprintf(stderr, "psi: id=%d %s %lld%s -> %lld%s reason=%s",
+            p->id, r->name, r->value, r->unit, v, r->unit, reason);
+    if (stall >= 0)
+        fprintf(stderr, " stall=%.1f%%", stall);
+    fputc('\n', stderr);
+
+    r->value = v;
+    r->apply(p->cgroup, v);
+}
+
+/**
+ * @return 0 или -errno
+ */
+static int init_resource(struct psi *p, struct psi_resource *r)
+{
+    // Повышение — крупным шагом, снижение — мелким: нехватка дороже излишка
+    r->up = (r->max - r->min) / 4;
+    r->down = (r->max - r->min) / 16;
+    if (r->up < 1)
+        r->up = 1;
+    if (r->down < 1)
+        r->down = 1;
+
+    r->value = r->max;
+    r->apply(p->cgroup, r->value);
+    r->fd = open_trigger(p->cgroup, r->pressure);
+    if (r->fd < 0)
+        return r->fd;
+    // Ресурс считается подключённым с открытым триггером: его закроет
+    // psi_detach()
+    p->n++;
+
+    int err = some_total(p->cgroup, r->pressure, &r->total);
+    if (err)
+        return err;
+
+    fprintf(stderr, "psi: id=%d %s start=%lld%s bounds=%lld%s..%lld%s\n",
+            p->id, r->name, r->value, r->unit, r->min, r->unit, r->max, r->unit);
+    return 0;
+}
+
+int psi_attach(struct psi *p, int cgroup_fd, int id, const struct psi_bounds *b)
+{
+    int err;
+
+    memset(p, 0, sizeof(*p));
+    p->cgroup = cgroup_fd;
+    p->id = id;
+
+    if (b->mem_max > 0) {
+        struct psi_resource *r = &p->res[p->n];
+
+        // memory.max остаётся жёстким пределом на верхней границе
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%lld", b->mem_max);
+        cgroup_set_memory_limit(cgroup_fd, buf);
+
+        r->name = "memory.high";
+        r->pressure = "memory.pressure";
+        r->unit = "";
+        r->min = b->mem_min;
+        r->max = b->mem_max;
+        r->apply = apply_memory;
+        if ((err = init_resource(p, r)))
+            goto fail;
+    }
+
+    if (b->cpu_max > 0) {
+        struct psi_resource *r = &p->res[p->n];
+
+        r->name = "cpu.max";
+        r->pressure = "cpu.pressure";
+        r->unit = "%";
+        r->min = b->cpu_min;
+        r->max = b->cpu_max;
+        r->apply = apply_cpu;
+        if ((err = init_resource(p, r)))
+            goto fail;
+    }
+
+    p->tick = timing_now_us();
+    return 0;
+
+fail:
+    psi_detach(p);
+    return err;
+}
+
+void psi_trigger(struct psi *p, int i)
+{
+    struct psi_resource *r = &p->res[i];
+
+    adjust(p, r, +1, "trigger", -1);
+    r->raised = 1;
+    r->calm = 0;
+}
+
+void psi_tick(struct psi *p)
+{
+    uint64_t now = timing_now_us();
+    if (now == p->tick)
+        return;
+
+    // Доля простоя за период по счётчику "some total"
+    for (int i = 0; i < p->n; i++) {
+        struct psi_resource *r = &p->res[i];
+        uint64_t total;
+
+        // cgroup могла быть удалена до завершения наблюдения
+        if (some_total(p->cgroup, r->pressure, &total))
+            continue;
+        uint64_t stalled = total - r->total;
+        double stall = 100.0 * stalled / (now - p->tick);
+        r->total = total;
+
+        if (stalled * PSI_WINDOW_US >= (uint64_t) PSI_THRESHOLD_US * (now - p->tick)) {
+            // Триггер в этом периоде уже поднял лимит
+            if (!r->raised)
+                adjust(p, r, +1, "pressure", stall);
+            r->calm = 0;
+        } else if (++r->calm >= PSI_CALM_TICKS) {
+            adjust(p, r, -1, "calm", stall);
+            r->calm = 0;
+        }
+        r->raised = 0;
+    }
+    p->tick = now;
+}
+
+void psi_detach(struct psi *p)
+{
+    for (int i = 0; i < p->n; i++)
+        close(p->res[i].fd);
+    p->n = 0;
+}
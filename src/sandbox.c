@@ -0,0 +1,1418 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sched.h>
+#include <stdint.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stddef.h>
+#include <wait.h>
+#include <memory.h>
+#include <syscall.h>
+#include <errno.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <linux/sched.h>
+#include "../include/util.h"
+#include "../include/netns.h"
+#include "../include/cgroup_control.h"
+#include "../include/instance.h"
+#include "../include/image.h"
+#include "../include/seccomp.h"
+#include "../include/sandbox.h"
+#include "../include/trace.h"
+
+/**
+ * @brief Настраивает mount namespace с pivot_root и монтирует procfs
+ *
+ * @param opts Параметры песочницы (режим overlay)
+ * @param root Каталог rootfs или точка монтирования образа
+ * @param tree idmapped-копия root от родителя или -1
+ * @param t Длительности фаз pivot_root и procfs
+ */
+static void prepare_mntns(const struct sandbox_opts *opts, const char *root,
+                          int tree, struct timings *t);
+
+/**
+ * @brief Монтирует файловую систему proc в каталог proc будущего корня
+ *        (относительно текущего каталога)
+ */
+static void prepare_procfs();
+
+/**
+ * @brief Структура параметров для передачи между процессами
+ */
+struct params {
+    int ctl;         /**< Управляющий сокет песочницы (сторона дочернего процесса) */
+    char **argv;     /**< Аргументы для запускаемой команды или NULL */
+    const struct sandbox_opts *opts;  /**< Параметры песочницы */
+    char root[PATH_MAX];  /**< Каталог rootfs или точка монтирования образа */
+    struct sock_fprog seccomp;  /**< Фильтр seccomp (len 0 — без фильтра) */
+    char seccomp_digest[SHA256_HEX_SIZE];  /**< Хэш фильтра в SECCOMP_CACHE или "" */
+    int log[CAPTURE_STREAMS];   /**< Пишущие концы каналов журналов или -1 */
+};
+
+/**
+ * @brief Отчёт дочернего процесса о подготовке, передаваемый перед execvp()
+ */
+struct child_report {
+    char tag;                 /**< Всегда 'T' */
+    uint64_t exec_ts;         /**< Момент вызова execvp(), мкс CLOCK_MONOTONIC */
+    struct timings t;         /**< Фазы pivot_root и procfs */
+    int nevents;              /**< Число шагов трассы в ev */
+    struct trace_event ev[TRACE_BUFFER_MAX];  /**< Шаги трассы дочернего процесса */
+};
+
+#define STACKSIZE (1024*1024)
+
+/**
+ * @brief Создаёт процесс сразу в cgroup через clone3(CLONE_INTO_CGROUP | CLONE_PIDFD).
+ *
+ * Процесс учитывается в cgroup с первой инструкции, без записи в cgroup.procs.
+ * Как и fork(), возвращает 0 в дочернем процессе (на копии стека родителя).
+ *
+ * @param flags Флаги CLONE_NEW* для новых пространств имён
+ * @param cgroup_fd Дескриптор директории cgroup
+ * @param pidfd Указатель для сохранения pidfd дочернего процесса
+ * @return PID дочернего процесса, 0 в дочернем процессе или -1 при ошибке
+ */
+static pid_t clone_into_cgroup(int flags, int cgroup_fd, int *pidfd)
+{
+    struct clone_args args;
+    memset(&args, 0, sizeof(args));
+
+    args.flags = flags | CLONE_INTO_CGROUP | CLONE_PIDFD;
+    args.pidfd = (__u64) (uintptr_t) pidfd;
+    args.exit_signal = SIGCHLD;
+    args.cgroup = cgroup_fd;
+
+    return syscall(SYS_clone3, &args, sizeof(args));
+}
+
+/**
+ * @brief Отправляет сообщение с дескрипторами через SCM_RIGHTS
+ *
+ * @param sock Unix сокет
+ * @param buf Данные сообщения
+ * @param len Длина данных (не меньше 1 байта)
+ * @param fds Передаваемые дескрипторы
+ * @param nfds Число дескрипторов (не больше 3)
+ * @return Результат sendmsg()
+ */
+static ssize_t send_fds(int sock, const void *buf, size_t len,
+                        const int *fds, int nfds)
+{
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    memset(cbuf, 0, sizeof(cbuf));
+
+    struct iovec iov = {
+            .iov_base = (void *) buf,
+            .iov_len = len
+    };
+    struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = cbuf,
+            .msg_controllen = CMSG_SPACE(nfds * sizeof(int))
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+/**
+ * @brief Принимает сообщение с дескрипторами, переданными через SCM_RIGHTS
+ *
+ * @param sock Unix сокет
+ * @param buf Буфер для данных
+ * @param len Размер буфера
+ * @param fds Массив для дескрипторов; если их не было, заполняется -1
+ * @param nfds Ожидаемое число дескрипторов (не больше 3)
+ * @return Результат recvmsg()
+ */
+static ssize_t recv_fds(int sock, void *buf, size_t len, int *fds, int nfds)
+{
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+
+    struct iovec iov = {
+            .iov_base = buf,
+            .iov_len = len
+    };
+    struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = cbuf,
+            .msg_controllen = CMSG_SPACE(nfds * sizeof(int))
+    };
+
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (n > 0 && cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(nfds * sizeof(int)))
+        memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+    else
+        for (int i = 0; i < nfds; i++)
+            fds[i] = -1;
+
+    return n;
+}
+
+/**
+ * @brief Ожидает сигнал о завершении настройки из управляющего сокета
+ *
+ * @param pipe Управляющий сокет
+ * @return Дескриптор idmapped-копии rootfs или -1, если её нет
+ */
+static int await_setup(int pipe)
+{
+    char buf[2];
+    int tree;
+
+    if (recv_fds(pipe, buf, 2, &tree, 1) != 2)
+        die("Failed to read from pipe: %m\n");
+    return tree;
+}
+
+/**
+ * @brief Ожидает задание для "тёплой" песочницы.
+ * Принимает argv и, если переданы, дескрипторы stdin/stdout/stderr клиента.
+ *
+ * @param ctl Управляющий сокет
+ * @return argv задания, завершённый NULL
+ */
+static char **await_job(int ctl)
+{
+    static char job[SANDBOX_JOB_MAX + 1];
+    static char *argv[SANDBOX_JOB_MAX / 2 + 1];
+    int stdio[3];
+
+    ssize_t len = recv_fds(ctl, job, SANDBOX_JOB_MAX, stdio, 3);
+    // Демон пула закрыл сокет, не передав задание: песочница больше не нужна
+    if (len == 0)
+        exit(0);
+    if (len < 0)
+        die("Failed to receive job: %m\n");
+    job[len] = '\0';
+
+    if (stdio[0] >= 0) {
+        fflush(stdout);
+        for (int i = 0; i < 3; i++) {
+            if (stdio[i] == i)
+                continue;
+            if (dup2(stdio[i], i) < 0)
+                die("Failed to dup2 job fd: %m\n");
+            close(stdio[i]);
+        }
+    }
+
+    int argc = 0;
+    for (char *p = job; p < job + len; p += strlen(p) + 1)
+        argv[argc++] = p;
+    argv[argc] = NULL;
+
+    if (argc == 0)
+        die("Received empty job\n");
+
+    return argv;
+}
+
+/**
+ * @brief Закрывает все дескрипторы, кроме stdio и перечисленных в keep
+ *
+ * @param keep Дескрипторы, которые нужно оставить (-1 пропускаются);
+ *        массив сортируется
+ * @param n Размер массива
+ */
+static void close_fds_except(int *keep, int n)
+{
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && keep[j - 1] > keep[j]; j--) {
+            int t = keep[j];
+            keep[j] = keep[j - 1];
+            keep[j - 1] = t;
+        }
+
+    unsigned int lo = 3;
+    for (int i = 0; i < n; i++) {
+        if (keep[i] < (int) lo)
+            continue;
+        if ((unsigned int) keep[i] > lo)
+            close_range(lo, keep[i] - 1, 0);
+        lo = keep[i] + 1;
+    }
+    close_range(lo, ~0U, 0);
+}
+
+/**
+ * @brief Функция, которая будет исполнена в дочернем процессе.
+ * Создаёт IPC очередь (демонстрация работы IPC namespace),
+ * монтирует файловые системы, снижает привилегии и запускает команду.
+ *
+ * @param arg Аргумент с параметрами командной строки
+ * @return int Возвращает 1 при ошибке
+ */
+static int cmd_exec(void *arg)
+{
+    if (prctl(PR_SET_PDEATHSIG, SIGKILL))
+        die("cannot PR_SET_PDEATHSIG for child process: %m\n");
+
+    struct params *params = (struct params*) arg;
+    uint64_t ts = trace_begin();
+
+    // Шаги песочницы копятся в памяти и уходят родителю перед execvp()
+    trace_buffer();
+
+    // Закрываем унаследованные дескрипторы других песочниц (в том числе
+    // блокировки номеров экземпляров), оставляя stdio, управляющий сокет и
+    // каналы журналов
+    int keep[] = { params->ctl, params->log[0], params->log[1] };
+    close_fds_except(keep, sizeof(keep) / sizeof(keep[0]));
+
+    // Маска сигналов наследуется от родителя (демон пула блокирует SIGCHLD и др.)
+    sigset_t mask;
+    sigemptyset(&mask);
+    if (sigprocmask(SIG_SETMASK, &mask, NULL))
+        die("Failed to reset signal mask: %m\n");
+    trace_end("cmd_exec.reset_fds", ts);
+
+    // Netlink сокет, открытый в новом network namespace: через него родитель
+    // настроит интерфейс песочницы без setns()
+    ts = trace_begin();
+    int nl_fd = create_socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl_fd < 0)
+        exit(1);
+    if (send_fds(params->ctl, "N", 1, &nl_fd, 1) < 0)
+        die("Failed to send netlink socket: %m\n");
+    close(nl_fd);
+    trace_end("cmd_exec.netlink_socket", ts);
+
+    // Ожидаем, пока основной процесс закончит настройки
+    ts = trace_begin();
+    int tree = await_setup(params->ctl);
+    trace_end("cmd_exec.await_setup", ts);
+
+    // Снижаем привилегии пользователя внутри user namespace; переключаемся
+    // до монтирования, чтобы файлы верхнего слоя overlay создавались от
+    // отображённого пользователя
+    //
+    // Прямые системные вызовы вместо обёрток glibc: если песочницу создал
+    // многопоточный процесс, обёртка рассылает смену учётных данных всем
+    // потокам родителя, которых в дочернем процессе нет, и ждёт их вечно
+    ts = trace_begin();
+    if (syscall(SYS_setgid, 0) == -1)
+        die("Failed to setgid: %m\n");
+    if (syscall(SYS_setuid, 0) == -1)
+        die("Failed to setuid: %m\n");
+
+    // Смена учётных данных сбрасывает PR_SET_PDEATHSIG: взводим заново,
+    // иначе "тёплая" песочница переживёт демон пула
+    if (prctl(PR_SET_PDEATHSIG, SIGKILL))
+        die("cannot PR_SET_PDEATHSIG for child process: %m\n");
+    trace_end("cmd_exec.setuid", ts);
+
+    // Настраиваем mount namespace с корневой файловой системой rootfs
+    static struct child_report report;
+    report.tag = 'T';
+    ts = trace_begin();
+    prepare_mntns(params->opts, params->root, tree, &report.t);
+    trace_end("prepare_mntns", ts);
+
+    // Демонстрация IPC namespace — создаём очередь сообщений
+    ts = trace_begin();
+    int msqid = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
+    if (msqid == -1)
+        die("msgget failed: %m\n");
+    dprintf(STDOUT_FILENO, "Created IPC message queue with id: %d\n", msqid);
+    trace_end("cmd_exec.msgget", ts);
+
+    // "Тёплая" песочница ждёт задание полностью подготовленной
+    ts = trace_begin();
+    char **argv = params->argv ? params->argv : await_job(params->ctl);
+    if (!params->argv)
+        trace_end("cmd_exec.await_job", ts);
+    char *cmd = argv[0];
+    dprintf(STDOUT_FILENO, "===========%s============\n", cmd);
+
+    if (params->opts->timings || trace_enabled()) {
+        report.nevents = trace_take(report.ev, TRACE_BUFFER_MAX);
+        report.exec_ts = timing_now_us();
+
+        size_t len = offsetof(struct child_report, ev) +
+                     report.nevents * sizeof(struct trace_event);
+        if (send(params->ctl, &report, len, MSG_NOSIGNAL) != (ssize_t) len)
+            die("Failed to send report: %m\n");
+    }
+
+    // Вывод команды уходит в каналы журналов, в том числе у задания пула
+    if (params->log[0] >= 0) {
+        fflush(stdout);
+        for (int i = 0; i < CAPTURE_STREAMS; i++) {
+            if (dup2(params->log[i], STDOUT_FILENO + i) < 0)
+                die("Failed to redirect output to log: %m\n");
+            close(params->log[i]);
+        }
+    }
+
+    // Политику наследуют потомки процесса песочницы; команды isolate exec
+    // ему не потомки и копируют её в sandbox_exec()
+    if (profile_apply_sched(params->opts->profile))
+        die("Failed to apply profile %s\n", profile_name(params->opts->profile));
+
+    // Фильтр ставится последним: всё, что выше, выполняется без него
+    if (params->seccomp.len && seccomp_apply(&params->seccomp))
+        die("Failed to apply seccomp policy %s\n", params->opts->seccomp);
+
+    // Управляющий сокет закрывается при exec (SOCK_CLOEXEC), что служит
+    // родителю признаком успешного запуска; при ошибке передаём errno
+    if (execvp(cmd, argv) == -1) {
+        int err = errno;
+        send(params->ctl, &err, sizeof(err), MSG_NOSIGNAL);
+        errno = err;
+        die("Failed to exec %s: %m\n", cmd);
+    }
+
+    die("¯\\_(ツ)_/¯");
+    return 1;
+}
+
+/**
+ * @brief Записывает строку в файл, с обработкой ошибок
+ *
+ * @param path Путь к файлу
+ * @param line Строка для записи
+ * @return 0 или -errno
+ */
+static int write_file(char path[100], char line[100])
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return fail("Failed to open file %s: %m\n", path);
+
+    size_t len = strlen(line);
+    if (fwrite(line, 1, len, f) != len) {
+        int err = fail("Failed to write to file %s: %m\n", path);
+        fclose(f);
+        return err;
+    }
+    if (fclose(f) != 0)
+        return fail("Failed to close file %s: %m\n", path);
+    return 0;
+}
+
+/**
+ * @brief Настраивает user namespace: отображает UID и GID 0..65535 песочницы
+ *        на диапазон экземпляра
+ *
+ * @param pid PID дочернего процесса для настройки
+ * @param id Номер экземпляра
+ * @return 0 или -errno
+ */
+static int prepare_userns(int pid, int id)
+{
+    char path[100];
+    char line[100];
+    uid_t uid;
+    gid_t gid;
+    int err;
+
+    if ((err = instance_subids(id, &uid, &gid)))
+        return err;
+    uint64_t ts = trace_begin();
+
+    sprintf(path, "/proc/%d/uid_map", pid);
+    sprintf(line, "0 %u %d\n", uid, INSTANCE_SUBID_SIZE);
+    if ((err = write_file(path, line)))
+        return err;
+    trace_end("prepare_userns.uid_map", ts);
+
+    ts = trace_begin();
+    sprintf(path, "/proc/%d/setgroups", pid);
+    sprintf(line, "deny");
+    if ((err = write_file(path, line)))
+        return err;
+    trace_end("prepare_userns.setgroups", ts);
+
+    ts = trace_begin();
+    sprintf(path, "/proc/%d/gid_map", pid);
+    sprintf(line, "0 %u %d\n", gid, INSTANCE_SUBID_SIZE);
+    if ((err = write_file(path, line)))
+        return err;
+    trace_end("prepare_userns.gid_map", ts);
+    return 0;
+}
+
+/**
+ * @brief Создаёт idmapped-копию rootfs для песочницы
+ *
+ * open_tree(OPEN_TREE_CLONE) даёт отсоединённую копию монтирования rootfs,
+ * а mount_setattr(MOUNT_ATTR_IDMAP) с user namespace песочницы отображает
+ * владельцев файлов так же, как её uid_map: файл root хоста виден в
+ * песочнице как принадлежащий её root. Один rootfs на диске служит
+ * песочницам с разными диапазонами UID без chown. Дочерний процесс
+ * получает дерево через управляющий сокет и подключает его move_mount().
+ *
+ * @param root Каталог rootfs или точка монтирования образа
+ * @param pid PID дочернего процесса с настроенным uid_map
+ * @return Дескриптор дерева, -1, если ядро или файловая система rootfs не
+ *         поддерживают idmapped mounts, или -errno
+ */
+static int idmap_rootfs(const char *root, int pid)
+{
+    static int warned;
+    char path[64];
+    int err;
+
+    snprintf(path, sizeof(path), "/proc/%d/ns/user", pid);
+    int userns = open(path, O_RDONLY | O_CLOEXEC);
+    if (userns < 0)
+        return fail("Failed to open %s: %m\n", path);
+
+    int tree = syscall(SYS_open_tree, AT_FDCWD, root,
+                       OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    if (tree < 0) {
+        err = errno == ENOSYS ? -1 : fail("Failed to clone %s: %m\n", root);
+        goto out;
+    }
+
+    struct mount_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.attr_set = MOUNT_ATTR_IDMAP;
+    attr.userns_fd = userns;
+
+    err = tree;
+    if (syscall(SYS_mount_setattr, tree, "", AT_EMPTY_PATH | AT_RECURSIVE,
+                &attr, sizeof(attr))) {
+        err = errno == EINVAL || errno == ENOSYS
+              ? -1 : fail("Failed to idmap %s: %m\n", root);
+        close(tree);
+    }
+
+out:
+    if (err == -1 && !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED))
+        fprintf(stderr, "%s does not support idmapped mounts, "
+                        "files keep host ownership\n", root);
+    close(userns);
+    return err;
+}
+
+/**
+ * @brief Собирает корень песочницы как overlay: rootfs — общий нижний слой только
+ * для чтения, верхний слой и workdir — в tmpfs экземпляра.
+ *
+ * Всё монтируется внутри mount namespace песочницы (ядро 5.11+ для overlay
+ * в user namespace): создание не зависит от размера образа, кэш страниц
+ * нижнего слоя общий для всех песочниц, а при уничтожении namespace
+ * монтирования исчезают вместе с ним.
+ *
+ * @param rootfs Путь к нижнему слою
+ * @return Путь к собранному корню
+ */
+static const char *prepare_overlay(const char *rootfs)
+{
+    char lower[PATH_MAX];
+    char data[PATH_MAX + 128];
+
+    if (!realpath(rootfs, lower))
+        die("Failed to resolve rootfs %s: %m\n", rootfs);
+
+    // tmpfs учитывается в memory cgroup экземпляра
+    if (mount("tmpfs", SANDBOX_OVERLAY_DIR, "tmpfs",
+              MS_NOSUID | MS_NODEV, "mode=0755"))
+        die("Failed to mount tmpfs at %s: %m\n", SANDBOX_OVERLAY_DIR);
+
+    const char *dirs[] = { "upper", "work", "merged" };
+    for (int i = 0; i < 3; i++) {
+        snprintf(data, sizeof(data), SANDBOX_OVERLAY_DIR "/%s", dirs[i]);
+        if (mkdir(data, 0755))
+            die("Failed to mkdir %s: %m\n", data);
+    }
+
+    snprintf(data, sizeof(data),
+             "lowerdir=%s,upperdir=" SANDBOX_OVERLAY_DIR "/upper,"
+             "workdir=" SANDBOX_OVERLAY_DIR "/work", lower);
+
+    if (mount("overlay", SANDBOX_OVERLAY_DIR "/merged", "overlay", 0, data))
+        die("Failed to mount overlay over %s: %m\n", lower);
+
+    return SANDBOX_OVERLAY_DIR "/merged";
+}
+
+static void prepare_mntns(const struct sandbox_opts *opts, const char *root,
+                          int tree, struct timings *t)
+{
+    uint64_t start = timing_now_us();
+    uint64_t ts = trace_begin();
+    const char *mnt = root;
+
+    // idmapped-копия ложится поверх root и служит корнем или нижним слоем
+    if (tree >= 0) {
+        if (syscall(SYS_move_mount, tree, "", AT_FDCWD, root,
+                    MOVE_MOUNT_F_EMPTY_PATH))
+            die("Failed to attach idmapped %s: %m\n", root);
+        close(tree);
+        trace_end("prepare_mntns.idmap", ts);
+        ts = trace_begin();
+    }
+
+    if (opts->overlay) {
+        mnt = prepare_overlay(root);
+    } else if (tree < 0 && mount(root, mnt, NULL, MS_BIND | MS_REC, NULL)) {
+        die("Failed to mount %s at %s: %m\n", root, mnt);
+    }
+    trace_end(opts->overlay ? "prepare_mntns.overlay" : "prepare_mntns.bind", ts);
+
+    if (chdir(mnt))
+        die("Failed to chdir to rootfs mounted at %s: %m\n", mnt);
+
+    // procfs монтируется до pivot_root: в user namespace ядро разрешает
+    // новый proc, только пока в mount namespace виден proc хоста
+    ts = trace_begin();
+    uint64_t procfs = timing_now_us();
+    prepare_procfs();
+    t->us[TIMING_PROCFS] = timing_now_us() - procfs;
+    trace_end("prepare_mntns.procfs", ts);
+
+    // pivot_root(".", ".") кладёт старый корень поверх нового, откуда он сразу
+    // отсоединяется: каталог put_old не нужен, и корнем может быть образ
+    // только для чтения
+    ts = trace_begin();
+    if (syscall(SYS_pivot_root, ".", "."))
+        die("Failed to pivot_root to %s: %m\n", mnt);
+    trace_end("prepare_mntns.pivot_root", ts);
+
+    ts = trace_begin();
+    if (umount2(".", MNT_DETACH))
+        die("Failed to umount old root: %m\n");
+    if (chdir("/"))
+        die("Failed to chdir to new root: %m\n");
+    trace_end("prepare_mntns.umount_old", ts);
+
+    t->us[TIMING_PIVOT_ROOT] = timing_now_us() - start - t->us[TIMING_PROCFS];
+}
+
+static void prepare_procfs()
+{
+    if (mkdir("proc", 0555) && errno != EEXIST)
+        die("Failed to mkdir /proc: %m\n");
+
+    if (mount("proc", "proc", "proc", 0, ""))
+        die("Failed to mount proc: %m\n");
+}
+
+/**
+ * @brief Считает CPU в списке формата cpuset.cpus ("0-3,8")
+ */
+static int count_cpus(const char *list)
+{
+    int count = 0;
+
+    for (;;) {
+        char *end;
+        long first = strtol(list, &end, 10);
+        if (end == list)
+            break;
+
+        long last = first;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        count += last - first + 1;
+
+        if (*end != ',')
+            break;
+        list = end + 1;
+    }
+    return count;
+}
+
+/**
+ * @brief Число очередей veth-mq: по одной на CPU, доступный экземпляру
+ *
+ * @param cpus cpuset.cpus экземпляра или NULL, если он не привязан к CPU
+ */
+static int net_queues(const char *cpus)
+{
+    cpu_set_t set;
+    int n = 1;
+
+    if (cpus)
+        n = count_cpus(cpus);
+    else if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        n = CPU_COUNT(&set);
+
+    if (n < 1)
+        n = 1;
+    return n < NET_QUEUES_MAX ? n : NET_QUEUES_MAX;
+}
+
+/**
+ * @brief Настраивает network namespace, создаёт виртуальные интерфейсы, настраивает адреса
+ *
+ * Экземпляр id получает на стороне хоста интерфейс net_ifname() (veth<id> для
+ * veth), в песочнице — eth0 (имена уникальны в пределах своего namespace),
+ * и подсеть /30 из instance_addrs().
+ *
+ * @param cmd_pid PID дочернего процесса
+ * @param id Номер экземпляра
+ * @param child_nl Netlink сокет, открытый дочерним процессом в его namespace
+ * @param net Драйвер интерфейсов
+ * @param queues Число очередей для veth-mq
+ * @param netns Дескриптор network namespace песочницы (остаётся открытым)
+ * @param ifindex Индекс интерфейса на стороне хоста
+ * @param peer_ifindex Индекс интерфейса в песочнице
+ * @param t Длительности фаз veth и addr
+ * @return 0 или -errno
+ */
+static int prepare_netns(int cmd_pid, int id, int child_nl,
+                         const struct net_opts *net, int queues,
+                         int *netns, int *ifindex, int *peer_ifindex,
+                         struct timings *t)
+{
+    char *vpeer = "eth0";
+    char veth_addr[INET_ADDRSTRLEN];
+    char vpeer_addr[INET_ADDRSTRLEN];
+
+    instance_addrs(id, veth_addr, vpeer_addr, INET_ADDRSTRLEN);
+
+    uint64_t ts = trace_begin();
+    int sock_fd = create_socket(
+            PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (sock_fd < 0)
+        return sock_fd;
+    int child_netns = get_netns_fd(cmd_pid);
+    if (child_netns < 0) {
+        close(sock_fd);
+        return child_netns;
+    }
+    trace_end("prepare_netns.open", ts);
+
+    ts = trace_begin();
+    int err = create_net_link(sock_fd, child_nl, child_netns, net, queues,
+                              id, vpeer, veth_addr, vpeer_addr,
+                              INSTANCE_PREFIXLEN, ifindex, peer_ifindex, t);
+    trace_end("prepare_netns.link", ts);
+
+    close(sock_fd);
+    if (err) {
+        close(child_netns);
+        return err;
+    }
+    *netns = child_netns;
+    return 0;
+}
+
+/**
+ * @brief Запасной путь для ядер без clone3(CLONE_INTO_CGROUP): clone() на
+ *        собственном стеке запуска, процесс переносится в cgroup после создания
+ *
+ * Стек выделяется через mmap() на каждый запуск, а не в общем статическом
+ * буфере: glibc записывает на него аргументы cmd_exec() ещё в родителе, и
+ * параллельные запуски из разных потоков портили бы друг другу стек. Нижняя
+ * страница — PROT_NONE, поэтому переполнение стека завершается SIGSEGV, а не
+ * порчей соседней памяти. Без CLONE_VM дочерний процесс получает копию
+ * стека, так что родитель освобождает его сразу после clone().
+ *
+ * @return PID дочернего процесса или -1 (errno сохраняется)
+ */
+static pid_t clone_with_stack(int flags, struct params *params)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    char *stack = mmap(NULL, STACKSIZE + page, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED)
+        return -1;
+
+    pid_t pid = -1;
+    if (mprotect(stack, page, PROT_NONE) == 0)
+        pid = clone(cmd_exec, stack + page + STACKSIZE, SIGCHLD | flags, params);
+
+    int err = errno;
+    munmap(stack, STACKSIZE + page);
+    errno = err;
+    return pid;
+}
+
+/**
+ * @brief Закрывает в родителе пишущие концы каналов журналов
+ */
+static void close_log_pipes(struct params *params)
+{
+    for (int i = 0; i < CAPTURE_STREAMS; i++) {
+        if (params->log[i] >= 0)
+            close(params->log[i]);
+        params->log[i] = -1;
+    }
+}
+
+/**
+ * @brief Закрывает дескриптор cgroup экземпляра и удаляет её каталог
+ */
+static void remove_cgroup(struct sandbox *sb)
+{
+    char cgroup_name[32];
+
+    close(sb->cgroup);
+    sb->cgroup = -1;
+    snprintf(cgroup_name, sizeof(cgroup_name), "sandbox%d", sb->id);
+    cgroup_remove(cgroup_name);
+}
+
+int sandbox_create(struct sandbox *sb, const struct sandbox_opts *opts,
+                   char **argv)
+{
+    struct params params;
+    memset(&params, 0, sizeof(struct params));
+    memset(&sb->timings, 0, sizeof(sb->timings));
+    uint64_t start;
+    uint64_t ts = trace_begin();
+    int queues = 1;
+    int tree = -1;
+    int err;
+
+    sb->cgroup = -1;
+    sb->pidfd = -1;
+    sb->ctl = -1;
+    sb->placed = 0;
+    sb->reason = NULL;
+    sb->image[0] = '\0';
+    sb->net = opts->net.driver;
+    sb->netns = -1;
+    sb->ifindex = 0;
+    sb->peer_ifindex = 0;
+    sb->nl = -1;
+    sb->log.opts = NULL;
+    for (int i = 0; i < CAPTURE_STREAMS; i++)
+        params.log[i] = -1;
+    memset(&sb->net_stats, 0, sizeof(sb->net_stats));
+    sb->teardown_us = 0;
+    sb->profile = opts->profile;
+    sb->perf.fd = NULL;
+    sb->counted = 0;
+    memset(&sb->perf_counts, 0, sizeof(sb->perf_counts));
+
+    int id = instance_acquire(&sb->lock);
+    trace_end("sandbox_create.instance", ts);
+    if (id < 0)
+        return id;
+    sb->id = id;
+
+    // Создаём управляющий сокет для связи между главным и дочерним процессом
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        err = fail("Failed to create socketpair: %m\n");
+        goto release;
+    }
+    sb->ctl = sv[0];
+
+    params.ctl = sv[1];
+    params.argv = argv;
+    params.opts = opts;
+    snprintf(params.root, sizeof(params.root), "%s", opts->rootfs);
+
+    // Образ rootfs монтируется на хосте один раз для всех экземпляров, а
+    // песочница получает копию монтирования вместе с mount namespace
+    if (image_is_file(opts->rootfs)) {
+        ts = trace_begin();
+        if ((err = image_acquire(opts->rootfs, id, sb->image, params.root,
+                                 sizeof(params.root))))
+            goto close_child_ctl;
+        trace_end("sandbox_create.image", ts);
+    }
+
+    // Точка монтирования tmpfs для overlay: общая для всех экземпляров,
+    // но монтирование в ней видно только в namespace песочницы
+    if (opts->overlay && mkdir(SANDBOX_OVERLAY_DIR, 0755) && errno != EEXIST) {
+        err = fail("Failed to mkdir %s: %m\n", SANDBOX_OVERLAY_DIR);
+        goto close_child_ctl;
+    }
+
+    // Флаги для clone с пространствами имён, включая IPC
+    int clone_flags =
+            CLONE_NEWUTS | CLONE_NEWUSER |
+            CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWNET | CLONE_NEWIPC;
+
+    // Создаём cgroup экземпляра с ограничениями ресурсов до появления процесса
+    char cgroup_name[32];
+    snprintf(cgroup_name, sizeof(cgroup_name), "sandbox%d", id);
+    start = timing_now_us();
+    ts = trace_begin();
+    sb->cgroup = cgroup_init_and_limit(cgroup_name);
+    trace_end("cgroup_init_and_limit", ts);
+    if (sb->cgroup < 0) {
+        err = sb->cgroup;
+        goto close_child_ctl;
+    }
+
+    // Привязка к CPU до появления процесса: он не начинает работу на чужом LLC
+    if (opts->placement.policy != PLACEMENT_NONE) {
+        char cpus[1024];
+        char mems[1024];
+
+        ts = trace_begin();
+        if ((err = placement_assign(id, &opts->placement, cpus, mems, sizeof(cpus))))
+            goto close_child_ctl;
+        sb->placed = 1;
+        if ((err = cgroup_set_cpuset(sb->cgroup, cpus, mems)))
+            goto close_child_ctl;
+        trace_end("sandbox_create.placement", ts);
+        if (opts->net.driver == NET_DRIVER_VETH_MQ)
+            queues = net_queues(cpus);
+    } else if (opts->net.driver == NET_DRIVER_VETH_MQ) {
+        queues = net_queues(NULL);
+    }
+
+    if ((err = profile_apply_cgroup(opts->profile, sb->cgroup)))
+        goto close_child_ctl;
+
+    // Ограничения ввода-вывода задаются на диске, где лежит rootfs (каталог
+    // или файл образа), а не на loop-устройстве или tmpfs overlay
+    if (opts->io.rbps || opts->io.wbps || opts->io.riops || opts->io.wiops ||
+        opts->io.latency_us) {
+        char dev[32];
+
+        ts = trace_begin();
+        if ((err = cgroup_io_device(opts->io.device ? opts->io.device : opts->rootfs,
+                                    dev, sizeof(dev))) ||
+            (err = cgroup_set_io(sb->cgroup, &opts->io, dev)))
+            goto close_child_ctl;
+        trace_end("sandbox_create.io", ts);
+    }
+    sb->timings.us[TIMING_CGROUP] = timing_now_us() - start;
+
+    // Счётчики открываются до появления процесса и видят его с первой
+    // инструкции
+    if (opts->perf) {
+        ts = trace_begin();
+        if ((err = perf_open(&sb->perf, sb->cgroup)))
+            goto close_child_ctl;
+        sb->counted = 1;
+        trace_end("sandbox_create.perf", ts);
+    }
+
+    // Каналы создаются до клонирования: пишущие концы наследует дочерний
+    // процесс, а файлы журналов, названные по его PID, открываются после
+    if (opts->log.dir && (err = capture_init(&sb->log, &opts->log, params.log)))
+        goto close_child_ctl;
+
+    // Дочерний процесс получает копию программы вместе с памятью родителя
+    if (opts->seccomp) {
+        start = timing_now_us();
+        ts = trace_begin();
+        if ((err = seccomp_load(opts->seccomp, &params.seccomp,
+                                 params.seccomp_digest)))
+            goto close_child_ctl;
+        sb->timings.us[TIMING_SECCOMP] = timing_now_us() - start;
+        trace_end("sandbox_create.seccomp", ts);
+    }
+
+    // Клонируем дочерний процесс с изоляцией сразу в cgroup экземпляра
+    start = timing_now_us();
+    ts = trace_begin();
+
+    // clone3() и clone() не проходят через обработчики fork() в glibc: если
+    // другой поток в этот момент пишет в stdout или stderr, дочерний процесс
+    // унаследует занятую блокировку потока и зависнет на первом выводе.
+    // Держим блокировки на время клонирования, а буфер stdout сбрасываем,
+    // чтобы он не был выведен повторно при exit() в дочернем процессе
+    flockfile(stdout);
+    flockfile(stderr);
+    fflush(stdout);
+
+    int cmd_pid = clone_into_cgroup(clone_flags, sb->cgroup, &sb->pidfd);
+    if (cmd_pid == 0) {
+        funlockfile(stderr);
+        funlockfile(stdout);
+        _exit(cmd_exec(&params));
+    }
+
+    // Ядра без clone3(CLONE_INTO_CGROUP): процесс переносится в cgroup
+    // после создания
+    int fallback = cmd_pid < 0 && (errno == ENOSYS || errno == E2BIG);
+    if (fallback)
+        cmd_pid = clone_with_stack(clone_flags, &params);
+
+    funlockfile(stderr);
+    funlockfile(stdout);
+    seccomp_free(&params.seccomp);
+    close_log_pipes(&params);
+
+    if (fallback && cmd_pid > 0) {
+        sb->pid = cmd_pid;
+        sb->pidfd = syscall(SYS_pidfd_open, cmd_pid, 0);
+        if ((err = cgroup_add_process(sb->cgroup, cmd_pid)))
+            goto kill_child;
+    }
+
+    if (cmd_pid < 0) {
+        err = fail("Failed to clone: %m\n");
+        goto close_child_ctl;
+    }
+
+    sb->timings.us[TIMING_CLONE] = timing_now_us() - start;
+    trace_end("sandbox_create.clone", ts);
+    close(sv[1]);
+    sv[1] = -1;
+
+    sb->pid = cmd_pid;
+    if ((err = instance_set_pid(sb->lock, cmd_pid, params.seccomp_digest)))
+        goto kill_child;
+    if (sb->log.opts && (err = capture_open(&sb->log, id, cmd_pid)))
+        goto kill_child;
+
+    // Настраиваем user и network namespaces для дочернего процесса
+    start = timing_now_us();
+    ts = trace_begin();
+    if ((err = prepare_userns(cmd_pid, id)))
+        goto kill_child;
+    if ((tree = idmap_rootfs(params.root, cmd_pid)) < -1) {
+        err = tree;
+        goto kill_child;
+    }
+    sb->timings.us[TIMING_IDMAP] = timing_now_us() - start;
+    trace_end("prepare_userns", ts);
+
+    ts = trace_begin();
+    char tag;
+    int child_nl;
+    errno = 0;
+    if (recv_fds(sb->ctl, &tag, 1, &child_nl, 1) != 1 || child_nl < 0) {
+        // EOF: процесс песочницы завершился, не дойдя до настройки сети
+        if (errno == 0)
+            errno = ECHILD;
+        err = fail("Failed to receive netlink socket from sandbox %d: %m\n", id);
+        goto kill_child;
+    }
+    trace_end("sandbox_create.recv_netlink", ts);
+
+    ts = trace_begin();
+    err = prepare_netns(cmd_pid, id, child_nl, &opts->net, queues,
+                        &sb->netns, &sb->ifindex, &sb->peer_ifindex,
+                        &sb->timings);
+    // Сокет в namespace песочницы нужен для счётчиков ipvlan и macvlan
+    if (!err && (sb->net == NET_DRIVER_IPVLAN || sb->net == NET_DRIVER_MACVLAN))
+        sb->nl = child_nl;
+    else
+        close(child_nl);
+    trace_end("prepare_netns", ts);
+    if (err)
+        goto kill_child;
+
+    // Сообщаем дочернему процессу, что настройка завершена, и передаём
+    // idmapped-копию rootfs
+    ssize_t sent = tree >= 0 ? send_fds(sb->ctl, "OK", 2, &tree, 1)
+                             : write(sb->ctl, "OK", 2);
+    if (tree >= 0)
+        close(tree);
+    tree = -1;
+    if (sent != 2) {
+        err = fail("Failed to write to pipe: %m\n");
+        goto kill_child;
+    }
+    return 0;
+
+    // Откат в обратном порядке: sandbox_wait() освобождает всё, что
+    // создано для запущенного процесса
+kill_child:
+    if (sv[1] >= 0)
+        close(sv[1]);
+    if (tree >= 0)
+        close(tree);
+    if (sb->pidfd >= 0)
+        syscall(SYS_pidfd_send_signal, sb->pidfd, SIGKILL, NULL, 0);
+    else
+        kill(sb->pid, SIGKILL);
+    sandbox_wait(sb);
+    close(sb->ctl);
+    sb->ctl = -1;
+    return err;
+
+close_child_ctl:
+    if (sv[1] >= 0)
+        close(sv[1]);
+    close(sb->ctl);
+    sb->ctl = -1;
+    close_log_pipes(&params);
+    seccomp_free(&params.seccomp);
+release:
+    capture_close(&sb->log);
+    perf_close(&sb->perf);
+    if (sb->cgroup >= 0)
+        remove_cgroup(sb);
+    if (sb->placed)
+        placement_release(id);
+    if (sb->image[0])
+        image_release(sb->image, id);
+    instance_release(sb->lock);
+    sb->lock = -1;
+    return err;
+}
+
+int sandbox_send_job(struct sandbox *sb, const char *job, size_t len,
+                     const int stdio[3])
+{
+    if (send_fds(sb->ctl, job, len, stdio, 3) < 0)
+        return fail("Failed to send job to sandbox %d: %m\n", sb->id);
+    return 0;
+}
+
+int sandbox_await_exec(struct sandbox *sb)
+{
+    struct child_report report;
+    uint64_t exec_ts = 0;
+    int err = 0;
+    ssize_t n;
+
+    // Отчёт о подготовке приходит перед execvp(), errno — после неудачи
+    while ((n = read(sb->ctl, &report, sizeof(report))) >=
+           (ssize_t) offsetof(struct child_report, ev) && report.tag == 'T') {
+        sb->timings.us[TIMING_PIVOT_ROOT] = report.t.us[TIMING_PIVOT_ROOT];
+        sb->timings.us[TIMING_PROCFS] = report.t.us[TIMING_PROCFS];
+        exec_ts = report.exec_ts;
+
+        char label[32];
+        snprintf(label, sizeof(label), "sandbox%d", sb->id);
+        trace_emit(sb->pid, label, report.ev, report.nevents);
+    }
+
+    // Дочерний процесс присылает errno неудачного execvp() положительным
+    if (n < 0) {
+        err = fail("Failed to read from sandbox %d: %m\n", sb->id);
+    } else if (n == sizeof(err)) {
+        memcpy(&err, &report, sizeof(err));
+        err = -err;
+    }
+
+    // EOF после закрытия сокета при exec: завершаем фазу execvp
+    if (!err && exec_ts) {
+        struct trace_event ev = { "cmd_exec.execvp", exec_ts, 0 };
+        ev.dur = timing_now_us() - exec_ts;
+        sb->timings.us[TIMING_EXEC] = ev.dur;
+        trace_emit(sb->pid, NULL, &ev, 1);
+    }
+
+    close(sb->ctl);
+    sb->ctl = -1;
+
+    return err;
+}
+
+/**
+ * @brief Ожидает завершения процесса через pidfd
+ *
+ * @param pidfd pidfd процесса
+ * @param pid PID процесса (для сообщений об ошибках)
+ * @return Статус завершения в формате waitpid() или -errno
+ */
+static int wait_pidfd(int pidfd, pid_t pid)
+{
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+
+    if (waitid(P_PIDFD, pidfd, &info, WEXITED) == -1)
+        return fail("Failed to wait pid %d: %m\n", pid);
+
+    if (info.si_code == CLD_EXITED)
+        return W_EXITCODE(info.si_status, 0);
+    return W_EXITCODE(0, info.si_status);
+}
+
+int sandbox_net_stats(const struct sandbox *sb, int sock_fd, struct nl_rx *rx,
+                      struct net_stats *st)
+{
+    if (sb->nl >= 0)
+        return net_stats_read_peer(sb->nl, rx, sb->peer_ifindex, st);
+    if (!sb->ifindex)
+        return -ENODEV;
+    return net_stats_read(sock_fd, rx, sb->ifindex, st);
+}
+
+/**
+ * @brief Читает итоговые сетевые счётчики песочницы в sb->net_stats и
+ *        удаляет её интерфейс на стороне хоста, если он не исчезнет вместе
+ *        с namespace
+ */
+static void release_net(struct sandbox *sb)
+{
+    struct nl_rx rx = { NULL, 0 };
+
+    int sock_fd = create_socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+                                NETLINK_ROUTE);
+    if (sock_fd < 0)
+        return;
+    if (sb->ifindex)
+        sandbox_net_stats(sb, sock_fd, &rx, &sb->net_stats);
+    net_release(sock_fd, &rx, sb->net, sb->id);
+    nl_rx_free(&rx);
+    close(sock_fd);
+}
+
+int sandbox_wait(struct sandbox *sb)
+{
+    int status = 0;
+
+    if (sb->pidfd < 0) {
+        if (waitpid(sb->pid, &status, 0) == -1)
+            status = fail("Failed to wait pid %d: %m\n", sb->pid);
+    } else {
+        status = wait_pidfd(sb->pidfd, sb->pid);
+        close(sb->pidfd);
+        sb->pidfd = -1;
+    }
+
+    uint64_t start = timing_now_us();
+
+    // Процессы, пережившие init песочницы (например, запущенные isolate
+    // exec), завершаются все сразу, в том числе порождаемые в этот момент
+    uint64_t ts = trace_begin();
+    int err = cgroup_kill(sb->cgroup);
+    if (err == 0)
+        err = cgroup_wait_empty(sb->cgroup, SANDBOX_TEARDOWN_MS);
+    trace_end("sandbox_wait.kill", ts);
+
+    // Счётчики cgroup включают уже завершившиеся процессы экземпляра
+    cgroup_read_usage(sb->cgroup, &sb->usage);
+    if (sb->perf.fd)
+        perf_read(&sb->perf, &sb->perf_counts);
+    perf_close(&sb->perf);
+    capture_close(&sb->log);
+
+    // Открытый дескриптор namespace не даёт интерфейсам исчезнуть вместе
+    // с процессом, поэтому итоговые счётчики ещё доступны. После cgroup.kill
+    // namespace не держит ни один процесс экземпляра, и с закрытием
+    // дескриптора ядро удаляет его вместе с парой veth
+    ts = trace_begin();
+    release_net(sb);
+    if (sb->nl >= 0)
+        close(sb->nl);
+    sb->nl = -1;
+    if (sb->netns >= 0)
+        close(sb->netns);
+    sb->netns = -1;
+    trace_end("sandbox_wait.net", ts);
+
+    // Непустую cgroup удалить нельзя: она останется до следующего
+    // экземпляра с тем же номером
+    ts = trace_begin();
+    if (err == 0) {
+        remove_cgroup(sb);
+    } else {
+        close(sb->cgroup);
+        sb->cgroup = -1;
+    }
+    trace_end("sandbox_wait.cgroup", ts);
+
+    // CPU освобождаются до номера: иначе новый владелец номера мог бы
+    // получить CPU, которые ещё числятся за прежним экземпляром
+    if (sb->placed)
+        placement_release(sb->id);
+    if (sb->image[0])
+        image_release(sb->image, sb->id);
+
+    instance_release(sb->lock);
+    sb->lock = -1;
+    sb->teardown_us = timing_now_us() - start;
+
+    return status;
+}
+
+void sandbox_write_report(FILE *f, const struct sandbox *sb, int status)
+{
+    const char *reason = sb->reason;
+    if (reason == NULL)
+        reason = WIFEXITED(status) ? "exited" : "signaled";
+
+    fprintf(f, "{\"id\":%d,\"pid\":%d,\"exit_code\":%d,\"signal\":%d,"
+               "\"reason\":\"%s\",", sb->id, sb->pid,
+            WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+            WIFSIGNALED(status) ? WTERMSIG(status) : 0, reason);
+    if (sb->profile != PROFILE_NONE)
+        fprintf(f, "\"profile\":\"%s\",", profile_name(sb->profile));
+    fputs("\"usage\":", f);
+    cgroup_usage_write_json(f, &sb->usage);
+    fputs(",\"net\":", f);
+    net_stats_write_json(f, &sb->net_stats);
+    if (sb->counted) {
+        fputs(",\"perf\":", f);
+        perf_write_json(f, &sb->perf_counts);
+    }
+    fprintf(f, ",\"teardown_us\":%llu", (unsigned long long) sb->teardown_us);
+    if (sb->log.opts)
+        fprintf(f, ",\"log\":{\"stdout_bytes\":%llu,\"stderr_bytes\":%llu,"
+                   "\"throttled_us\":%llu}",
+                (unsigned long long) sb->log.s[CAPTURE_STDOUT].bytes,
+                (unsigned long long) sb->log.s[CAPTURE_STDERR].bytes,
+                (unsigned long long) sb->log.throttled_us);
+    fputs("}\n", f);
+}
+
+/**
+ * @brief Входит в namespaces песочницы и запускает в ней команду.
+ *
+ * Выполняется во вспомогательном процессе sandbox_exec(): после setns()
+ * процесс остаётся в namespaces песочницы навсегда.
+ *
+ * @param id Номер экземпляра песочницы
+ * @param pidfd pidfd процесса песочницы
+ * @param cgroup_fd Дескриптор cgroup экземпляра
+ * @param policy Политика планировщика для команды
+ * @param param Параметры политики планировщика
+ * @param filter Фильтр seccomp песочницы (len == 0 — без фильтра)
+ * @param argv Команда для запуска
+ * @return Статус завершения команды в формате waitpid() или -errno
+ */
+static int exec_in_sandbox(int id, int pidfd, int cgroup_fd, int policy,
+                           const struct sched_param *param,
+                           const struct sock_fprog *filter, char **argv)
+{
+    // Один setns() по pidfd переводит процесс во все namespaces песочницы;
+    // PID namespace применяется к создаваемым потомкам
+    if (setns(pidfd, CLONE_NEWUSER | CLONE_NEWNS | CLONE_NEWPID |
+                     CLONE_NEWNET | CLONE_NEWIPC | CLONE_NEWUTS))
+        return fail("Failed to join namespaces of sandbox %d: %m\n", id);
+
+    int cmd_pidfd;
+    pid_t cmd_pid = clone_into_cgroup(0, cgroup_fd, &cmd_pidfd);
+    if (cmd_pid < 0)
+        return fail("Failed to clone into sandbox %d: %m\n", id);
+
+    if (cmd_pid == 0) {
+        // Прямые системные вызовы, как в cmd_exec(): обёртки glibc ждали бы
+        // потоков родителя, которых в дочернем процессе нет
+        if (syscall(SYS_setgid, 0) == -1)
+            die("Failed to setgid: %m\n");
+        if (syscall(SYS_setuid, 0) == -1)
+            die("Failed to setuid: %m\n");
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL))
+            die("cannot PR_SET_PDEATHSIG for child process: %m\n");
+        if (policy != SCHED_OTHER && sched_setscheduler(0, policy, param))
+            die("Failed to set scheduling policy: %m\n");
+        if (filter->len && seccomp_apply(filter))
+            die("Failed to apply seccomp filter of sandbox %d\n", id);
+
+        execvp(argv[0], argv);
+        die("Failed to exec %s: %m\n", argv[0]);
+    }
+
+    int err = wait_pidfd(cmd_pidfd, cmd_pid);
+    close(cmd_pidfd);
+    return err;
+}
+
+int sandbox_exec(int id, char **argv)
+{
+    struct sock_fprog filter = { 0, NULL };
+    char digest[SHA256_HEX_SIZE];
+    pid_t pid, now;
+    int err;
+
+    if ((err = instance_pid(id, &pid, digest)))
+        return err;
+
+    // Команда — не потомок процесса песочницы и не наследует его фильтр:
+    // ставим ей тот же из кэша (после setns() он в другом mount namespace),
+    // а без него отказываемся запускать
+    if (digest[0] && seccomp_load_cached(digest, &filter)) {
+        errno = EPERM;
+        return fail("Seccomp filter of sandbox %d is unavailable, "
+                    "refusing to exec\n", id);
+    }
+
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd < 0) {
+        err = fail("Failed to open pidfd of sandbox %d: %m\n", id);
+        seccomp_free(&filter);
+        return err;
+    }
+
+    // Песочница могла завершиться до pidfd_open(), а её PID — достаться
+    // другому процессу: номер освобождается только после её ожидания
+    int cgroup_fd = -1;
+    if ((err = instance_pid(id, &now, NULL)) || now != pid) {
+        errno = ESRCH;
+        if (!err)
+            err = fail("Sandbox instance %d has exited\n", id);
+        goto out;
+    }
+
+    // Политика класса задержки (batch, idle) есть только у процесса
+    // песочницы: команда копирует её, пока PID виден из нашего namespace
+    struct sched_param param;
+    int policy = sched_getscheduler(pid);
+    if (policy < 0 || sched_getparam(pid, &param)) {
+        err = fail("Failed to get scheduling policy of sandbox %d: %m\n", id);
+        goto out;
+    }
+
+    // Путь к cgroup разрешается до перехода в mount namespace песочницы
+    char cgroup_name[32];
+    snprintf(cgroup_name, sizeof(cgroup_name), "sandbox%d", id);
+    cgroup_fd = cgroup_open(cgroup_name);
+    if (cgroup_fd < 0) {
+        err = cgroup_fd;
+        goto out;
+    }
+
+    // setns() необратим, а CLONE_NEWUSER недоступен многопоточному
+    // процессу: в namespaces песочницы входит короткоживущий
+    // вспомогательный процесс и возвращает результат через канал
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC)) {
+        err = fail("Failed to create pipe: %m\n");
+        goto out;
+    }
+
+    fflush(stdout);
+    pid_t parent = getpid();
+    pid_t helper = fork();
+    if (helper < 0) {
+        err = fail("Failed to fork exec helper: %m\n");
+        close(fds[0]);
+        close(fds[1]);
+        goto out;
+    }
+
+    if (helper == 0) {
+        close(fds[0]);
+        // Команда получает SIGKILL вместе с вспомогательным процессом,
+        // а он — вместе с вызывающим
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL) || getppid() != parent)
+            _exit(1);
+        err = exec_in_sandbox(id, pidfd, cgroup_fd, policy, &param,
+                              &filter, argv);
+        _exit(write(fds[1], &err, sizeof(err)) != sizeof(err));
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], &err, sizeof(err));
+    if (n < 0)
+        err = fail("Failed to read exec helper result: %m\n");
+    close(fds[0]);
+    waitpid(helper, NULL, 0);
+
+    if (n >= 0 && n != sizeof(err)) {
+        errno = ECHILD;
+        err = fail("Exec helper of sandbox %d exited without a result\n",
+                   id);
+    }
+
+out:
+    if (cgroup_fd >= 0)
+        close(cgroup_fd);
+    close(pidfd);
+    seccomp_free(&filter);
+    return err;
+}
@@ -0,0 +1,516 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include "../include/util.h"
+#include "../include/sha256.h"
+#include "../include/seccomp.h"
+
+#if defined(__x86_64__)
+#define SECCOMP_ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define SECCOMP_ARCH AUDIT_ARCH_AARCH64
+#else
+#error "seccomp: unsupported architecture"
+#endif
+
+/**
+ * @def SECCOMP_POLICY_MAX
+ * @brief Максимальный размер файла политики, байт.
+ */
+#define SECCOMP_POLICY_MAX (64 * 1024)
+
+/**
+ * @def SECCOMP_HOT_MAX
+ * @brief Максимальное число вызовов, проверяемых до дерева поиска.
+ */
+#define SECCOMP_HOT_MAX 4
+
+#define SECCOMP_CACHE_MAGIC 0x31706373u
+
+/**
+ * @brief Имя и номер системного вызова
+ */
+struct syscall_name {
+    const char *name;
+    int nr;
+};
+
+// syscalls.h генерируется при сборке из <sys/syscall.h>: SYSCALL(read) ...
+static const struct syscall_name syscalls[] = {
+#define SYSCALL(name) { #name, __NR_##name },
+#include "syscalls.h"
+#undef SYSCALL
+};
+
+#define SYSCALLS_COUNT (sizeof(syscalls) / sizeof(syscalls[0]))
+
+/**
+ * @brief Заголовок файла кэша; за ним следуют len инструкций
+ */
+struct cache_header {
+    __u32 magic;    /**< SECCOMP_CACHE_MAGIC */
+    __u32 arch;     /**< AUDIT_ARCH_* фильтра */
+    __u32 len;      /**< Число инструкций */
+};
+
+/**
+ * @brief Разобранная политика: действие по умолчанию и разрешённые вызовы
+ *        с их весами
+ */
+struct policy {
+    __u32 def;          /**< Действие для неразрешённых вызовов */
+    int max_nr;         /**< Наибольший номер вызова в таблице */
+    uint64_t *weight;   /**< Число вызовов + 1 для разрешённых, 0 — запрещён */
+};
+
+/**
+ * @brief Диапазон номеров [lo, lo следующего диапазона) с одним действием
+ */
+struct range {
+    __u32 lo;           /**< Первый номер */
+    __u32 action;       /**< SECCOMP_RET_* */
+    uint64_t weight;    /**< Сумма весов вызовов диапазона, не меньше 1 */
+};
+
+/**
+ * @brief Программа BPF в процессе построения
+ */
+struct bpf {
+    struct sock_filter insns[BPF_MAXINSNS];
+    int len;
+};
+
+static char table_digest[SHA256_HEX_SIZE];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Считает хэш таблицы вызовов сборки: кэш другой сборки с другими
+ *        номерами не подходит
+ */
+static void hash_table(void)
+{
+    struct sha256 c;
+    char line[64];
+
+    sha256_init(&c);
+    for (size_t i = 0; i < SYSCALLS_COUNT; i++) {
+        int n = snprintf(line, sizeof(line), "%s=%d\n",
+                         syscalls[i].name, syscalls[i].nr);
+        sha256_update(&c, line, n);
+    }
+    sha256_final_hex(&c, table_digest);
+}
+
+static int syscall_nr(const char *name)
+{
+    for (size_t i = 0; i < SYSCALLS_COUNT; i++)
+        if (!strcmp(syscalls[i].name, name))
+            return syscalls[i].nr;
+    return -1;
+}
+
+/**
+ * @brief Читает файл политики целиком
+ *
+ * @return Длина или -errno
+ */
+static ssize_t read_policy(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return fail("Failed to open seccomp policy %s: %m\n", path);
+
+    ssize_t len = read(fd, buf, size);
+    int err = errno;
+    close(fd);
+    errno = err;
+    if (len < 0)
+        return fail("Failed to read seccomp policy %s: %m\n", path);
+    if ((size_t) len == size) {
+        errno = EFBIG;
+        return fail("Seccomp policy %s is too large\n", path);
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+static int parse_action(const char *name, __u32 *action)
+{
+    if (!strcmp(name, "kill"))
+        *action = SECCOMP_RET_KILL_PROCESS;
+    else if (!strcmp(name, "eperm"))
+        *action = SECCOMP_RET_ERRNO | EPERM;
+    else if (!strcmp(name, "enosys"))
+        *action = SECCOMP_RET_ERRNO | ENOSYS;
+    else if (!strcmp(name, "log"))
+        *action = SECCOMP_RET_LOG;
+    else
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Разбирает текст политики (буфер изменяется)
+ *
+ * @return 0 или -errno
+ */
+static int parse_policy(const char *path, char *text, struct policy *p)
+{
+    p->def = SECCOMP_RET_ERRNO | EPERM;
+    p->max_nr = 0;
+    for (size_t i = 0; i < SYSCALLS_COUNT; i++)
+        if (syscalls[i].nr > p->max_nr)
+            p->max_nr = syscalls[i].nr;
+
+    p->weight = calloc(p->max_nr + 1, sizeof(*p->weight));
+    if (p->weight == NULL)
+        return -ENOMEM;
+
+    // Без execve фильтр не дал бы запустить саму команду
+    p->weight[__NR_execve] = 1;
+
+    int lineno = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(text, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+
+        char name[64];
+        char arg[32];
+        int n = sscanf(line, "%63s %31s", name, arg);
+        if (n < 1)
+            continue;
+
+        if (!strcmp(name, "default")) {
+            if (n == 2 && parse_action(arg, &p->def) == 0)
+                continue;
+            errno = EINVAL;
+            return fail("%s:%d: expected default kill|eperm|enosys|log\n",
+                        path, lineno);
+        }
+
+        int nr = syscall_nr(name);
+        if (nr < 0) {
+            errno = EINVAL;
+            return fail("%s:%d: unknown system call %s\n", path, lineno, name);
+        }
+
+        char *end;
+        uint64_t count = n == 2 ? strtoull(arg, &end, 10) : 0;
+        if (n == 2 && *end != '\0') {
+            errno = EINVAL;
+            return fail("%s:%d: invalid call count %s\n", path, lineno, arg);
+        }
+        p->weight[nr] = count + 1;
+    }
+    return 0;
+}
+
+static int emit(struct bpf *b, __u16 code, __u32 k, __u8 jt, __u8 jf)
+{
+    if (b->len >= BPF_MAXINSNS)
+        return -E2BIG;
+    b->insns[b->len++] = (struct sock_filter) BPF_JUMP(code, k, jt, jf);
+    return 0;
+}
+
+/**
+ * @brief Строит дерево поиска по диапазонам [a, c)
+ *
+ * Узел — JGE по первому номеру правой половины, левая половина идёт сразу
+ * за ним, поэтому промах не стоит перехода. Граница выбирается так, чтобы
+ * веса половин были как можно ближе: частые вызовы оказываются ближе к
+ * корню. Если левая половина длиннее 8-битного смещения, переход в правую
+ * идёт через BPF_JA.
+ *
+ * @param sum Префиксные суммы весов: sum[i] — вес диапазонов [0, i)
+ * @return 0 или -E2BIG
+ */
+static int emit_tree(struct bpf *b, const struct range *r,
+                     const uint64_t *sum, int a, int c)
+{
+    if (c - a == 1)
+        return emit(b, BPF_RET | BPF_K, r[a].action, 0, 0);
+
+    int m = a + 1;
+    uint64_t best = UINT64_MAX;
+    for (int i = a + 1; i < c; i++) {
+        uint64_t left = sum[i] - sum[a];
+        uint64_t right = sum[c] - sum[i];
+        uint64_t diff = left > right ? left - right : right - left;
+        if (diff < best) {
+            best = diff;
+            m = i;
+        }
+    }
+
+    int node = b->len;
+    int err = emit(b, BPF_JMP | BPF_JGE | BPF_K, r[m].lo, 0, 0);
+    if (err || (err = emit_tree(b, r, sum, a, m)))
+        return err;
+
+    int left = b->len - node - 1;
+    if (left > 255) {
+        // Сдвигаем левую половину на одну инструкцию ради BPF_JA: смещения
+        // в ней относительные и не меняются
+        if (b->len >= BPF_MAXINSNS)
+            return -E2BIG;
+        memmove(&b->insns[node + 2], &b->insns[node + 1],
+                left * sizeof(struct sock_filter));
+        b->insns[node + 1] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JA,
+                                                           left, 0, 0);
+        b->insns[node].jf = 1;
+        b->len++;
+    } else {
+        b->insns[node].jt = left;
+    }
+
+    return emit_tree(b, r, sum, m, c);
+}
+
+/**
+ * @brief Компилирует политику в программу BPF
+ *
+ * @return 0 или -errno
+ */
+static int compile(struct policy *p, struct bpf *b)
+{
+    int n = 0;
+    int err;
+
+    // Диапазоны с одинаковым действием; последний, от max_nr + 1 до 2^32,
+    // покрывает и вызовы x32 (бит 0x40000000) и неизвестные номера
+    struct range *r = calloc(p->max_nr + 2, sizeof(*r));
+    uint64_t *sum = calloc(p->max_nr + 3, sizeof(*sum));
+    if (r == NULL || sum == NULL) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    uint64_t total = 0;
+    for (int nr = 0; nr <= p->max_nr + 1; nr++) {
+        uint64_t w = nr <= p->max_nr ? p->weight[nr] : 0;
+        __u32 action = w ? SECCOMP_RET_ALLOW : p->def;
+        if (n == 0 || r[n - 1].action != action)
+            r[n++] = (struct range) { nr, action, 1 };
+        r[n - 1].weight += w;
+        total += w;
+    }
+
+    b->len = 0;
+    emit(b, BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch), 0, 0);
+    emit(b, BPF_JMP | BPF_JEQ | BPF_K, SECCOMP_ARCH, 1, 0);
+    emit(b, BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS, 0, 0);
+    emit(b, BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr), 0, 0);
+
+    // Вызов, на который приходится больше половины оставшихся вызовов,
+    // дешевле проверить одним JEQ до дерева: остальные платят за это одно
+    // сравнение, а он экономит не меньше одного уровня дерева
+    for (int hot = 0; hot < SECCOMP_HOT_MAX; hot++) {
+        int top = -1;
+        for (int nr = 0; nr <= p->max_nr; nr++)
+            if (p->weight[nr] > 1 && (top < 0 || p->weight[nr] > p->weight[top]))
+                top = nr;
+        if (top < 0 || (p->weight[top] - 1) * 2 <= total)
+            break;
+
+        emit(b, BPF_JMP | BPF_JEQ | BPF_K, top, 0, 1);
+        emit(b, BPF_RET | BPF_K, SECCOMP_RET_ALLOW, 0, 0);
+
+        for (int i = 0; i < n; i++)
+            if ((i + 1 == n || r[i + 1].lo > (__u32) top) && r[i].lo <= (__u32) top) {
+                r[i].weight -= p->weight[top] - 1;
+                break;
+            }
+        total -= p->weight[top] - 1;
+        p->weight[top] = 1;
+    }
+
+    for (int i = 0; i < n; i++)
+        sum[i + 1] = sum[i] + r[i].weight;
+    err = emit_tree(b, r, sum, 0, n);
+    if (err)
+        fail("Seccomp policy does not fit in %d instructions\n", BPF_MAXINSNS);
+
+out:
+    free(sum);
+    free(r);
+    return err;
+}
+
+/**
+ * @brief Читает программу из кэша
+ *
+ * @return 0 или -errno (-ENOENT — программы нет в кэше)
+ */
+static int cache_read(const char *file, struct sock_fprog *prog)
+{
+    struct cache_header h;
+    struct stat st;
+
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    int err = -EINVAL;
+    if (fstat(fd, &st) == 0 && read(fd, &h, sizeof(h)) == sizeof(h) &&
+        h.magic == SECCOMP_CACHE_MAGIC && h.arch == SECCOMP_ARCH &&
+        h.len > 0 && h.len <= BPF_MAXINSNS &&
+        (size_t) st.st_size == sizeof(h) + h.len * sizeof(struct sock_filter)) {
+        size_t size = h.len * sizeof(struct sock_filter);
+        prog->filter = malloc(size);
+        if (prog->filter == NULL) {
+            err = -ENOMEM;
+        } else if (read(fd, prog->filter, size) == (ssize_t) size) {
+            prog->len = h.len;
+            err = 0;
+        } else {
+            free(prog->filter);
+            prog->filter = NULL;
+        }
+    }
+    close(fd);
+    return err;
+}
+
+/**
+ * @brief Сохраняет программу в кэш: временный файл и rename(), поэтому
+ *        параллельные запуски не видят частично записанный файл
+ */
+static int cache_write(const char *digest, const struct bpf *b)
+{
+    char file[PATH_MAX];
+    char tmp[PATH_MAX];
+    struct cache_header h = { SECCOMP_CACHE_MAGIC, SECCOMP_ARCH, b->len };
+    size_t size = b->len * sizeof(struct sock_filter);
+
+    int err = mkdirs(SECCOMP_CACHE);
+    if (err)
+        return err;
+
+    snprintf(file, sizeof(file), SECCOMP_CACHE "/%s.bpf", digest);
+    snprintf(tmp, sizeof(tmp), SECCOMP_CACHE "/.%s.%d", digest, gettid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444);
+    if (fd < 0)
+        return fail("Failed to create %s: %m\n", tmp);
+
+    if (write(fd, &h, sizeof(h)) != sizeof(h) ||
+        write(fd, b->insns, size) != (ssize_t) size)
+        err = fail("Failed to write %s: %m\n", tmp);
+    close(fd);
+
+    if (!err && rename(tmp, file))
+        err = fail("Failed to rename %s to %s: %m\n", tmp, file);
+    if (err)
+        unlink(tmp);
+    return err;
+}
+
+int seccomp_load(const char *path, struct sock_fprog *prog,
+                 char digest[SHA256_HEX_SIZE])
+{
+    char text[SECCOMP_POLICY_MAX];
+    char hex[SHA256_HEX_SIZE];
+    char file[PATH_MAX];
+    struct policy p = { 0, 0, NULL };
+    struct bpf *b = NULL;
+    struct sha256 c;
+    __u32 arch = SECCOMP_ARCH;
+    int err;
+
+    prog->filter = NULL;
+    prog->len = 0;
+
+    ssize_t len = read_policy(path, text, sizeof(text));
+    if (len < 0)
+        return len;
+
+    pthread_once(&table_once, hash_table);
+    sha256_init(&c);
+    sha256_update(&c, &arch, sizeof(arch));
+    sha256_update(&c, table_digest, SHA256_HEX_SIZE - 1);
+    sha256_update(&c, text, len);
+    sha256_final_hex(&c, hex);
+    if (digest)
+        memcpy(digest, hex, SHA256_HEX_SIZE);
+
+    // Повреждённый файл кэша перезаписывается заново скомпилированным
+    snprintf(file, sizeof(file), SECCOMP_CACHE "/%s.bpf", hex);
+    if (cache_read(file, prog) == 0)
+        return 0;
+
+    b = malloc(sizeof(*b));
+    if (b == NULL)
+        return -ENOMEM;
+    if ((err = parse_policy(path, text, &p)) || (err = compile(&p, b)))
+        goto out;
+
+    size_t size = b->len * sizeof(struct sock_filter);
+    prog->filter = malloc(size);
+    if (prog->filter == NULL) {
+        err = -ENOMEM;
+        goto out;
+    }
+    memcpy(prog->filter, b->insns, size);
+    prog->len = b->len;
+
+    // Без записи в кэш фильтр всё равно применяется: следующий запуск
+    // просто скомпилирует его снова
+    cache_write(hex, b);
+
+out:
+    free(p.weight);
+    free(b);
+    return err;
+}
+
+int seccomp_load_cached(const char *digest, struct sock_fprog *prog)
+{
+    char file[PATH_MAX];
+
+    prog->filter = NULL;
+    prog->len = 0;
+    snprintf(file, sizeof(file), SECCOMP_CACHE "/%s.bpf", digest);
+
+    int err = cache_read(file, prog);
+    if (err) {
+        errno = -err;
+        return fail("Failed to load seccomp filter %s: %m\n", file);
+    }
+    return 0;
+}
+
+int seccomp_apply(const struct sock_fprog *prog)
+{
+    // Без no_new_privs фильтр может поставить только владелец
+    // CAP_SYS_ADMIN, и setuid-файлы в песочнице не смогут обойти фильтр
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+        return fail("Failed to set no_new_privs: %m\n");
+    if (syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, prog))
+        return fail("Failed to install seccomp filter: %m\n");
+    return 0;
+}
+
+void seccomp_free(struct sock_fprog *prog)
+{
+    free(prog->filter);
+    prog->filter = NULL;
+    prog->len = 0;
+}
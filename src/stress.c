@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/wait.h>
+#include "../include/util.h"
+#include "../include/sandbox.h"
+#include "../include/timing.h"
+
+/**
+ * @def STRESS_LEVELS_MAX
+ * @brief Максимальное число уровней параллельности за один запуск.
+ */
+#define STRESS_LEVELS_MAX 32
+
+/**
+ * @def STRESS_WORKERS_MAX
+ * @brief Максимальная параллельность одного уровня.
+ */
+#define STRESS_WORKERS_MAX 1024
+
+/**
+ * @def STRESS_SETTLE_MS
+ * @brief Сколько ждать возврата ресурсов хоста к исходным значениям после
+ *        уровня: пары veth удаляются ядром асинхронно вместе с namespace.
+ */
+#define STRESS_SETTLE_MS 2000
+
+/**
+ * @brief Параметры командной строки нагрузочного теста
+ */
+struct options {
+    char **argv;                  /**< Команда, запускаемая в каждой песочнице */
+    int levels[STRESS_LEVELS_MAX];  /**< Уровни параллельности */
+    int nlevels;                  /**< Число уровней */
+    int seconds;                  /**< Длительность одного уровня */
+    const char *output;           /**< Файл для JSON с результатами */
+    struct sandbox_opts sandbox;  /**< Параметры песочниц */
+};
+
+/**
+ * @brief Растущий массив замеров одного потока
+ */
+struct samples {
+    uint64_t *v;
+    size_t n;
+    size_t cap;
+};
+
+/**
+ * @brief Поток, выполняющий циклы создание — запуск — удаление
+ */
+struct worker {
+    const struct options *opts;   /**< Параметры теста */
+    uint64_t deadline;            /**< Момент окончания уровня, мкс */
+    struct samples launch;        /**< От sandbox_create() до execvp(), мкс */
+    struct samples cycle;         /**< Полный цикл до конца sandbox_wait(), мкс */
+    int failures;                 /**< Неудачные циклы */
+    pthread_t thread;
+};
+
+/**
+ * @brief Ресурсы хоста, которые песочница занимает на время жизни
+ */
+struct resources {
+    int cgroups;    /**< cgroup экземпляров в isolate_group */
+    int links;      /**< Сетевые интерфейсы namespace хоста */
+    int mounts;     /**< Точки монтирования mount namespace хоста */
+    int fds;        /**< Открытые дескрипторы процесса */
+};
+
+/**
+ * @brief Разбирает список уровней параллельности ("1,4,16")
+ */
+static void parse_levels(const char *arg, struct options *opts)
+{
+    const char *p = arg;
+
+    opts->nlevels = 0;
+    while (*p) {
+        char *end;
+        long n = strtol(p, &end, 10);
+        if (end == p || n < 1 || n > STRESS_WORKERS_MAX ||
+            opts->nlevels == STRESS_LEVELS_MAX || (*end && *end != ','))
+            die("Invalid concurrency list %s\n", arg);
+        opts->levels[opts->nlevels++] = n;
+        p = *end ? end + 1 : end;
+    }
+    if (opts->nlevels == 0)
+        die("Invalid concurrency list %s\n", arg);
+}
+
+/**
+ * @brief Парсит аргументы командной строки, пропуская имя бинарника
+ *
+ * Поддерживаемые опции:
+ *   --concurrency L  уровни параллельности через запятую (по умолчанию 1,4,16)
+ *   --seconds N      длительность каждого уровня (по умолчанию 5)
+ *   --output FILE    файл для JSON с результатами (по умолчанию stress.json)
+ *   --rootfs PATH    корневая файловая система песочниц (каталог или образ)
+ *   --overlay        смонтировать rootfs как нижний слой overlay
+ *   --net-driver D   интерфейсы песочниц: veth, veth-mq, ipvlan, macvlan, netkit
+ *   --uplink IF      интерфейс хоста для ipvlan и macvlan
+ *   --seccomp FILE   политика seccomp
+ *   --profile P      класс задержки песочниц
+ *
+ * @param argc Количество аргументов
+ * @param argv Массив аргументов
+ * @param opts Структура параметров для заполнения
+ */
+static void parse_args(int argc, char **argv, struct options *opts)
+{
+#define NEXT_ARG() do { argc--; argv++; } while (0)
+#define ARG_VALUE() do { \
+        NEXT_ARG(); \
+        if (argc < 1) \
+            die("Option %s requires a value\n", argv[-1]); \
+    } while (0)
+
+    NEXT_ARG();
+
+    while (argc > 0 && argv[0][0] == '-') {
+        if (!strcmp(argv[0], "--")) {
+            NEXT_ARG();
+            break;
+        } else if (!strcmp(argv[0], "--concurrency")) {
+            ARG_VALUE();
+            parse_levels(argv[0], opts);
+        } else if (!strcmp(argv[0], "--seconds")) {
+            ARG_VALUE();
+            opts->seconds = atoi(argv[0]);
+        } else if (!strcmp(argv[0], "--output")) {
+            ARG_VALUE();
+            opts->output = argv[0];
+        } else if (!strcmp(argv[0], "--rootfs")) {
+            ARG_VALUE();
+            opts->sandbox.rootfs = argv[0];
+        } else if (!strcmp(argv[0], "--overlay")) {
+            opts->sandbox.overlay = 1;
+        } else if (!strcmp(argv[0], "--net-driver")) {
+            ARG_VALUE();
+            opts->sandbox.net.driver = net_driver_parse(argv[0]);
+        } else if (!strcmp(argv[0], "--uplink")) {
+            ARG_VALUE();
+            opts->sandbox.net.uplink = argv[0];
+        } else if (!strcmp(argv[0], "--seccomp")) {
+            ARG_VALUE();
+            opts->sandbox.seccomp = argv[0];
+        } else if (!strcmp(argv[0], "--profile")) {
+            ARG_VALUE();
+            opts->sandbox.profile = profile_parse(argv[0]);
+        } else {
+            die("Unknown option %s\n", argv[0]);
+        }
+        NEXT_ARG();
+    }
+
+    if (argc < 1)
+        die("Usage: isolate-stress [--concurrency 1,4,16] [--seconds N] "
+            "[--output FILE] [--rootfs PATH] [--overlay] [--net-driver D] "
+            "[--uplink IF] [--seccomp FILE] [--profile P] -- CMD [ARGS...]\n");
+    if (opts->seconds < 1)
+        die("Invalid duration: %d\n", opts->seconds);
+
+    opts->argv = argv;
+#undef ARG_VALUE
+#undef NEXT_ARG
+}
+
+static void push(struct samples *s, uint64_t v)
+{
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->v = realloc(s->v, s->cap * sizeof(*s->v));
+        if (s->v == NULL)
+            die("Failed to allocate samples: %m\n");
+    }
+    s->v[s->n++] = v;
+}
+
+/**
+ * @brief Дописывает замеры src в конец dst
+ */
+static void merge(struct samples *dst, const struct samples *src)
+{
+    for (size_t i = 0; i < src->n; i++)
+        push(dst, src->v[i]);
+}
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = arg;
+    const struct options *opts = w->opts;
+
+    while (timing_now_us() < w->deadline) {
+        struct sandbox sb;
+        uint64_t start = timing_now_us();
+
+        if (sandbox_create(&sb, &opts->sandbox, opts->argv)) {
+            w->failures++;
+            continue;
+        }
+        int err = sandbox_await_exec(&sb);
+        uint64_t launched = timing_now_us();
+        int status = sandbox_wait(&sb);
+
+        if (err || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            w->failures++;
+            continue;
+        }
+        push(&w->launch, launched - start);
+        push(&w->cycle, timing_now_us() - start);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Считает записи каталога, кроме "." и ".."
+ */
+static int count_entries(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        die("Failed to open %s: %m\n", path);
+
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL)
+        if (de->d_name[0] != '.')
+            n++;
+    closedir(dir);
+    return n;
+}
+
+/**
+ * @brief Считает строки файла
+ */
+static int count_lines(const char *path)
+{
+    FILE *f = fopen(path, "re");
+    if (f == NULL)
+        die("Failed to open %s: %m\n", path);
+
+    int n = 0;
+    int c;
+    while ((c = getc(f)) != EOF)
+        n += c == '\n';
+    fclose(f);
+    return n;
+}
+
+static void snapshot(struct resources *r)
+{
+    struct if_nameindex *links = if_nameindex();
+    if (links == NULL)
+        die("Failed to list network interfaces: %m\n");
+    r->links = 0;
+    while (links[r->links].if_index)
+        r->links++;
+    if_freenameindex(links);
+
+    r->cgroups = cgroup_count_instances();
+    if (r->cgroups < 0)
+        die("Failed to count cgroups\n");
+    r->mounts = count_lines("/proc/self/mountinfo");
+    // Дескриптор самого каталога /proc/self/fd есть в обоих снимках
+    r->fds = count_entries("/proc/self/fd");
+}
+
+/**
+ * @brief Ждёт, пока ресурсы хоста вернутся к исходным, не дольше
+ *        STRESS_SETTLE_MS, и возвращает оставшуюся разницу
+ *
+ * @param base Снимок до уровня
+ * @param leaks Занятые после уровня ресурсы (после минус до)
+ * @return 1, если что-то не освободилось
+ */
+static int check_leaks(const struct resources *base, struct resources *leaks)
+{
+    uint64_t deadline = timing_now_us() + STRESS_SETTLE_MS * 1000ull;
+
+    for (;;) {
+        struct resources now;
+        snapshot(&now);
+        leaks->cgroups = now.cgroups - base->cgroups;
+        leaks->links = now.links - base->links;
+        leaks->mounts = now.mounts - base->mounts;
+        leaks->fds = now.fds - base->fds;
+
+        int leaked = leaks->cgroups > 0 || leaks->links > 0 ||
+                     leaks->mounts > 0 || leaks->fds > 0;
+        if (!leaked || timing_now_us() >= deadline)
+            return leaked;
+        usleep(10000);
+    }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Перцентиль по методу ближайшего ранга
+ */
+static uint64_t percentile(const uint64_t *sorted, size_t n, int p)
+{
+    size_t rank = (n * p + 99) / 100;
+    return n ? sorted[rank > 0 ? rank - 1 : 0] : 0;
+}
+
+/**
+ * @brief Записывает перцентили замеров одним JSON-объектом
+ *
+ * @param s Замеры (сортируются на месте)
+ */
+static void write_percentiles(FILE *f, const char *name, struct samples *s)
+{
+    qsort(s->v, s->n, sizeof(*s->v), cmp_u64);
+    fprintf(f, "\"%s\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}",
+            name, (unsigned long long) percentile(s->v, s->n, 50),
+            (unsigned long long) percentile(s->v, s->n, 90),
+            (unsigned long long) percentile(s->v, s->n, 99),
+            (unsigned long long) (s->n ? s->v[s->n - 1] : 0));
+}
+
+/**
+ * @brief Выполняет один уровень: concurrency потоков в течение opts->seconds
+ *        создают, запускают и удаляют песочницы, затем проверяются утечки
+ *
+ * @return 1, если были неудачные запуски или утечки
+ */
+static int run_level(FILE *f, const struct options *opts, int concurrency)
+{
+    struct worker *workers = calloc(concurrency, sizeof(*workers));
+    struct samples launch = { NULL, 0, 0 };
+    struct samples cycle = { NULL, 0, 0 };
+    struct resources base;
+    struct resources leaks;
+    int failures = 0;
+
+    if (workers == NULL)
+        die("Failed to allocate workers: %m\n");
+
+    snapshot(&base);
+    uint64_t start = timing_now_us();
+    for (int i = 0; i < concurrency; i++) {
+        workers[i].opts = opts;
+        workers[i].deadline = start + opts->seconds * 1000000ull;
+        if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]))
+            die("Failed to start worker\n");
+    }
+    for (int i = 0; i < concurrency; i++) {
+        pthread_join(workers[i].thread, NULL);
+        merge(&launch, &workers[i].launch);
+        merge(&cycle, &workers[i].cycle);
+        failures += workers[i].failures;
+        free(workers[i].launch.v);
+        free(workers[i].cycle.v);
+    }
+    uint64_t elapsed = timing_now_us() - start;
+    free(workers);
+
+    int leaked = check_leaks(&base, &leaks);
+    double per_sec = elapsed ? launch.n * 1e6 / elapsed : 0;
+
+    fprintf(f, "{\"concurrency\":%d,\"launches\":%zu,\"failures\":%d,"
+               "\"elapsed_us\":%llu,\"launches_per_sec\":%.1f,",
+            concurrency, launch.n, failures,
+            (unsigned long long) elapsed, per_sec);
+    write_percentiles(f, "launch_us", &launch);
+    fputc(',', f);
+    write_percentiles(f, "cycle_us", &cycle);
+    fprintf(f, ",\"leaks\":{\"cgroups\":%d,\"links\":%d,\"mounts\":%d,"
+               "\"fds\":%d}}",
+            leaks.cgroups, leaks.links, leaks.mounts, leaks.fds);
+
+    fprintf(stderr, "%11d %9.1f %8d %8llu %8llu %8llu %8llu  %s\n",
+            concurrency, per_sec, failures,
+            (unsigned long long) percentile(launch.v, launch.n, 50),
+            (unsigned long long) percentile(launch.v, launch.n, 99),
+            (unsigned long long) percentile(cycle.v, cycle.n, 50),
+            (unsigned long long) percentile(cycle.v, cycle.n, 99),
+            leaked ? "LEAK" : "ok");
+    if (leaked)
+        fprintf(stderr, "leaked after %d ms: cgroups=%d links=%d mounts=%d "
+                        "fds=%d\n", STRESS_SETTLE_MS, leaks.cgroups,
+                leaks.links, leaks.mounts, leaks.fds);
+
+    free(launch.v);
+    free(cycle.v);
+    return failures > 0 || leaked;
+}
+
+/**
+ * @brief Нагрузочный тест: на каждом уровне параллельности потоки в течение
+ *        заданного времени непрерывно создают песочницы, запускают команду и
+ *        удаляют их; сохраняет устойчивую частоту запусков, перцентили
+ *        задержки запуска и полного цикла и утечки ресурсов хоста.
+ */
+int main(int argc, char **argv)
+{
+    struct options opts;
+    memset(&opts, 0, sizeof(struct options));
+    opts.levels[0] = 1;
+    opts.levels[1] = 4;
+    opts.levels[2] = 16;
+    opts.nlevels = 3;
+    opts.seconds = 5;
+    opts.output = "stress.json";
+    opts.sandbox.rootfs = SANDBOX_ROOTFS;
+
+    parse_args(argc, argv, &opts);
+
+    // Вывод песочниц не должен искажать замеры. Копия stdout не должна
+    // попадать в песочницы и в базовую линию проверки утечек дескрипторов
+    int out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (out < 0 || null < 0 || dup2(null, STDOUT_FILENO) < 0)
+        die("Failed to redirect stdout: %m\n");
+    close(null);
+
+    FILE *f = fopen(opts.output, "we");
+    if (f == NULL)
+        die("Failed to open file %s: %m\n", opts.output);
+
+    fprintf(f, "{\"command\":\"%s\",\"seconds\":%d,\"levels\":[",
+            opts.argv[0], opts.seconds);
+    fprintf(stderr, "%11s %9s %8s %8s %8s %8s %8s  %s\n", "concurrency",
+            "launch/s", "failures", "launch50", "launch99", "cycle50",
+            "cycle99", "leaks");
+
+    int bad = 0;
+    for (int i = 0; i < opts.nlevels; i++) {
+        if (i > 0)
+            fputc(',', f);
+        bad |= run_level(f, &opts, opts.levels[i]);
+    }
+    fprintf(f, "]}\n");
+
+    if (fclose(f) != 0)
+        die("Failed to close file %s: %m\n", opts.output);
+
+    fflush(stdout);
+    if (dup2(out, STDOUT_FILENO) < 0)
+        die("Failed to restore stdout: %m\n");
+    close(out);
+
+    fprintf(stderr, "-> %s\n", opts.output);
+    return bad;
+}
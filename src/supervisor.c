@@ -0,0 +1,607 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include "../include/util.h"
+#include "../include/supervisor.h"
+
+/**
+ * @brief Читает значение ключа из файла вида "ключ значение" (cgroup.events,
+ *        memory.events) через уже открытый дескриптор.
+ *
+ * Чтение с начала файла сбрасывает уведомление kernfs, поэтому следующее
+ * EPOLLPRI придёт только при новом изменении.
+ *
+ * @return Значение или -1, если ключа нет
+ */
+static long long read_key(int fd, const char *key)
+{
+    char buf[512];
+    size_t klen = strlen(key);
+
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len < 0)
+        return -1;
+    buf[len] = '\0';
+
+    for (char *line = buf; *line; ) {
+        if (!strncmp(line, key, klen) && line[klen] == ' ')
+            return strtoll(line + klen + 1, NULL, 10);
+        char *next = strchr(line, '\n');
+        if (next == NULL)
+            break;
+        line = next + 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief Регистрирует источник в epoll. Дескриптор запоминается и при
+ *        неудаче, чтобы его закрыл release()
+ *
+ * @return 0 или -errno
+ */
+static int watch_fd(struct supervisor *s, struct supervisor_watch *w,
+                    enum supervisor_kind kind, int fd, uint32_t events)
+{
+    struct supervisor_source *src = &w->src[kind];
+    src->w = w;
+    src->kind = kind;
+    src->fd = fd;
+
+    struct epoll_event ev = { .events = events, .data.ptr = src };
+    if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev))
+        return fail("Failed to watch sandbox %d: %m\n", w->sb->id);
+    return 0;
+}
+
+/**
+ * @brief Снимает источник с epoll и при необходимости закрывает дескриптор
+ */
+static void unwatch_fd(struct supervisor *s, struct supervisor_source *src,
+                       int close_fd)
+{
+    if (src->fd < 0)
+        return;
+    epoll_ctl(s->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    if (close_fd)
+        close(src->fd);
+    src->fd = -1;
+}
+
+/**
+ * @brief Снимает с epoll все источники наблюдения и закрывает его
+ *        собственные дескрипторы
+ */
+static void release(struct supervisor *s, struct supervisor_watch *w)
+{
+    // pidfd и каналы журналов принадлежат песочнице: их закроет
+    // sandbox_wait()
+    unwatch_fd(s, &w->src[SUPERVISOR_PIDFD], 0);
+    unwatch_fd(s, &w->src[SUPERVISOR_LOG_STDOUT], 0);
+    unwatch_fd(s, &w->src[SUPERVISOR_LOG_STDERR], 0);
+    for (int i = SUPERVISOR_CGROUP_EVENTS; i < SUPERVISOR_SOURCES; i++)
+        unwatch_fd(s, &w->src[i], i < SUPERVISOR_PSI_TRIGGER);
+    psi_detach(&w->psi);
+}
+
+/**
+ * @brief Открывает файл событий cgroup экземпляра
+ *
+ * @return Дескриптор, -ENOENT без контроллера или -errno
+ */
+static int open_events(struct sandbox *sb, const char *file)
+{
+    int fd = openat(sb->cgroup, file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return -ENOENT;
+        return fail("Failed to open %s of sandbox %d: %m\n", file, sb->id);
+    }
+    return fd;
+}
+
+/**
+ * @return Дескриптор timerfd или -errno
+ */
+static int create_timer(uint64_t us, int periodic)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = us / 1000000;
+    its.it_value.tv_nsec = (us % 1000000) * 1000;
+    if (periodic)
+        its.it_interval = its.it_value;
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return fail("Failed to create timer: %m\n");
+    if (timerfd_settime(fd, 0, &its, NULL)) {
+        int err = fail("Failed to create timer: %m\n");
+        close(fd);
+        return err;
+    }
+    return fd;
+}
+
+void supervisor_init(struct supervisor *s)
+{
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (s->epfd < 0)
+        die("Failed to create epoll: %m\n");
+    s->watches = 0;
+    s->active = NULL;
+    s->net_tick.w = NULL;
+    s->net_tick.kind = SUPERVISOR_NET_TICK;
+    s->net_tick.fd = -1;
+    s->net_sock = -1;
+    s->net_rx.buf = NULL;
+    s->net_rx.size = 0;
+}
+
+/**
+ * @brief Запускает общий таймер сбора сетевых счётчиков и открывает сокет
+ *        для их дампа
+ *
+ * @return 0 или -errno
+ */
+static int start_net_stats(struct supervisor *s, uint64_t interval_ms)
+{
+    int err;
+
+    s->net_sock = create_socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+                                NETLINK_ROUTE);
+    if (s->net_sock < 0)
+        return fail("Failed to open netlink socket for network stats\n");
+
+    s->net_tick.fd = create_timer(interval_ms * 1000, 1);
+    if (s->net_tick.fd < 0) {
+        err = s->net_tick.fd;
+        goto fail;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &s->net_tick };
+    if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->net_tick.fd, &ev)) {
+        err = fail("Failed to watch network stats timer: %m\n");
+        close(s->net_tick.fd);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    s->net_tick.fd = -1;
+    close(s->net_sock);
+    s->net_sock = -1;
+    return err;
+}
+
+/**
+ * @brief Создаёт таймер и регистрирует его как источник наблюдения
+ *
+ * @return 0 или -errno
+ */
+static int watch_timer(struct supervisor *s, struct supervisor_watch *w,
+                       enum supervisor_kind kind, uint64_t us, int periodic)
+{
+    int fd = create_timer(us, periodic);
+    if (fd < 0)
+        return fd;
+    return watch_fd(s, w, kind, fd, EPOLLIN);
+}
+
+int supervisor_add(struct supervisor *s, struct supervisor_watch *w,
+                   struct sandbox *sb, const struct supervisor_limits *limits,
+                   void *data)
+{
+    int err;
+
+    memset(w, 0, sizeof(*w));
+    w->sb = sb;
+    w->data = data;
+    for (int i = 0; i < SUPERVISOR_SOURCES; i++)
+        w->src[i].fd = -1;
+
+    if (sb->pidfd < 0) {
+        errno = ENOSYS;
+        return fail("Supervision requires pidfd support\n");
+    }
+    if ((err = watch_fd(s, w, SUPERVISOR_PIDFD, sb->pidfd, EPOLLIN)))
+        goto fail;
+
+    // Без cgroup.events пустой считается cgroup, процесс которой завершился
+    int fd = open_events(sb, "cgroup.events");
+    if (fd >= 0) {
+        w->populated = read_key(fd, "populated") > 0;
+        err = watch_fd(s, w, SUPERVISOR_CGROUP_EVENTS, fd, EPOLLPRI);
+    } else if (fd != -ENOENT) {
+        err = fd;
+    }
+    if (err)
+        goto fail;
+
+    fd = open_events(sb, "memory.events");
+    if (fd >= 0) {
+        w->oom_kills = read_key(fd, "oom_kill");
+        err = watch_fd(s, w, SUPERVISOR_MEMORY_EVENTS, fd, EPOLLPRI);
+    } else if (fd != -ENOENT) {
+        err = fd;
+    }
+    if (err)
+        goto fail;
+
+    if (limits->timeout_ms > 0 &&
+        (err = watch_timer(s, w, SUPERVISOR_TIMEOUT,
+                           limits->timeout_ms * 1000, 0)))
+        goto fail;
+
+    if (limits->psi.mem_max > 0 || limits->psi.cpu_max > 0) {
+        // Без триггеров песочница работает с лимитами на верхних границах
+        if (psi_attach(&w->psi, sb->cgroup, sb->id, &limits->psi))
+            fprintf(stderr, "supervisor: id=%d running without adaptive "
+                            "limits\n", sb->id);
+        for (int i = 0; i < w->psi.n; i++)
+            if ((err = watch_fd(s, w, SUPERVISOR_PSI_TRIGGER + i,
+                                w->psi.res[i].fd, EPOLLPRI)))
+                goto fail;
+        if (w->psi.n > 0 &&
+            (err = watch_timer(s, w, SUPERVISOR_PSI_TICK, PSI_WINDOW_US, 1)))
+            goto fail;
+    }
+
+    // Лимит скорости журналов приостанавливает каналы до таймера
+    if (sb->log.opts) {
+        for (int i = 0; i < CAPTURE_STREAMS; i++)
+            if (sb->log.s[i].pipe >= 0 &&
+                (err = watch_fd(s, w, SUPERVISOR_LOG_STDOUT + i,
+                                sb->log.s[i].pipe, EPOLLIN)))
+                goto fail;
+        if (sb->log.opts->rate > 0 &&
+            (err = watch_timer(s, w, SUPERVISOR_LOG_RESUME, 0, 0)))
+            goto fail;
+    }
+
+    if (limits->net_stats_ms > 0 && s->net_tick.fd < 0 &&
+        (err = start_net_stats(s, limits->net_stats_ms)))
+        goto fail;
+
+    w->next = s->active;
+    if (s->active)
+        s->active->pprev = &w->next;
+    w->pprev = &s->active;
+    s->active = w;
+    s->watches++;
+    return 0;
+
+fail:
+    release(s, w);
+    return err;
+}
+
+/**
+ * @brief Обработчик дампа счётчиков: находит песочницу по индексу её
+ *        интерфейса на стороне хоста
+ */
+static void store_net_stats(int ifindex, const struct net_stats *st, void *arg)
+{
+    struct supervisor *s = arg;
+
+    for (struct supervisor_watch *w = s->active; w; w = w->next) {
+        if (w->sb->ifindex == ifindex && w->sb->nl < 0) {
+            w->sb->net_stats = *st;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Завершает песочницу, за которой супервизор не может следить дальше;
+ *        наблюдение закончится обычным путём по её pidfd
+ */
+static void abort_watch(struct supervisor_watch *w)
+{
+    fprintf(stderr, "supervisor: id=%d cannot be supervised, killing\n",
+            w->sb->id);
+    if (syscall(SYS_pidfd_send_signal, w->sb->pidfd, SIGKILL, NULL, 0) &&
+        errno != ESRCH)
+        fprintf(stderr, "supervisor: failed to kill sandbox %d: %m\n",
+                w->sb->id);
+}
+
+/**
+ * @brief Обновляет счётчики perf_event песочницы и пишет их в stderr
+ */
+static void perf_event(struct sandbox *sb)
+{
+    const struct perf_counts *c = &sb->perf_counts;
+    const uint64_t *v = c->value;
+
+    perf_read(&sb->perf, &sb->perf_counts);
+    if (c->hardware)
+        fprintf(stderr, "supervisor: id=%d perf cycles=%llu instructions=%llu "
+                        "ipc=%.3f llc_misses=%llu ",
+                sb->id, (unsigned long long) v[PERF_CYCLES],
+                (unsigned long long) v[PERF_INSTRUCTIONS],
+                v[PERF_CYCLES] ? (double) v[PERF_INSTRUCTIONS] / v[PERF_CYCLES] : 0,
+                (unsigned long long) v[PERF_LLC_MISSES]);
+    else
+        fprintf(stderr, "supervisor: id=%d perf ", sb->id);
+    fprintf(stderr, "context_switches=%llu cpu_clock_ns=%llu cpus=%s%s\n",
+            (unsigned long long) v[PERF_CONTEXT_SWITCHES],
+            (unsigned long long) v[PERF_CPU_CLOCK], c->cpus,
+            c->multiplexed ? " multiplexed" : "");
+}
+
+/**
+ * @brief Обновляет сетевые счётчики и потребление ресурсов всех
+ *        наблюдаемых песочниц и пишет их в stderr
+ */
+static void net_stats_event(struct supervisor *s)
+{
+    uint64_t expirations;
+    if (read(s->net_tick.fd, &expirations, sizeof(expirations)) < 0 ||
+        s->active == NULL)
+        return;
+
+    if (net_stats_dump(s->net_sock, &s->net_rx, store_net_stats, s))
+        return;
+
+    for (struct supervisor_watch *w = s->active; w; w = w->next) {
+        struct sandbox *sb = w->sb;
+        const struct net_stats *st = &sb->net_stats;
+
+        if (w->exited)
+            continue;
+        if (sb->perf.fd)
+            perf_event(sb);
+        // Счётчики ipvlan и macvlan в общий дамп хоста не попадают
+        if (sb->nl >= 0)
+            sandbox_net_stats(sb, s->net_sock, &s->net_rx, &sb->net_stats);
+        else if (!sb->ifindex)
+            continue;
+        cgroup_read_usage(sb->cgroup, &sb->usage);
+        fprintf(stderr, "supervisor: id=%d net rx_bytes=%llu tx_bytes=%llu "
+                        "rx_packets=%llu tx_packets=%llu dropped=%llu/%llu "
+                        "errors=%llu/%llu cpu_usec=%lld memory_peak=%lld\n",
+                sb->id, (unsigned long long) st->rx_bytes,
+                (unsigned long long) st->tx_bytes,
+                (unsigned long long) st->rx_packets,
+                (unsigned long long) st->tx_packets,
+                (unsigned long long) st->rx_dropped,
+                (unsigned long long) st->tx_dropped,
+                (unsigned long long) st->rx_errors,
+                (unsigned long long) st->tx_errors,
+                sb->usage.cpu_usage_usec, sb->usage.memory_peak);
+    }
+}
+
+static void memory_event(struct supervisor_watch *w)
+{
+    long long n = read_key(w->src[SUPERVISOR_MEMORY_EVENTS].fd, "oom_kill");
+
+    if (n > w->oom_kills)
+        fprintf(stderr, "supervisor: id=%d oom_kill count=%lld\n",
+                w->sb->id, n);
+    w->oom_kills = n;
+}
+
+static void timeout_event(struct supervisor_watch *w)
+{
+    uint64_t expirations;
+    if (read(w->src[SUPERVISOR_TIMEOUT].fd, &expirations, sizeof(expirations)) < 0)
+        return;
+
+    fprintf(stderr, "supervisor: id=%d timed out, killing\n", w->sb->id);
+    w->timed_out = 1;
+
+    // Завершение init PID namespace завершает все процессы песочницы
+    if (syscall(SYS_pidfd_send_signal, w->sb->pidfd, SIGKILL, NULL, 0) &&
+        errno != ESRCH)
+        fprintf(stderr, "supervisor: failed to kill sandbox %d: %m\n",
+                w->sb->id);
+}
+
+/**
+ * @brief Переносит вывод песочницы в журнал; при исчерпании лимита снимает
+ *        канал с epoll и взводит таймер возобновления
+ */
+static void log_event(struct supervisor *s, struct supervisor_watch *w,
+                      struct supervisor_source *src)
+{
+    int i = src->kind - SUPERVISOR_LOG_STDOUT;
+    uint64_t wait_us;
+
+    int ret = capture_pump(&w->sb->log, i, &wait_us);
+    if (ret == 0)
+        return;
+    if (ret < 0) {
+        // Конец потока или ошибка записи: канал закроет sandbox_wait()
+        unwatch_fd(s, src, 0);
+        return;
+    }
+
+    // Снимаем канал с epoll, а не только EPOLLIN: закрытый писателем канал
+    // сообщал бы EPOLLHUP и во время паузы
+    epoll_ctl(s->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    w->log_paused |= 1 << i;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = wait_us / 1000000;
+    its.it_value.tv_nsec = (wait_us % 1000000) * 1000;
+    timerfd_settime(w->src[SUPERVISOR_LOG_RESUME].fd, 0, &its, NULL);
+}
+
+static void log_resume(struct supervisor *s, struct supervisor_watch *w)
+{
+    uint64_t expirations;
+    if (read(w->src[SUPERVISOR_LOG_RESUME].fd, &expirations,
+             sizeof(expirations)) < 0)
+        return;
+
+    for (int i = 0; i < CAPTURE_STREAMS; i++) {
+        struct supervisor_source *src = &w->src[SUPERVISOR_LOG_STDOUT + i];
+        if (!(w->log_paused & (1 << i)) || src->fd < 0)
+            continue;
+
+        // Без канала в epoll песочница заблокируется на записи
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = src };
+        if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, src->fd, &ev)) {
+            fprintf(stderr, "supervisor: failed to watch sandbox %d: %m\n",
+                    w->sb->id);
+            src->fd = -1;
+            abort_watch(w);
+        }
+    }
+    w->log_paused = 0;
+}
+
+/**
+ * @brief Фиксирует завершение процесса песочницы и его причину; сам процесс
+ *        остаётся зомби до sandbox_wait()
+ */
+static void exit_event(struct supervisor *s, struct supervisor_watch *w)
+{
+    struct sandbox *sb = w->sb;
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+
+    // pidfd остаётся читаемым: снимаем его с epoll, закроет sandbox_wait()
+    unwatch_fd(s, &w->src[SUPERVISOR_PIDFD], 0);
+    w->exited = 1;
+
+    // Статус всё равно получит sandbox_wait(); здесь нужна только причина
+    if (waitid(P_PIDFD, sb->pidfd, &info, WEXITED | WNOWAIT) == -1) {
+        fprintf(stderr, "supervisor: failed to wait pid %d: %m\n", sb->pid);
+        sb->reason = w->timed_out ? "timeout" :
+                     w->oom_kills > 0 ? "oom_kill" : NULL;
+        return;
+    }
+
+    // memory.events мог измениться в той же пачке событий
+    if (w->src[SUPERVISOR_MEMORY_EVENTS].fd >= 0)
+        memory_event(w);
+
+    if (w->timed_out)
+        sb->reason = "timeout";
+    else if (w->oom_kills > 0)
+        sb->reason = "oom_kill";
+    else
+        sb->reason = info.si_code == CLD_EXITED ? "exited" : "signaled";
+
+    if (info.si_code == CLD_EXITED && !strcmp(sb->reason, "exited"))
+        return;
+
+    fprintf(stderr, "supervisor: id=%d pid=%d %s %d reason=%s\n", sb->id, sb->pid,
+            info.si_code == CLD_EXITED ? "exit_code" : "signal",
+            info.si_status, sb->reason);
+}
+
+static void finish(struct supervisor *s, struct supervisor_watch *w)
+{
+    // Каналы журналов дочитает sandbox_wait()
+    release(s, w);
+
+    *w->pprev = w->next;
+    if (w->next)
+        w->next->pprev = w->pprev;
+
+    w->status = sandbox_wait(w->sb);
+    w->done = 1;
+    s->watches--;
+}
+
+int supervisor_dispatch(struct supervisor *s, int timeout_ms,
+                        struct supervisor_watch **done, int max)
+{
+    struct epoll_event ev[SUPERVISOR_EVENTS_MAX];
+    int ndone = 0;
+
+    int n = epoll_wait(s->epfd, ev,
+                       max < SUPERVISOR_EVENTS_MAX ? max : SUPERVISOR_EVENTS_MAX,
+                       timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR)
+            return 0;
+        return fail("epoll_wait failed: %m\n");
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct supervisor_source *src = ev[i].data.ptr;
+        struct supervisor_watch *w = src->w;
+
+        if (src->kind == SUPERVISOR_NET_TICK) {
+            net_stats_event(s);
+            continue;
+        }
+
+        // Источник мог быть снят обработкой предыдущего события пачки
+        if (w->done || src->fd < 0)
+            continue;
+
+        switch (src->kind) {
+            case SUPERVISOR_PIDFD:
+                exit_event(s, w);
+                break;
+            case SUPERVISOR_CGROUP_EVENTS:
+                w->populated = read_key(src->fd, "populated") > 0;
+                break;
+            case SUPERVISOR_MEMORY_EVENTS:
+                memory_event(w);
+                break;
+            case SUPERVISOR_TIMEOUT:
+                timeout_event(w);
+                unwatch_fd(s, src, 1);
+                break;
+            case SUPERVISOR_LOG_STDOUT:
+            case SUPERVISOR_LOG_STDERR:
+                log_event(s, w, src);
+                break;
+            case SUPERVISOR_LOG_RESUME:
+                log_resume(s, w);
+                break;
+            case SUPERVISOR_PSI_TICK: {
+                uint64_t expirations;
+                if (read(src->fd, &expirations, sizeof(expirations)) > 0)
+                    psi_tick(&w->psi);
+                break;
+            }
+            default:
+                // EPOLLERR на триггере: cgroup удалена
+                if (ev[i].events & EPOLLERR)
+                    unwatch_fd(s, src, 0);
+                else
+                    psi_trigger(&w->psi, src->kind - SUPERVISOR_PSI_TRIGGER);
+                break;
+        }
+
+        if (w->exited && !w->populated) {
+            finish(s, w);
+            done[ndone++] = w;
+        }
+    }
+
+    return ndone;
+}
+
+void supervisor_close(struct supervisor *s)
+{
+    if (s->net_tick.fd >= 0)
+        close(s->net_tick.fd);
+    s->net_tick.fd = -1;
+    if (s->net_sock >= 0)
+        close(s->net_sock);
+    s->net_sock = -1;
+    nl_rx_free(&s->net_rx);
+    close(s->epfd);
+    s->epfd = -1;
+}
@@ -0,0 +1,45 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "../include/timing.h"
+
+static const char *const names[TIMING_PHASES] = {
+        [TIMING_CLONE] = "clone",
+        [TIMING_CGROUP] = "cgroup",
+        [TIMING_IDMAP] = "idmap",
+        [TIMING_VETH] = "veth",
+        [TIMING_ADDR] = "addr",
+        [TIMING_PIVOT_ROOT] = "pivot_root",
+        [TIMING_PROCFS] = "procfs",
+        [TIMING_SECCOMP] = "seccomp",
+        [TIMING_EXEC] = "execvp",
+};
+
+uint64_t timing_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+const char *timing_name(enum timing_phase phase)
+{
+    return names[phase];
+}
+
+uint64_t timing_total_us(const struct timings *t)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < TIMING_PHASES; i++)
+        total += t->us[i];
+    return total;
+}
+
+void timing_write_json(FILE *f, const struct timings *t)
+{
+    fputc('{', f);
+    for (int i = 0; i < TIMING_PHASES; i++)
+        fprintf(f, "\"%s\":%llu,", names[i], (unsigned long long) t->us[i]);
+    fprintf(f, "\"total\":%llu}", (unsigned long long) timing_total_us(t));
+}
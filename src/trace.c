@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/util.h"
+#include "../include/timing.h"
+#include "../include/trace.h"
+
+/**
+ * @brief Состояние трассировки процесса
+ */
+static struct {
+    FILE *file;                                 /**< Файл трассы или NULL */
+    int count;                                  /**< Число записанных событий */
+    int buffered;                               /**< Накапливать шаги в памяти */
+    int nbuf;                                   /**< Число накопленных шагов */
+    struct trace_event buf[TRACE_BUFFER_MAX];   /**< Накопленные шаги */
+} trace;
+
+/**
+ * @brief Записывает одно событие строкой JSON-массива
+ */
+static void write_event(const char *fmt, ...)
+{
+    va_list ap;
+
+    fputs(trace.count++ ? "," : "", trace.file);
+    va_start(ap, fmt);
+    vfprintf(trace.file, fmt, ap);
+    va_end(ap);
+    fputc('\n', trace.file);
+}
+
+static void write_process_name(pid_t pid, const char *label)
+{
+    write_event("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", pid, label);
+}
+
+static void write_span(pid_t pid, const char *name, uint64_t ts, uint64_t dur)
+{
+    write_event("{\"name\":\"%s\",\"cat\":\"isolate\",\"ph\":\"X\","
+                "\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d}",
+                name, (unsigned long long) ts, (unsigned long long) dur,
+                pid, pid);
+}
+
+int trace_open(const char *path)
+{
+    trace.file = fopen(path, "we");
+    if (trace.file == NULL)
+        return fail("Failed to open trace file %s: %m\n", path);
+    setvbuf(trace.file, NULL, _IOLBF, 0);
+
+    fputs("[\n", trace.file);
+    write_process_name(getpid(), "isolate");
+    return 0;
+}
+
+int trace_close(void)
+{
+    if (trace.file == NULL)
+        return 0;
+
+    fputs("]\n", trace.file);
+    int err = fclose(trace.file) ? fail("Failed to close trace file: %m\n") : 0;
+    trace.file = NULL;
+    return err;
+}
+
+int trace_enabled(void)
+{
+    return trace.file != NULL;
+}
+
+uint64_t trace_begin(void)
+{
+    return trace.file ? timing_now_us() : 0;
+}
+
+void trace_end(const char *name, uint64_t start)
+{
+    if (trace.file == NULL)
+        return;
+
+    uint64_t now = timing_now_us();
+
+    if (!trace.buffered) {
+        write_span(getpid(), name, start, now - start);
+        return;
+    }
+
+    // Шаги сверх буфера отбрасываются: трасса не должна мешать запуску
+    if (trace.nbuf == TRACE_BUFFER_MAX)
+        return;
+
+    struct trace_event *ev = &trace.buf[trace.nbuf++];
+    snprintf(ev->name, sizeof(ev->name), "%s", name);
+    ev->ts = start;
+    ev->dur = now - start;
+}
+
+void trace_buffer(void)
+{
+    trace.buffered = 1;
+    trace.nbuf = 0;
+}
+
+int trace_take(struct trace_event *ev, int max)
+{
+    int n = trace.nbuf < max ? trace.nbuf : max;
+
+    memcpy(ev, trace.buf, n * sizeof(*ev));
+    trace.nbuf = 0;
+    return n;
+}
+
+void trace_emit(pid_t pid, const char *label,
+                const struct trace_event *ev, int n)
+{
+    if (trace.file == NULL)
+        return;
+
+    if (label)
+        write_process_name(pid, label);
+    for (int i = 0; i < n; i++)
+        write_span(pid, ev[i].name, ev[i].ts, ev[i].dur);
+}
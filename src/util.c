@@ -0,0 +1,51 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "../include/util.h"
+
+void die(const char *fmt, ...)
+{
+    va_list params;
+
+    va_start(params, fmt);
+    vfprintf(stderr, fmt, params);
+    va_end(params);
+    exit(1);
+}
+
+int fail(const char *fmt, ...)
+{
+    int err = errno ? errno : EIO;
+    va_list params;
+
+    errno = err;
+    va_start(params, fmt);
+    vfprintf(stderr, fmt, params);
+    va_end(params);
+
+    errno = err;
+    return -err;
+}
+
+int mkdirs(const char *path)
+{
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", path);
+
+    for (char *p = buf + 1; ; p++) {
+        if (*p != '/' && *p != '\0')
+            continue;
+
+        char c = *p;
+        *p = '\0';
+        if (mkdir(buf, 0755) && errno != EEXIST)
+            return fail("Failed to mkdir %s: %m\n", buf);
+        *p = c;
+        if (c == '\0')
+            return 0;
+    }
+}